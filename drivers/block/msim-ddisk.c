@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+
 #include <addrspace.h>
 #include <io.h>
 #include <config.h>
@@ -23,11 +24,35 @@
 #include <drivers/block/hd.h>
 #include <drivers/block/msim-ddisk.h>
 
-unsigned char msim_dd_dma[SECTOR_SIZE];
+/*
+ * Start a transfer of sector @sect from/to bus address @busaddr, and
+ * optionally wait for it.  Returns 0 if successful.
+ */
+static int __msim_dd_transfer(unsigned long paddr, size_t sect,
+    addr_t busaddr, uint32_t cmd, bool poll)
+{
+	write32(MSIM_DD_REG(paddr, MSIM_DD_DMAADDR), busaddr);
+	write32(MSIM_DD_REG(paddr, MSIM_DD_SECTOR), sect);
+	write32(MSIM_DD_REG(paddr, MSIM_DD_COMMAND), cmd);
+	if (!poll)
+		return 0;
+	while (!msim_dd_check_interrupt(paddr))
+		/* nothing */;
+	/* Clear interrupt */
+	msim_dd_ack_interrupt(paddr);
+	if (read32(MSIM_DD_REG(paddr, MSIM_DD_STAT)) & STAT_ERROR)
+		return -1;
+	return 0;
+}
 
-void msim_dd_init(unsigned long paddr)
+int msim_dd_check_interrupt(unsigned long paddr)
 {
-	write32(MSIM_DD_REG(paddr, MSIM_DD_DMAADDR), kva2pa(msim_dd_dma));
+	return !!(read32(MSIM_DD_REG(paddr, MSIM_DD_STAT)) & STAT_INTR);
+}
+
+void msim_dd_ack_interrupt(unsigned long paddr)
+{
+	write32(MSIM_DD_REG(paddr, MSIM_DD_COMMAND), CMD_ACK);
 }
 
 size_t msim_dd_get_sector_count(unsigned long paddr)
@@ -35,57 +60,104 @@ size_t msim_dd_get_sector_count(unsigned long paddr)
 	return read32(MSIM_DD_REG(paddr, MSIM_DD_SIZE));
 }
 
+#ifdef RAW /* baremetal driver */
+
+unsigned char msim_dd_dma[SECTOR_SIZE];
+
+void msim_dd_init(unsigned long paddr)
+{
+	write32(MSIM_DD_REG(paddr, MSIM_DD_DMAADDR), kva2pa(msim_dd_dma));
+}
+
 /*
  * Read sector, returns 0 if successful.
  */
 int msim_dd_read_sector(unsigned long paddr, size_t sect, void *buf, bool poll)
 {
-	write32(MSIM_DD_REG(paddr, MSIM_DD_DMAADDR), kva2pa(msim_dd_dma));
-	write32(MSIM_DD_REG(paddr, MSIM_DD_SECTOR), sect);
-	write32(MSIM_DD_REG(paddr, MSIM_DD_COMMAND), CMD_READ);
-	if (poll) {
-		while (!msim_dd_check_interrupt(paddr))
-			/* nothing */;
-		/* Clear interrupt */
-		msim_dd_ack_interrupt(paddr);
-		if (read32(MSIM_DD_REG(paddr, MSIM_DD_STAT)) & STAT_ERROR) {
-			return -1;
-		} else {
-			memcpy(buf, msim_dd_dma, SECTOR_SIZE);
-			return 0;
-		}
-	} else {
-		return 0;
-	}
+	if (__msim_dd_transfer(paddr, sect, kva2pa(msim_dd_dma), CMD_READ,
+	    poll) != 0)
+		return -1;
+	if (poll)
+		memcpy(buf, msim_dd_dma, SECTOR_SIZE);
+	return 0;
 }
 
 int msim_dd_write_sector(unsigned long paddr, size_t sect, void *buf, bool poll)
 {
 	memcpy(msim_dd_dma, buf, SECTOR_SIZE);
-	write32(MSIM_DD_REG(paddr, MSIM_DD_DMAADDR), kva2pa(msim_dd_dma));
-	write32(MSIM_DD_REG(paddr, MSIM_DD_SECTOR), sect);
-	write32(MSIM_DD_REG(paddr, MSIM_DD_COMMAND), CMD_WRITE);
-	if (poll) {
-		while (!msim_dd_check_interrupt(paddr))
-			/* nothing */;
-		/* Clear interrupt */
-		msim_dd_ack_interrupt(paddr);
-		if (read32(MSIM_DD_REG(paddr, MSIM_DD_STAT)) & STAT_ERROR)
-			return -1;
-		else
-			return 0;
-	} else {
+	return __msim_dd_transfer(paddr, sect, kva2pa(msim_dd_dma), CMD_WRITE,
+	    poll);
+}
+
+#else /* not RAW, or kernel driver */
+
+#include <aim/device.h>
+#include <aim/initcalls.h>
+#include <console.h>
+#include <dma.h>
+#include <errno.h>
+
+static struct blk_device __msim_dd;
+
+/*
+ * The disk DMAs whole sectors to 32-bit word-aligned physical addresses,
+ * so callers must hand in sector-aligned requests.  Buffers the disk can
+ * reach are used in place, dma_map() bounces the others.
+ */
+static ssize_t __msim_dd_rw(char *buf, size_t len, loff_t *pos, bool write)
+{
+	struct dma_buf dma = { .vaddr = buf, .size = len };
+	int dir = write ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	size_t sect = *pos / SECTOR_SIZE, done;
+	int ret = 0;
+
+	if (*pos % SECTOR_SIZE != 0 || len % SECTOR_SIZE != 0 ||
+	    ((size_t)buf & 0x3) != 0)
+		return -EINVAL;
+	if (len == 0)
 		return 0;
+	if (dma_map(&dma, DMA_LIMIT_32BIT, dir) != 0)
+		return -ENOMEM;
+	for (done = 0; done < len; done += SECTOR_SIZE, ++sect) {
+		ret = __msim_dd_transfer(__msim_dd.base, sect,
+		    dma.busaddr + done, write ? CMD_WRITE : CMD_READ, true);
+		if (ret != 0)
+			break;
 	}
+	dma_unmap(&dma, dir);
+	if (done == 0 && ret != 0)
+		return -EIO;
+	*pos += done;
+	return done;
 }
 
-int msim_dd_check_interrupt(unsigned long paddr)
+static ssize_t __msim_dd_readblk(struct file *file, char *buf, size_t len,
+    loff_t *pos)
 {
-	return !!(read32(MSIM_DD_REG(paddr, MSIM_DD_STAT)) & STAT_INTR);
+	return __msim_dd_rw(buf, len, pos, false);
 }
 
-void msim_dd_ack_interrupt(unsigned long paddr)
+static ssize_t __msim_dd_writeblk(struct file *file, const char *buf,
+    size_t len, loff_t *pos)
 {
-	write32(MSIM_DD_REG(paddr, MSIM_DD_COMMAND), CMD_ACK);
+	return __msim_dd_rw((char *)buf, len, pos, true);
+}
+
+static struct blk_device __msim_dd = {
+	.name = "block-msim",
+	.base = MSIM_DISK_PHYSADDR,
+	.blk_ops = {
+		.readblk = __msim_dd_readblk,
+		.writeblk = __msim_dd_writeblk,
+	},
+};
+
+static int __init(void)
+{
+	kputs("KERN: <block-msim> Initializing.\n");
+	return dev_add(&__msim_dd);
 }
 
+INITCALL_DEV(__init)
+
+#endif /* RAW */
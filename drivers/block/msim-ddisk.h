@@ -36,12 +36,16 @@
 #define CMD_WRITE	0x2
 #define CMD_READ	0x1
 
-void	msim_dd_init(unsigned long paddr);
-
 size_t	msim_dd_get_sector_count(unsigned long);
-int	msim_dd_read_sector(unsigned long, size_t, void *, bool);
-int	msim_dd_write_sector(unsigned long, size_t, void *, bool);
 int	msim_dd_check_interrupt(unsigned long);
 void	msim_dd_ack_interrupt(unsigned long);
 
+#ifdef RAW /* baremetal driver */
+
+void	msim_dd_init(unsigned long paddr);
+int	msim_dd_read_sector(unsigned long, size_t, void *, bool);
+int	msim_dd_write_sector(unsigned long, size_t, void *, bool);
+
+#endif /* RAW */
+
 #endif
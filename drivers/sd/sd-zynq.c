@@ -33,46 +33,13 @@
 /* FIXME zedboard uses SD0 only */
 #define SD_BASE	SD0_PHYSBASE
 
-void sd_init()
-{
-	uint16_t tmp16;
-	uint8_t tmp8;
-	/* reset */
-	write8(SD_BASE + SD_SW_RST_OFFSET, SD_SWRST_ALL_MASK);
-	while (read8(SD_BASE + SD_SW_RST_OFFSET) & SD_SWRST_ALL_MASK);
-
-	/* capabilities = read32(SD_BASE + SD_CAPS_OFFSET) */
-
-	/* enable internal clock */
-	tmp16 = SD_CC_SDCLK_FREQ_D128 | SD_CC_INT_CLK_EN;
-	write16(SD_BASE + SD_CLK_CTRL_OFFSET, tmp16);
-	while (!(read16(SD_BASE + SD_CLK_CTRL_OFFSET) & SD_CC_INT_CLK_STABLE));
-
-	/* enable SD clock */
-	tmp16 = read16(SD_BASE + SD_CLK_CTRL_OFFSET) | SD_CC_SD_CLK_EN;
-	write16(SD_BASE + SD_CLK_CTRL_OFFSET, tmp16);
-	
-	/* enable bus power */
-	tmp8 = SD_PC_BUS_VSEL_3V3 | SD_PC_BUS_PWR;
-	write8(SD_BASE + SD_POWER_CTRL_OFFSET, tmp8);
-	write8(SD_BASE + SD_HOST_CTRL1_OFFSET, SD_HC_DMA_SDMA);
-	/*
-	 * Xilinx's driver uses ADMA2 by default, we use single-operation
-	 * DMA to avoid putting descriptors in memory.
-	 */
-
-	/* enable interrupt status except card */
-	tmp16 = SD_NORM_INTR_ALL & (~SD_INTR_CARD);
-	write16(SD_BASE + SD_NORM_INTR_STS_EN_OFFSET, tmp16);
-	write16(SD_BASE + SD_ERR_INTR_STS_EN_OFFSET, SD_ERR_INTR_ALL);
+#else /* not RAW, or kernel driver */
 
-	/* but disable all interrupt signals */
-	write16(SD_BASE + SD_NORM_INTR_SIG_EN_OFFSET, 0x0);
-	write16(SD_BASE + SD_ERR_INTR_SIG_EN_OFFSET, 0x0);
+/* FIXME zedboard uses SD0 only, mapped by sd_early_init() */
+static size_t __sd_base;
+#define SD_BASE	__sd_base
 
-	/* set block size to 512 */
-	write16(SD_BASE + SD_BLK_SIZE_OFFSET, 512);
-}
+#endif /* RAW */
 
 /* add descriptions to a command */
 uint16_t sd_frame_cmd(uint16_t cmd)
@@ -177,73 +144,6 @@ int sd_send_cmd(uint16_t cmd, uint16_t count, uint32_t arg, int mode)
 	return 0;
 }
 
-/*
- * initialize a memory card
- * card inserted into SD slot can be MMC, SDIO, SD(SC/HC/XC)-(memory/combo).
- * we want a SD(SC/HC)-memory here. if we see a combo, we ignore the sdio.
- * 1 = good SDHC
- * 0 = good SD(SC)
- * -1 = no card
- * -2 = error sending CMD0
- * -3 = error sending CMD8
- * -4 = CMD8 response bad
- * -5 = error sending CMD55 & ACMD41
- * -6 = error sending CMD2
- * -7 = error sending CMD3
- * -8 = error sending CMD9
- * -9 = error sending CMD7
- */
-
-int sd_init_card()
-{
-	uint32_t state, resp;
-	int ret, cardtype;
-	/* check card */
-	state = read32(SD_BASE + SD_PRES_STATE_OFFSET);
-	if (!(state & SD_PSR_CARD_INSRT)) return -1;
-	/* wait 74 clocks (of sd controller). */
-	usleep(2000);
-	/* CMD0 */
-	ret = sd_send_cmd(SD_CMD0, 0, 0, 0);
-	if (ret) return -2;
-	/* CMD8 */
-	ret = sd_send_cmd(SD_CMD8, 0, SD_CMD8_VOL_PATTERN, 0);
-	if (ret) return -3;
-	resp = read32(SD_BASE + SD_RESP0_OFFSET);
-	if (resp != SD_CMD8_VOL_PATTERN) return -4;
-	/* CMD55 & ACMD41 */
-	do {
-		ret = sd_send_cmd(SD_CMD55, 0, 0, 0);
-		if (ret) return -5;
-		ret = sd_send_cmd(SD_ACMD41, 0, \
-			(SD_ACMD41_HCS | SD_ACMD41_3V3), 0);
-		if (ret) return -5;
-		resp = read32(SD_BASE + SD_RESP0_OFFSET);
-	} while (!(resp & SD_RESP_READY));
-	/* SD or SDHC? */
-	if (resp & SD_ACMD41_HCS) cardtype = 1; /* SDHC */
-	else cardtype = 0; /* SD(SC) */
-	/* assume S18A(OR) good and go on to CMD2 */
-	ret = sd_send_cmd(SD_CMD2, 0, 0, 0);
-	if (ret) return -6;
-	/* response0-3 contains cardID */
-	/* CMD3 */
-	do {
-		ret = sd_send_cmd(SD_CMD3, 0, 0, 0);
-		if (ret) return -7;
-		resp = read32(SD_BASE + SD_RESP0_OFFSET) & 0xFFFF0000;
-	} while (resp == 0);
-	/* response0(high 16bit) contains card RCA */
-	/* CMD9 for specs, we don't use this now */
-	ret = sd_send_cmd(SD_CMD9, 0, resp, 0);
-	if (ret) return -8;
-	/* response0-3 contains cardSpecs */
-	/* CMD7 */
-	ret = sd_send_cmd(SD_CMD7, 0, resp, 0);
-	if (ret) return -9;
-	return cardtype;
-}
-
 /*
  * read block from memory card
  * utilize basic DMA (known as SDMA in documents)
@@ -346,7 +246,215 @@ int sd_write(uint32_t pa, uint16_t count, uint32_t offset)
 	return 0;
 }
 
+#ifdef RAW /* baremetal driver */
+
+void sd_init()
+{
+	uint16_t tmp16;
+	uint8_t tmp8;
+	/* reset */
+	write8(SD_BASE + SD_SW_RST_OFFSET, SD_SWRST_ALL_MASK);
+	while (read8(SD_BASE + SD_SW_RST_OFFSET) & SD_SWRST_ALL_MASK);
+
+	/* capabilities = read32(SD_BASE + SD_CAPS_OFFSET) */
+
+	/* enable internal clock */
+	tmp16 = SD_CC_SDCLK_FREQ_D128 | SD_CC_INT_CLK_EN;
+	write16(SD_BASE + SD_CLK_CTRL_OFFSET, tmp16);
+	while (!(read16(SD_BASE + SD_CLK_CTRL_OFFSET) & SD_CC_INT_CLK_STABLE));
+
+	/* enable SD clock */
+	tmp16 = read16(SD_BASE + SD_CLK_CTRL_OFFSET) | SD_CC_SD_CLK_EN;
+	write16(SD_BASE + SD_CLK_CTRL_OFFSET, tmp16);
+	
+	/* enable bus power */
+	tmp8 = SD_PC_BUS_VSEL_3V3 | SD_PC_BUS_PWR;
+	write8(SD_BASE + SD_POWER_CTRL_OFFSET, tmp8);
+	write8(SD_BASE + SD_HOST_CTRL1_OFFSET, SD_HC_DMA_SDMA);
+	/*
+	 * Xilinx's driver uses ADMA2 by default, we use single-operation
+	 * DMA to avoid putting descriptors in memory.
+	 */
+
+	/* enable interrupt status except card */
+	tmp16 = SD_NORM_INTR_ALL & (~SD_INTR_CARD);
+	write16(SD_BASE + SD_NORM_INTR_STS_EN_OFFSET, tmp16);
+	write16(SD_BASE + SD_ERR_INTR_STS_EN_OFFSET, SD_ERR_INTR_ALL);
+
+	/* but disable all interrupt signals */
+	write16(SD_BASE + SD_NORM_INTR_SIG_EN_OFFSET, 0x0);
+	write16(SD_BASE + SD_ERR_INTR_SIG_EN_OFFSET, 0x0);
+
+	/* set block size to 512 */
+	write16(SD_BASE + SD_BLK_SIZE_OFFSET, 512);
+}
+
+/*
+ * initialize a memory card
+ * card inserted into SD slot can be MMC, SDIO, SD(SC/HC/XC)-(memory/combo).
+ * we want a SD(SC/HC)-memory here. if we see a combo, we ignore the sdio.
+ * 1 = good SDHC
+ * 0 = good SD(SC)
+ * -1 = no card
+ * -2 = error sending CMD0
+ * -3 = error sending CMD8
+ * -4 = CMD8 response bad
+ * -5 = error sending CMD55 & ACMD41
+ * -6 = error sending CMD2
+ * -7 = error sending CMD3
+ * -8 = error sending CMD9
+ * -9 = error sending CMD7
+ */
+
+int sd_init_card()
+{
+	uint32_t state, resp;
+	int ret, cardtype;
+	/* check card */
+	state = read32(SD_BASE + SD_PRES_STATE_OFFSET);
+	if (!(state & SD_PSR_CARD_INSRT)) return -1;
+	/* wait 74 clocks (of sd controller). */
+	usleep(2000);
+	/* CMD0 */
+	ret = sd_send_cmd(SD_CMD0, 0, 0, 0);
+	if (ret) return -2;
+	/* CMD8 */
+	ret = sd_send_cmd(SD_CMD8, 0, SD_CMD8_VOL_PATTERN, 0);
+	if (ret) return -3;
+	resp = read32(SD_BASE + SD_RESP0_OFFSET);
+	if (resp != SD_CMD8_VOL_PATTERN) return -4;
+	/* CMD55 & ACMD41 */
+	do {
+		ret = sd_send_cmd(SD_CMD55, 0, 0, 0);
+		if (ret) return -5;
+		ret = sd_send_cmd(SD_ACMD41, 0, \
+			(SD_ACMD41_HCS | SD_ACMD41_3V3), 0);
+		if (ret) return -5;
+		resp = read32(SD_BASE + SD_RESP0_OFFSET);
+	} while (!(resp & SD_RESP_READY));
+	/* SD or SDHC? */
+	if (resp & SD_ACMD41_HCS) cardtype = 1; /* SDHC */
+	else cardtype = 0; /* SD(SC) */
+	/* assume S18A(OR) good and go on to CMD2 */
+	ret = sd_send_cmd(SD_CMD2, 0, 0, 0);
+	if (ret) return -6;
+	/* response0-3 contains cardID */
+	/* CMD3 */
+	do {
+		ret = sd_send_cmd(SD_CMD3, 0, 0, 0);
+		if (ret) return -7;
+		resp = read32(SD_BASE + SD_RESP0_OFFSET) & 0xFFFF0000;
+	} while (resp == 0);
+	/* response0(high 16bit) contains card RCA */
+	/* CMD9 for specs, we don't use this now */
+	ret = sd_send_cmd(SD_CMD9, 0, resp, 0);
+	if (ret) return -8;
+	/* response0-3 contains cardSpecs */
+	/* CMD7 */
+	ret = sd_send_cmd(SD_CMD7, 0, resp, 0);
+	if (ret) return -9;
+	return cardtype;
+}
+
 #else /* not RAW, or kernel driver */
 
-#endif /* RAW */
+#include <aim/device.h>
+#include <aim/initcalls.h>
+#include <console.h>
+#include <dma.h>
+#include <errno.h>
+#include <mm.h>
+#include <mmu.h>
+#include <panic.h>
+#include <util.h>
+
+#define SD_SECTOR_SIZE	512
+/* SDMA stops at each boundary, which is 4K after controller reset */
+#define SD_SDMA_BOUNDARY	4096
+
+static struct blk_device __sd_zynq;
+
+/*
+ * sd_early_init()
+ * Map the controller.  The card itself was brought up by the firmware.
+ */
+void sd_early_init(void)
+{
+	size_t base = ALIGN_BELOW(SD0_PHYSBASE, ARM_SECT_SIZE);
+	size_t mapped;
+
+	mapped = early_mapping_add_kmmap(base, ARM_SECT_SIZE);
+	if (mapped == 0)
+		panic("Cannot map SD controller.\n");
+	__sd_base = mapped + SD0_PHYSBASE - base;
+}
+
+/*
+ * Offsets are in blocks as the firmware only boots from SDHC cards.
+ * Buffers must be sector aligned so that no sector straddles an SDMA
+ * boundary; each transfer stops at the next one.
+ */
+static ssize_t __sd_zynq_rw(char *buf, size_t len, loff_t *pos, bool write)
+{
+	struct dma_buf dma = { .vaddr = buf, .size = len };
+	int dir = write ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	uint32_t blk = *pos / SD_SECTOR_SIZE;
+	addr_t addr;
+	size_t done, l;
+	int ret = 0;
+
+	if (*pos % SD_SECTOR_SIZE != 0 || len % SD_SECTOR_SIZE != 0 ||
+	    (size_t)buf % SD_SECTOR_SIZE != 0)
+		return -EINVAL;
+	if (len == 0)
+		return 0;
+	if (dma_map(&dma, DMA_LIMIT_32BIT, dir) != 0)
+		return -ENOMEM;
+	for (done = 0; done < len; done += l, blk += l / SD_SECTOR_SIZE) {
+		addr = dma.busaddr + done;
+		l = min2(len - done,
+		    SD_SDMA_BOUNDARY - (addr & (SD_SDMA_BOUNDARY - 1)));
+		if (write)
+			ret = sd_write(addr, l / SD_SECTOR_SIZE, blk);
+		else
+			ret = sd_read(addr, l / SD_SECTOR_SIZE, blk);
+		if (ret != 0)
+			break;
+	}
+	dma_unmap(&dma, dir);
+	if (done == 0 && ret != 0)
+		return -EIO;
+	*pos += done;
+	return done;
+}
+
+static ssize_t __sd_zynq_readblk(struct file *file, char *buf, size_t len,
+    loff_t *pos)
+{
+	return __sd_zynq_rw(buf, len, pos, false);
+}
 
+static ssize_t __sd_zynq_writeblk(struct file *file, const char *buf,
+    size_t len, loff_t *pos)
+{
+	return __sd_zynq_rw((char *)buf, len, pos, true);
+}
+
+static struct blk_device __sd_zynq = {
+	.name = "sd-zynq",
+	.base = SD0_PHYSBASE,
+	.blk_ops = {
+		.readblk = __sd_zynq_readblk,
+		.writeblk = __sd_zynq_writeblk,
+	},
+};
+
+static int __init(void)
+{
+	kputs("KERN: <sd-zynq> Initializing.\n");
+	return dev_add(&__sd_zynq);
+}
+
+INITCALL_DEV(__init)
+
+#endif /* RAW */
@@ -19,15 +19,18 @@
 #ifndef _DRIVERS_SD_SD_H
 #define _DRIVERS_SD_SD_H
 
+int	sd_read(uint32_t pa, uint16_t count, uint32_t offset);
+int	sd_write(uint32_t pa, uint16_t count, uint32_t offset);
+
 #ifdef RAW /* baremetal driver */
 
 int	sd_init(void);
 int	sd_init_card(void);
-int	sd_read(uint32_t pa, uint16_t count, uint32_t offset);
-int	sd_write(uint32_t pa, uint16_t count, uint32_t offset);
 
 #else /* not RAW, or kernel driver */
 
+void	sd_early_init(void);
+
 #endif /* RAW */
 
 
@@ -75,9 +75,15 @@ void readdisk(size_t sector, size_t offset, void *buf, size_t len)
 
 	for (; len > 0; len -= l) {
 		l = min2(len, SECTOR_SIZE - offset);
-		if (sd_read((uint32_t)sector_buf, 1, sector) != 0)
-			fwpanic("read disk error\n");
-		memcpy(buf, (void *)&sector_buf[offset], l);
+		/* whole sectors go straight into @buf, caches are off here */
+		if (l == SECTOR_SIZE) {
+			if (sd_read((uint32_t)buf, 1, sector) != 0)
+				fwpanic("read disk error\n");
+		} else {
+			if (sd_read((uint32_t)sector_buf, 1, sector) != 0)
+				fwpanic("read disk error\n");
+			memcpy(buf, (void *)&sector_buf[offset], l);
+		}
 		offset = 0;
 		buf += l;
 		++sector;
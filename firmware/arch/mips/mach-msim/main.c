@@ -55,11 +55,19 @@ void readdisk(size_t sector, size_t offset, void *buf, size_t len)
 
 	for (; len > 0; len -= l) {
 		l = min2(len, SECTOR_SIZE - offset);
-		if (msim_dd_read_sector(MSIM_DISK_PHYSADDR,
-		    sector, sector_buf, true) < 0)
-			fwpanic("read disk error");
-		for (i = 0; i < l; ++i)
-			*(unsigned char *)(buf + i) = sector_buf[offset + i];
+		/* the driver copies whole sectors into @buf itself */
+		if (l == SECTOR_SIZE) {
+			if (msim_dd_read_sector(MSIM_DISK_PHYSADDR,
+			    sector, buf, true) < 0)
+				fwpanic("read disk error");
+		} else {
+			if (msim_dd_read_sector(MSIM_DISK_PHYSADDR,
+			    sector, sector_buf, true) < 0)
+				fwpanic("read disk error");
+			for (i = 0; i < l; ++i)
+				*(unsigned char *)(buf + i) =
+				    sector_buf[offset + i];
+		}
 		offset = 0;
 		buf += l;
 		++sector;
@@ -25,32 +25,139 @@
 
 #ifndef __ASSEMBLER__
 
-/* Spinlocks. Implemented by architectures. */
+/*
+ * Spinlocks. Implemented by architectures.
+ *
+ * These are ticket locks.  The upper half of a lock is the next ticket to
+ * hand out, the lower half the ticket being served.  A locker atomically
+ * takes a ticket and waits for its turn, so the lock goes around in the
+ * order it was asked for, and waiters only read the lock while spinning.
+ * Only the holder writes the lower half, with a plain halfword store.
+ */
 
 typedef unsigned int lock_t;
 #define UNLOCKED	0
-#define LOCKED		1
+
+#define LOCK_TICKET_SHIFT	16
+#define LOCK_OWNER_MASK		0xffff
+#define lock_owner(val)		((val) & LOCK_OWNER_MASK)
+#define lock_next(val)		((val) >> LOCK_TICKET_SHIFT)
+#define lock_held(val)		(lock_owner(val) != lock_next(val))
+
+/* the lower half of a lock in memory */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define lock_owner_half(lock)	(((volatile uint16_t *)(lock))[0])
+#else
+#define lock_owner_half(lock)	(((volatile uint16_t *)(lock))[1])
+#endif
 
 /* By initializing a lock, caller assumes no code is holding it. */
 void spinlock_init(lock_t *lock);
+void arch_spin_lock(lock_t *lock);
+/* arch_spin_unlock may contain instructions to send event */
+void arch_spin_unlock(lock_t *lock);
+
+/*
+ * Lock statistics, with --enable-lockstat.
+ *
+ * spin_lock() and spin_unlock() then go through kern/debug/lockstat.c,
+ * which keeps for each lock how often it was taken, how often it was
+ * found held, and how long it was waited for and held, in get_cycles()
+ * units.  lockstat_dump() prints what has been gathered so far and
+ * lockstat_reset() starts over.  Without it, both compile down to the
+ * architecture routines and the dump and reset do nothing.
+ */
+#ifdef LOCKSTAT
 void spin_lock(lock_t *lock);
-/* spin_unlock may contain instructions to send event */
 void spin_unlock(lock_t *lock);
+void lockstat_dump(void);
+void lockstat_reset(void);
+#else /* !LOCKSTAT */
+#define spin_lock(lock)		arch_spin_lock(lock)
+#define spin_unlock(lock)	arch_spin_unlock(lock)
+#define lockstat_dump()		do {} while (0)
+#define lockstat_reset()	do {} while (0)
+#endif /* LOCKSTAT */
+
+/*
+ * Reader-writer spinlocks. Implemented by architectures.
+ *
+ * The top bit is set by a writer, the rest counts readers inside.  Readers
+ * only get in while the top bit is clear, and a writer sets it before
+ * waiting for the readers to drain, so writers are not starved by a
+ * steady stream of readers.
+ */
+
+typedef unsigned int rwlock_t;
+#define RW_UNLOCKED	0
+#define RW_WRITER	0x80000000
+#define RW_READERS	(~RW_WRITER)
+
+void rwlock_init(rwlock_t *lock);
+void read_lock(rwlock_t *lock);
+void read_unlock(rwlock_t *lock);
+void write_lock(rwlock_t *lock);
+void write_unlock(rwlock_t *lock);
+
+/*
+ * Sequence locks.
+ *
+ * Writers serialize on the spinlock and bump the sequence number before
+ * and after changing the data, so it is odd while a write is going on.
+ * Readers never write anything: they copy what they need and try again
+ * if the sequence number changed meanwhile.
+ *	do {
+ *		seq = read_seqbegin(&sl);
+ *		... copy the data ...
+ *	} while (read_seqretry(&sl, seq));
+ * Good for small data read far more often than written, as long as the
+ * reader does not follow pointers a writer may free.
+ */
 
-/* Semaphore, implemented by architectures. */
 typedef struct {
-	int val;
-	int limit;
-} semaphore_t;
-
-void semaphore_init(semaphore_t *sem, int val);
-void semaphore_dec(semaphore_t *sem);
-/* semaphore_inc may contain instructions to send event */
-void semaphore_inc(semaphore_t *sem);
-#define semaphore_pass(sem) ({ \
-	semaphore_t *_sem = sem; \
-	semaphore_dec(_sem); \
-	semaphore_inc(_sem); })
+	unsigned int seq;
+	lock_t lock;
+} seqlock_t;
+
+#define SEQLOCK_UNLOCKED	{ .seq = 0, .lock = UNLOCKED }
+
+static inline void seqlock_init(seqlock_t *sl)
+{
+	sl->seq = 0;
+	spinlock_init(&sl->lock);
+}
+
+static inline void write_seqlock(seqlock_t *sl)
+{
+	spin_lock(&sl->lock);
+	++sl->seq;
+	SMP_DMB();
+}
+
+static inline void write_sequnlock(seqlock_t *sl)
+{
+	SMP_DMB();
+	++sl->seq;
+	spin_unlock(&sl->lock);
+}
+
+static inline unsigned int read_seqbegin(seqlock_t *sl)
+{
+	unsigned int seq;
+
+	while ((seq = *(volatile unsigned int *)&sl->seq) & 1)
+		/* writer inside */;
+	SMP_DMB();
+	return seq;
+}
+
+static inline bool read_seqretry(seqlock_t *sl, unsigned int seq)
+{
+	SMP_DMB();
+	return *(volatile unsigned int *)&sl->seq != seq;
+}
+
+/* Sleeping mutexes and semaphores are in mutex.h and semaphore.h */
 
 #endif /* !__ASSEMBLER__ */
 
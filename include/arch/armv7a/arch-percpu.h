@@ -0,0 +1,38 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ARCH_PERCPU_H
+#define _ARCH_PERCPU_H
+
+#ifndef __ASSEMBLER__
+
+/*
+ * TPIDRPRW holds the address of our struct percpu, which the trap entry
+ * code in vector.S relies on as well.
+ */
+static inline unsigned long __this_cpu_offset(void)
+{
+	char *this;
+
+	asm ("mrc	p15, 0, %0, c13, c0, 4" : "=r" (this));
+	return this - (char *)&cpu_data;
+}
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _ARCH_PERCPU_H */
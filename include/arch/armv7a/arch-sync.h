@@ -28,13 +28,23 @@
 #ifndef __ASSEMBLER__
 
 #define SMP_DMB() \
-	asm volatile ("dmb")
+	asm volatile ("dmb" : : : "memory")
 
 #define SMP_DSB() \
-	asm volatile ("dsb")
+	asm volatile ("dsb" : : : "memory")
 
 #define SMP_ISB() \
-	asm volatile ("isb")
+	asm volatile ("isb" : : : "memory")
+
+/* PMU cycle counter, started by arch_init() on each CPU */
+static inline unsigned long __get_cycles(void)
+{
+	unsigned long ccnt;
+
+	asm volatile ("mrc	p15, 0, %0, c9, c13, 0" : "=r" (ccnt));
+	return ccnt;
+}
+#define get_cycles()	__get_cycles()
 
 #endif /* __ASSEMBLER__ */
 
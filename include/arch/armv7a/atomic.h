@@ -24,54 +24,175 @@
 
 #ifndef __ASSEMBLER__
 
-/* counter += val */
-static inline void atomic_add(atomic_t *counter, uint32_t val)
+/*
+ * Relaxed primitives, see asm-generic/atomic.h.
+ * All are LDREX/STREX loops retrying until the exclusive store goes
+ * through; barriers are added by the generic wrappers.
+ */
+
+#define ARM_ATOMIC_FETCH_OP(name, insn) \
+static inline uint32_t atomic_fetch_##name##_relaxed(atomic_t *counter, \
+    uint32_t val) \
+{ \
+	register uint32_t old, new; \
+	int ret = ARM_STREX_FAIL; \
+\
+	while (ret != ARM_STREX_SUCCESS) { \
+		asm volatile ( \
+			"ldrex		%[old], [%[addr]];" \
+			insn "		%[new], %[old], %[val];" \
+			"strex		%[ret], %[new], [%[addr]];" \
+			: [old] "=&r" (old), \
+			  [new] "=&r" (new), \
+			  [ret] "=&r" (ret) \
+			: [val] "r" (val), \
+			  [addr] "r" (counter) \
+			: "memory" \
+		); \
+	} \
+	return old; \
+}
+
+ARM_ATOMIC_FETCH_OP(add, "add")
+ARM_ATOMIC_FETCH_OP(or, "orr")
+ARM_ATOMIC_FETCH_OP(and, "and")
+
+#undef ARM_ATOMIC_FETCH_OP
+
+static inline uint32_t atomic_xchg_relaxed(atomic_t *counter, uint32_t val)
+{
+	register uint32_t old;
+	int ret = ARM_STREX_FAIL;
+
+	while (ret != ARM_STREX_SUCCESS) {
+		asm volatile (
+			"ldrex		%[old], [%[addr]];"
+			"strex		%[ret], %[val], [%[addr]];"
+			: [old] "=&r" (old),
+			  [ret] "=&r" (ret)
+			: [val] "r" (val),
+			  [addr] "r" (counter)
+			: "memory"
+		);
+	}
+	return old;
+}
+
+static inline uint32_t atomic_cmpxchg_relaxed(atomic_t *counter,
+    uint32_t old, uint32_t new)
+{
+	register uint32_t prev;
+	int ret = ARM_STREX_FAIL;
+
+	/* a mismatch leaves ret at success, and we give up */
+	while (ret != ARM_STREX_SUCCESS) {
+		asm volatile (
+			"ldrex		%[prev], [%[addr]];"
+			"mov		%[ret], %[success];"
+			"teq		%[prev], %[old];"
+			"strexeq	%[ret], %[new], [%[addr]];"
+			: [prev] "=&r" (prev),
+			  [ret] "=&r" (ret)
+			: [old] "r" (old),
+			  [new] "r" (new),
+			  [success] "i" (ARM_STREX_SUCCESS),
+			  [addr] "r" (counter)
+			: "cc", "memory"
+		);
+	}
+	return prev;
+}
+
+/*
+ * 64-bit counters use LDREXD/STREXD on an even/odd register pair; %H
+ * names the second register of a pair.  LDREXD alone is a single-copy
+ * atomic load.
+ */
+static inline uint64_t atomic64_read(atomic64_t *counter)
 {
-	register int reg;
+	register uint64_t val;
+
+	asm volatile (
+		"ldrexd		%[val], %H[val], [%[addr]];"
+		: [val] "=&r" (val)
+		: [addr] "r" (counter)
+	);
+	return val;
+}
+
+static inline uint64_t atomic64_xchg_relaxed(atomic64_t *counter,
+    uint64_t val)
+{
+	register uint64_t old;
 	int ret = ARM_STREX_FAIL;
 
-	while (ret == ARM_STREX_FAIL) {
-		SMP_DMB();
+	while (ret != ARM_STREX_SUCCESS) {
 		asm volatile (
-			"ldrex		%[reg], [%[addr]];"
-			"add		%[reg], %[reg], %[val];"
-			"strex		%[ret], %[reg], [%[addr]];"
-			/* STREX happens only at signed less or equal. */
-			: [reg] "=r" (reg),
-			  [ret] "=r" (ret)
-			: [val] "i" (val),
+			"ldrexd		%[old], %H[old], [%[addr]];"
+			"strexd		%[ret], %[val], %H[val], [%[addr]];"
+			: [old] "=&r" (old),
+			  [ret] "=&r" (ret)
+			: [val] "r" (val),
 			  [addr] "r" (counter)
+			: "memory"
 		);
 	}
-	SMP_DMB();
+	return old;
 }
 
-/* counter -= val */
-static inline void atomic_sub(atomic_t *counter, uint32_t val)
+#define atomic64_set(counter, val) \
+	((void)atomic64_xchg_relaxed(counter, val))
+
+static inline uint64_t atomic64_fetch_add_relaxed(atomic64_t *counter,
+    uint64_t val)
 {
-	register int reg;
+	register uint64_t old, new;
 	int ret = ARM_STREX_FAIL;
 
-	while (ret == ARM_STREX_FAIL) {
-		SMP_DMB();
+	while (ret != ARM_STREX_SUCCESS) {
 		asm volatile (
-			"ldrex		%[reg], [%[addr]];"
-			"sub		%[reg], %[reg], %[val];"
-			"strex		%[ret], %[reg], [%[addr]];"
-			/* STREX happens only at signed less or equal. */
-			: [reg] "=r" (reg),
-			  [ret] "=r" (ret)
-			: [val] "i" (val),
+			"ldrexd		%[old], %H[old], [%[addr]];"
+			"adds		%Q[new], %Q[old], %Q[val];"
+			"adc		%R[new], %R[old], %R[val];"
+			"strexd		%[ret], %[new], %H[new], [%[addr]];"
+			: [old] "=&r" (old),
+			  [new] "=&r" (new),
+			  [ret] "=&r" (ret)
+			: [val] "r" (val),
 			  [addr] "r" (counter)
+			: "cc", "memory"
 		);
 	}
-	SMP_DMB();
+	return old;
 }
 
-#define atomic_inc(x)	atomic_add((x), 1)
-#define atomic_dec(x)	atomic_sub((x), 1)
+static inline uint64_t atomic64_cmpxchg_relaxed(atomic64_t *counter,
+    uint64_t old, uint64_t new)
+{
+	register uint64_t prev;
+	int ret = ARM_STREX_FAIL;
+
+	while (ret != ARM_STREX_SUCCESS) {
+		asm volatile (
+			"ldrexd		%[prev], %H[prev], [%[addr]];"
+			"mov		%[ret], %[success];"
+			"teq		%[prev], %[old];"
+			"teqeq		%H[prev], %H[old];"
+			"strexdeq	%[ret], %[new], %H[new], [%[addr]];"
+			: [prev] "=&r" (prev),
+			  [ret] "=&r" (ret)
+			: [old] "r" (old),
+			  [new] "r" (new),
+			  [success] "i" (ARM_STREX_SUCCESS),
+			  [addr] "r" (counter)
+			: "cc", "memory"
+		);
+	}
+	return prev;
+}
 
 #endif /* !__ASSEMBLER__ */
 
-#endif /* _ATOMIC_H */
+#include <asm-generic/atomic.h>
 
+#endif /* _ATOMIC_H */
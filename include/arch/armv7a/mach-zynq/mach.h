@@ -20,6 +20,51 @@
 #define _MACH_H
 
 #define MPCORE_PHYSBASE	0xF8F00000
+/* the PL310 sits in the same 1MB as the MPCore private region */
+#define L2C_PHYSBASE	0xF8F02000
+
+/* PL310 setup, as recommended for Zynq-7000 */
+#define L2C_AUX_CTRL_VAL	0x72360000
+#define L2C_TAG_LATENCY_VAL	0x00000111
+#define L2C_DATA_LATENCY_VAL	0x00000121
+
+#define SLCR_PHYSBASE	0xF8000000
+#define SLCR_OFFSET_LOCK	0x004
+#define SLCR_OFFSET_UNLOCK	0x008
+#define SLCR_OFFSET_L2C_RAM	0xA1C
+#define SLCR_LOCK_KEY	0x767B
+#define SLCR_UNLOCK_KEY	0xDF0D
+/* must be written before the L2 cache is enabled */
+#define SLCR_L2C_RAM_VAL	0x00020202
+
+/* CPU1 waits in the BootROM for an address to show up here, then a SEV */
+#define CPU1_START_PHYSADDR	0xFFFFFFF0
+
+/* GIC, inside the MPCore private region */
+#define GICC_OFFSET		0x0100	/* CPU interface, banked per CPU */
+#define GICC_OFFSET_CTLR	0x00
+#define GICC_OFFSET_PMR		0x04
+#define GICC_OFFSET_IAR		0x0C
+#define GICC_OFFSET_EOIR	0x10
+#define GICD_OFFSET		0x1000	/* distributor */
+#define GICD_OFFSET_CTLR	0x000
+#define GICD_OFFSET_ISENABLER0	0x100
+#define GICD_OFFSET_SGIR	0xF00
+#define GIC_CTLR_EN		0x1
+#define GIC_PMR_ALL		0xF0	/* lowest priority the A9 implements */
+#define GIC_IAR_ID(iar)		((iar) & 0x3FF)
+#define GIC_ID_SPURIOUS		1023
+#define GIC_SGIR_TARGET_SHIFT	16
+/* the software generated interrupt we use for IPIs */
+#define GIC_SGI_IPI		0
+
+#ifndef __ASSEMBLER__
+#include <sys/types.h>
+
+void smp_early_init(void);
+/* Take down an IPI if that is what came in, false otherwise */
+bool mach_ipi_ack(void);
+#endif /* !__ASSEMBLER__ */
 
 #endif /* _MACH_H */
 
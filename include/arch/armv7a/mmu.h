@@ -37,12 +37,37 @@
 #define kva2pa(kva)	((kva) + RAM_PHYSBASE - KERN_BASE)
 #define pa2kva(pa)	((pa) - RAM_PHYSBASE + KERN_BASE)
 
+/* whether @kva is in the physically contiguous kernel linear mapping */
+#define kva_is_linear(kva) \
+	((size_t)(kva) >= KERN_BASE && (size_t)(kva) < KMMAP_BASE)
+
+#define ARM_SUPERSECT_SHIFT	24
+#define ARM_SUPERSECT_SIZE	(1 << ARM_SUPERSECT_SHIFT)
 #define ARM_SECT_SHIFT	20
 #define ARM_SECT_SIZE	(1 << ARM_SECT_SHIFT)
+#define ARM_LARGE_PAGE_SHIFT	16
+#define ARM_LARGE_PAGE_SIZE	(1 << ARM_LARGE_PAGE_SHIFT)
 #define ARM_PAGE_SHIFT	12
 #define ARM_PAGE_SIZE	(1 << ARM_PAGE_SHIFT)
 
 #define PAGE_SIZE	ARM_PAGE_SIZE
+/* transparent huge pages are sections */
+#define HPAGE_SIZE	ARM_SECT_SIZE
+
+/* CONTEXTIDR carries an 8-bit ASID */
+#define NR_ASIDS	256
+
+/* SCTLR bits turned on along with the MMU */
+#define ARM_SCTLR_M		(1 << 0)
+#define ARM_SCTLR_C		(1 << 2)
+#define ARM_SCTLR_Z		(1 << 11)
+#define ARM_SCTLR_I		(1 << 12)
+
+/*
+ * TTBR0 walk attributes: inner and outer write-back write-allocate,
+ * shareable, inner shareable (IRGN is split into bits 0 and 6).
+ */
+#define ARM_TTB_FLAGS		0x6A
 
 #define ARM_PT_AP_USER_NONE	0x1
 #define ARM_PT_AP_USER_READ	0x2
@@ -50,6 +75,12 @@
 
 #define ARM_PT_L1_TABLE_BASE_MASK	0xFFFFFC00
 #define ARM_PT_L1_SECT_BASE_MASK	0xFFF00000
+#define ARM_PT_L1_SUPERSECT_BASE_MASK	0xFF000000
+
+/* bit 18 tells supersections from sections, both are of type SECT */
+#define ARM_PT_L1_SUPERSECT	(1 << 18)
+/* not global, i.e. tagged with current ASID */
+#define ARM_PT_L1_NG		(1 << 17)
 
 #define ARM_PT_L1_TYPE_MASK	0x3
 #define ARM_PT_L1_RES		0x3
@@ -58,8 +89,19 @@
 #define ARM_PT_L1_FREE		0x0
 
 #define ARM_PT_L2_PAGE_BASE_MASK	0xFFFFF000
+#define ARM_PT_L2_LARGE_BASE_MASK	0xFFFF0000
 
+/* bit 0 of a small page entry is XN, so only bit 1 tells the type */
 #define ARM_PT_L2_PAGE		0x2
+#define ARM_PT_L2_LARGE		0x1
+#define ARM_PT_L2_FREE		0x0
+#define ARM_PT_L2_NG		(1 << 11)
+
+/*
+ * Supersections and large pages must be repeated in 16 consecutive entries
+ * of their tables.
+ */
+#define ARM_PT_REPEAT		16
 
 #ifndef __ASSEMBLER__
 
@@ -104,6 +146,10 @@ void page_index_clear(pgindex_t * index);
 int page_index_early_map(pgindex_t * index, addr_t paddr, size_t vaddr,
 	size_t length);
 
+/* Cortex-A9 cache and coherency setup, see cache.c */
+void cache_early_init(void);
+void cache_init(void);
+
 #endif
 
 #endif /* _ARCH_MMU_H */
@@ -0,0 +1,43 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ARCH_SMP_H
+#define _ARCH_SMP_H
+
+#ifndef __ASSEMBLER__
+
+/* from kernel */
+#include <sys/types.h>
+
+/* CPU ID inside the cluster, from MPIDR */
+static inline unsigned int __cpuid(void)
+{
+	uint32_t mpidr;
+
+	asm volatile (
+		"mrc	p15, 0, %[mpidr], c0, c0, 5"
+		: [mpidr] "=r" (mpidr)
+	);
+	return mpidr & 0x3;
+}
+
+#define cpuid()		__cpuid()
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _ARCH_SMP_H */
@@ -0,0 +1,38 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ARCH_PERCPU_H
+#define _ARCH_PERCPU_H
+
+#ifndef __ASSEMBLER__
+
+/*
+ * %fs is loaded with the SEG_KCPU segment, whose base is our offset, so
+ * %fs-relative accesses to a per-CPU variable land in our copy.
+ */
+static inline unsigned long __this_cpu_offset(void)
+{
+	unsigned long offset;
+
+	asm ("movl	%%fs:%1, %0" : "=r" (offset) : "m" (cpu_data.offset));
+	return offset;
+}
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _ARCH_PERCPU_H */
@@ -19,5 +19,29 @@
 #ifndef _ARCH_SYNC_H
 #define _ARCH_SYNC_H
 
+#ifndef __ASSEMBLER__
+
+/*
+ * x86 keeps loads in order with loads and stores in order with stores,
+ * which is all the ordering our locks ask for, so we only need to stop
+ * the compiler.
+ */
+#define SMP_DMB() \
+	asm volatile ("" : : : "memory")
+
+/* The time stamp counter, its low half is plenty for short intervals */
+static inline unsigned long __get_cycles(void)
+{
+	unsigned long lo;
+
+	asm volatile ("rdtsc" : "=a" (lo) : : "edx");
+	return lo;
+}
+#define get_cycles()	__get_cycles()
+
+#endif /* __ASSEMBLER__ */
+
+#include <asm-generic/sync.h>
+
 #endif
 
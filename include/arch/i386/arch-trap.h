@@ -66,6 +66,7 @@ struct idtentry {
 #define IRQ_COM1	4
 #define IRQ_IDE		14
 #define IRQ_ERROR	19
+#define IRQ_IPI		20	// cross-CPU calls
 #define IRQ_SPURIOUS	31
 
 #endif
@@ -168,6 +168,18 @@ ltr(uint16_t selector)
 	);
 }
 
+static inline uint32_t
+rcr2(void)
+{
+	uint32_t val;
+
+	asm volatile (
+		"movl	%%cr2, %0"
+		: "=r"(val)
+	);
+	return val;
+}
+
 __noinline unsigned long get_pc(void);
 
 static inline uint32_t
@@ -185,4 +197,40 @@ xchg(volatile uint32_t *addr, uint32_t newval)
 	return result;
 }
 
+/* Atomically add @val to *@addr, returning the old value */
+static inline uint32_t
+xadd(volatile uint32_t *addr, uint32_t val)
+{
+	asm volatile(
+		"lock; xaddl %0, %1" :
+		"+r" (val), "+m" (*addr) :
+		:
+		"cc", "memory"
+	);
+	return val;
+}
+
+/*
+ * Atomically replace *@addr with @newval if it is @oldval.
+ * Returns what was in *@addr, equal to @oldval on success.
+ */
+static inline uint32_t
+cmpxchg(volatile uint32_t *addr, uint32_t oldval, uint32_t newval)
+{
+	asm volatile(
+		"lock; cmpxchgl %2, %1" :
+		"+a" (oldval), "+m" (*addr) :
+		"r" (newval) :
+		"cc", "memory"
+	);
+	return oldval;
+}
+
+/* Spin-wait hint, saves power and memory order violations */
+static inline void
+pause(void)
+{
+	asm volatile ("pause" : : : "memory");
+}
+
 #endif
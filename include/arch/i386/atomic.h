@@ -21,35 +21,130 @@
 
 #include <sys/types.h>
 
-/* counter += val */
-static inline void atomic_add(atomic_t *counter, uint32_t val)
+#ifndef __ASSEMBLER__
+
+/*
+ * Relaxed primitives, see asm-generic/atomic.h.
+ * Locked instructions are full barriers on x86 anyway, so these are
+ * really ordered; the generic wrappers only add compiler barriers.
+ */
+
+static inline uint32_t atomic_fetch_add_relaxed(atomic_t *counter,
+    uint32_t val)
 {
+	asm volatile (
+		"lock xaddl	%0, %1"
+		: "+r" (val), "+m" (*counter)
+		:
+		: "cc", "memory"
+	);
+	return val;
 }
 
-/* counter -= val */
-static inline void atomic_sub(atomic_t *counter, uint32_t val)
+static inline uint32_t atomic_xchg_relaxed(atomic_t *counter, uint32_t val)
 {
+	/* xchg with memory is always locked */
+	asm volatile (
+		"xchgl	%0, %1"
+		: "+r" (val), "+m" (*counter)
+		:
+		: "memory"
+	);
+	return val;
 }
 
-/* counter++ */
-static inline void atomic_inc(atomic_t *counter)
+static inline uint32_t atomic_cmpxchg_relaxed(atomic_t *counter,
+    uint32_t old, uint32_t new)
 {
-	uint32_t reg;
 	asm volatile (
-		"lock incl	%0"
-		: "+m" (*counter)
+		"lock cmpxchgl	%2, %1"
+		: "+a" (old), "+m" (*counter)
+		: "r" (new)
+		: "cc", "memory"
 	);
+	return old;
 }
 
-/* counter-- */
-static inline void atomic_dec(atomic_t *counter)
+static inline uint32_t atomic_fetch_or_relaxed(atomic_t *counter,
+    uint32_t val)
+{
+	uint32_t old, prev = *(volatile atomic_t *)counter;
+
+	do {
+		old = prev;
+		prev = atomic_cmpxchg_relaxed(counter, old, old | val);
+	} while (prev != old);
+	return old;
+}
+
+static inline uint32_t atomic_fetch_and_relaxed(atomic_t *counter,
+    uint32_t val)
+{
+	uint32_t old, prev = *(volatile atomic_t *)counter;
+
+	do {
+		old = prev;
+		prev = atomic_cmpxchg_relaxed(counter, old, old & val);
+	} while (prev != old);
+	return old;
+}
+
+/*
+ * 64-bit counters go through cmpxchg8b.  It wants the new value in
+ * %ecx:%ebx, but %ebx holds the GOT pointer in PIE code, so we pass the
+ * low half in %esi and swap it in and out around the instruction.
+ */
+static inline uint64_t atomic64_cmpxchg_relaxed(atomic64_t *counter,
+    uint64_t old, uint64_t new)
 {
-	uint32_t reg;
 	asm volatile (
-		"lock decl	%0"
-		: "+m" (*counter)
+		"xchgl	%%ebx, %%esi;"
+		"lock cmpxchg8b	(%[addr]);"
+		"xchgl	%%ebx, %%esi;"
+		: "+A" (old)
+		: [addr] "D" (counter),
+		  "S" ((uint32_t)new),
+		  "c" ((uint32_t)(new >> 32))
+		: "cc", "memory"
 	);
+	return old;
+}
+
+/* A 64-bit load is not atomic, but a failing cmpxchg8b is */
+static inline uint64_t atomic64_read(atomic64_t *counter)
+{
+	return atomic64_cmpxchg_relaxed(counter, 0, 0);
+}
+
+static inline uint64_t atomic64_xchg_relaxed(atomic64_t *counter,
+    uint64_t val)
+{
+	uint64_t old, prev = *(volatile atomic64_t *)counter;
+
+	do {
+		old = prev;
+		prev = atomic64_cmpxchg_relaxed(counter, old, val);
+	} while (prev != old);
+	return old;
 }
 
-#endif
+#define atomic64_set(counter, val) \
+	((void)atomic64_xchg_relaxed(counter, val))
+
+static inline uint64_t atomic64_fetch_add_relaxed(atomic64_t *counter,
+    uint64_t val)
+{
+	uint64_t old, prev = *(volatile atomic64_t *)counter;
+
+	do {
+		old = prev;
+		prev = atomic64_cmpxchg_relaxed(counter, old, old + val);
+	} while (prev != old);
+	return old;
+}
+
+#endif /* !__ASSEMBLER__ */
+
+#include <asm-generic/atomic.h>
 
+#endif /* _ATOMIC_H */
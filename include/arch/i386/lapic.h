@@ -0,0 +1,72 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LAPIC_H
+#define _LAPIC_H
+
+#define LAPIC_PHYSBASE		0xFEE00000
+
+/* register offsets */
+#define LAPIC_OFFSET_ID		0x020
+#define LAPIC_OFFSET_TPR	0x080
+#define LAPIC_OFFSET_EOI	0x0B0
+#define LAPIC_OFFSET_SVR	0x0F0
+#define LAPIC_OFFSET_ICRLO	0x300
+#define LAPIC_OFFSET_ICRHI	0x310
+
+#define LAPIC_SVR_ENABLE	0x00000100
+#define LAPIC_SVR_SPURIOUS	0xFF	/* vector of spurious interrupts */
+
+#define LAPIC_ICR_FIXED		0x00000000
+#define LAPIC_ICR_INIT		0x00000500
+#define LAPIC_ICR_STARTUP	0x00000600
+#define LAPIC_ICR_BUSY		0x00001000	/* delivery status */
+#define LAPIC_ICR_ASSERT	0x00004000
+#define LAPIC_ICR_LEVEL		0x00008000
+#define LAPIC_ICR_DEST_SHIFT	24		/* in ICRHI */
+
+#ifndef __ASSEMBLER__
+
+#include <sys/types.h>
+#include <io.h>
+
+/* virtual address of the local APIC, 0 until the MMU is on */
+extern size_t lapic_base;
+
+/*
+ * QEMU numbers the local APICs from 0 up, so the APIC ID is our CPU
+ * number.  Before the mapping is there, only the boot CPU runs.
+ */
+static inline unsigned int lapic_id(void)
+{
+	if (lapic_base == 0)
+		return 0;
+	return read32(lapic_base + LAPIC_OFFSET_ID) >> 24;
+}
+
+void lapic_early_init(void);
+void lapic_init(void);
+int lapic_start_cpu(int apicid, uint32_t entry);
+/* Interrupt @apicid with @vector */
+void lapic_send_ipi(int apicid, int vector);
+/* Acknowledge the interrupt being handled */
+void lapic_eoi(void);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _LAPIC_H */
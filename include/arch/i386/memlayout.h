@@ -41,6 +41,9 @@
 
 #define HIGHMEM_BASE		0x100000
 
+/* where secondary CPUs start in real mode, see smpboot.S */
+#define SMPBOOT_ADDR		0x7000
+
 #ifndef __ASSEMBLER__
 
 #pragma pack(1)
@@ -34,6 +34,9 @@
 /* kernel virtual address and physical address conversion */
 #define kva2pa(kva)		(ULCAST(kva) - KERN_BASE)
 #define pa2kva(pa)		(PTRCAST(pa) + KERN_BASE)
+/* whether @kva is in the physically contiguous kernel linear mapping */
+#define kva_is_linear(kva) \
+	(ULCAST(kva) >= KERN_BASE && ULCAST(kva) < KMMAP_BASE)
 
 #define PAGE_SHIFT	12
 #define PTX_SHIFT	PAGE_SHIFT
@@ -42,8 +45,10 @@
 #define XPAGE_SHIFT	22
 #define XPTX_SHIFT	XPAGE_SHIFT
 #define XPAGE_SIZE	(1 << XPAGE_SHIFT)	/* 4MB */
+#define HPAGE_SIZE	XPAGE_SIZE	/* transparent huge pages */
 
 #define NR_PTENTRIES	(1 << (PAGE_SHIFT - WORD_SHIFT))
+#define PTXMASK		(NR_PTENTRIES - 1)
 
 /* Page table flags */
 #define PTE_P		0x1		/* Present */
@@ -75,7 +80,7 @@
 #define mkpte(paddr, flags) \
 	(ALIGN_BELOW(paddr, PAGE_SIZE) | (flags))
 
-#define PTX(vaddr)	(ULCAST(vaddr) >> PTX_SHIFT)
+#define PTX(vaddr)	((ULCAST(vaddr) >> PTX_SHIFT) & PTXMASK)
 #define PDX(vaddr)	(ULCAST(vaddr) >> PDX_SHIFT)
 #define XPTX(vaddr)	(ULCAST(vaddr) >> XPTX_SHIFT)
 
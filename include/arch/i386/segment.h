@@ -17,6 +17,7 @@
 
 #define KERNEL_DS	(SEG_KDATA << 3)
 #define KERNEL_CS	(SEG_KCODE << 3)
+#define KERNEL_CPU	(SEG_KCPU << 3)
 
 #define NR_SEGMENTS	7
 
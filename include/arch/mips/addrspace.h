@@ -107,6 +107,17 @@ static inline unsigned long kva2pa(void *x)
 		return -1;	/* should be something like panic() */
 }
 
+/* whether @x is in an unmapped, hence physically contiguous, segment */
+static inline int kva_is_linear(void *x)
+{
+	unsigned long a = (unsigned long)x;
+#ifdef __LP64__
+	if (a >= XKPHY && a < XKSEG)
+		return 1;
+#endif
+	return a >= KSEG0 && a < KSSEG;
+}
+
 static inline void *pa2kva(unsigned long x)
 {
 #ifdef __LP64__	/* 64 bit */
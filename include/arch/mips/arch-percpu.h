@@ -0,0 +1,44 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ARCH_PERCPU_H
+#define _ARCH_PERCPU_H
+
+#ifndef __ASSEMBLER__
+
+#include <cp0regdef.h>
+#include <mipsregs.h>
+
+/*
+ * There are no KScratch registers on our machines, and k0/k1 belong to
+ * the exception handlers.  The upper bits of Context are free though, and
+ * tlb_init() keeps our CPU number there for the TLB refill handler; a
+ * CP0 read is much cheaper than asking the CPU number device.
+ */
+static inline unsigned long __this_cpu_offset(void)
+{
+#ifndef __LP64__
+	return __percpu_offset[read_c0_context() >> CONTEXT_CPUID_SHIFT];
+#else
+	return __percpu_offset[read_c0_xcontext() >> CONTEXT_CPUID_SHIFT];
+#endif
+}
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _ARCH_PERCPU_H */
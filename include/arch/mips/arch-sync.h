@@ -22,5 +22,23 @@
 #define smp_mb() \
 	asm volatile ("sync" : : : "memory")
 
+#ifndef __ASSEMBLER__
+
+#define SMP_DMB()	smp_mb()
+
+/* CP0 Count, which most cores run at half the pipeline clock */
+static inline unsigned long __get_cycles(void)
+{
+	unsigned int count;
+
+	asm volatile ("mfc0	%0, $9" : "=r" (count));
+	return count;
+}
+#define get_cycles()	__get_cycles()
+
+#endif /* __ASSEMBLER__ */
+
+#include <asm-generic/sync.h>
+
 #endif
 
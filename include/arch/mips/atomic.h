@@ -22,50 +22,219 @@
 #include <sys/types.h>
 #include <arch-sync.h>
 
-/* counter += val */
-static inline void atomic_add(atomic_t *counter, uint32_t val)
+#ifndef __ASSEMBLER__
+
+/*
+ * Relaxed primitives, see asm-generic/atomic.h.
+ * LL/SC loops; barriers are added by the generic wrappers.
+ */
+
+static inline uint32_t atomic_fetch_add_relaxed(atomic_t *counter,
+    uint32_t val)
+{
+	uint32_t old, new;
+	asm volatile (
+		"	.set	push;"
+		"	.set	reorder;"
+		"1:	ll	%[old], %[mem];"
+		"	addu	%[new], %[old], %[val];"
+		"	sc	%[new], %[mem];"
+		"	beqz	%[new], 1b;"
+		"	.set	pop;"
+		: [old] "=&r"(old), [new] "=&r"(new), [mem] "+m"(*counter)
+		: [val] "r"(val)
+	);
+	return old;
+}
+
+static inline uint32_t atomic_fetch_or_relaxed(atomic_t *counter,
+    uint32_t val)
+{
+	uint32_t old, new;
+	asm volatile (
+		"	.set	push;"
+		"	.set	reorder;"
+		"1:	ll	%[old], %[mem];"
+		"	or	%[new], %[old], %[val];"
+		"	sc	%[new], %[mem];"
+		"	beqz	%[new], 1b;"
+		"	.set	pop;"
+		: [old] "=&r"(old), [new] "=&r"(new), [mem] "+m"(*counter)
+		: [val] "r"(val)
+	);
+	return old;
+}
+
+static inline uint32_t atomic_fetch_and_relaxed(atomic_t *counter,
+    uint32_t val)
 {
+	uint32_t old, new;
+	asm volatile (
+		"	.set	push;"
+		"	.set	reorder;"
+		"1:	ll	%[old], %[mem];"
+		"	and	%[new], %[old], %[val];"
+		"	sc	%[new], %[mem];"
+		"	beqz	%[new], 1b;"
+		"	.set	pop;"
+		: [old] "=&r"(old), [new] "=&r"(new), [mem] "+m"(*counter)
+		: [val] "r"(val)
+	);
+	return old;
 }
 
-/* counter -= val */
-static inline void atomic_sub(atomic_t *counter, uint32_t val)
+static inline uint32_t atomic_xchg_relaxed(atomic_t *counter, uint32_t val)
 {
+	uint32_t old, tmp;
+	asm volatile (
+		"	.set	push;"
+		"	.set	reorder;"
+		"1:	ll	%[old], %[mem];"
+		"	move	%[tmp], %[val];"
+		"	sc	%[tmp], %[mem];"
+		"	beqz	%[tmp], 1b;"
+		"	.set	pop;"
+		: [old] "=&r"(old), [tmp] "=&r"(tmp), [mem] "+m"(*counter)
+		: [val] "r"(val)
+	);
+	return old;
+}
+
+static inline uint32_t atomic_cmpxchg_relaxed(atomic_t *counter,
+    uint32_t old, uint32_t new)
+{
+	uint32_t prev, tmp;
+	asm volatile (
+		"	.set	push;"
+		"	.set	reorder;"
+		"1:	ll	%[prev], %[mem];"
+		"	bne	%[prev], %[old], 2f;"
+		"	move	%[tmp], %[new];"
+		"	sc	%[tmp], %[mem];"
+		"	beqz	%[tmp], 1b;"
+		"2:	.set	pop;"
+		: [prev] "=&r"(prev), [tmp] "=&r"(tmp), [mem] "+m"(*counter)
+		: [old] "r"(old), [new] "r"(new)
+	);
+	return prev;
 }
 
-/* counter++ */
-static inline void atomic_inc(atomic_t *counter)
+#ifdef __LP64__
+
+/* 64-bit counters, LLD/SCD */
+
+#define atomic64_read(counter)	(*(volatile atomic64_t *)(counter))
+#define atomic64_set(counter, val) \
+	(*(volatile atomic64_t *)(counter) = (val))
+
+static inline uint64_t atomic64_fetch_add_relaxed(atomic64_t *counter,
+    uint64_t val)
 {
-	uint32_t reg;
-	smp_mb();
+	uint64_t old, new;
 	asm volatile (
 		"	.set	push;"
 		"	.set	reorder;"
-		"1:	ll	%[reg], %[mem];"
-		"	addu	%[reg], 1;"
-		"	sc	%[reg], %[mem];"
-		"	beqz	%[reg], 1b;"
+		"1:	lld	%[old], %[mem];"
+		"	daddu	%[new], %[old], %[val];"
+		"	scd	%[new], %[mem];"
+		"	beqz	%[new], 1b;"
 		"	.set	pop;"
-		: [reg] "=&r"(reg), [mem] "+m"(*counter)
+		: [old] "=&r"(old), [new] "=&r"(new), [mem] "+m"(*counter)
+		: [val] "r"(val)
 	);
-	smp_mb();
+	return old;
 }
 
-/* counter-- */
-static inline void atomic_dec(atomic_t *counter)
+static inline uint64_t atomic64_xchg_relaxed(atomic64_t *counter,
+    uint64_t val)
 {
-	uint32_t reg;
-	smp_mb();
+	uint64_t old, tmp;
 	asm volatile (
 		"	.set	push;"
 		"	.set	reorder;"
-		"1:	ll	%[reg], %[mem];"
-		"	addu	%[reg], -1;"
-		"	sc	%[reg], %[mem];"
-		"	beqz	%[reg], 1b;"
+		"1:	lld	%[old], %[mem];"
+		"	move	%[tmp], %[val];"
+		"	scd	%[tmp], %[mem];"
+		"	beqz	%[tmp], 1b;"
 		"	.set	pop;"
-		: [reg] "=&r"(reg), [mem] "+m"(*counter)
+		: [old] "=&r"(old), [tmp] "=&r"(tmp), [mem] "+m"(*counter)
+		: [val] "r"(val)
 	);
-	smp_mb();
+	return old;
+}
+
+static inline uint64_t atomic64_cmpxchg_relaxed(atomic64_t *counter,
+    uint64_t old, uint64_t new)
+{
+	uint64_t prev, tmp;
+	asm volatile (
+		"	.set	push;"
+		"	.set	reorder;"
+		"1:	lld	%[prev], %[mem];"
+		"	bne	%[prev], %[old], 2f;"
+		"	move	%[tmp], %[new];"
+		"	scd	%[tmp], %[mem];"
+		"	beqz	%[tmp], 1b;"
+		"2:	.set	pop;"
+		: [prev] "=&r"(prev), [tmp] "=&r"(tmp), [mem] "+m"(*counter)
+		: [old] "r"(old), [new] "r"(new)
+	);
+	return prev;
+}
+
+#else	/* !__LP64__ */
+
+/*
+ * MIPS32 has no 64-bit LL/SC, so 64-bit counters share one spinlock,
+ * taken with interrupts off.  It lives in kern/arch/mips/sync.c.
+ */
+
+#include <aim/sync.h>
+#include <irq.h>
+
+extern lock_t __atomic64_lock;
+
+#define __atomic64_locked(stmt) ({ \
+	unsigned long _flags; \
+	uint64_t _old; \
+	local_irq_save(_flags); \
+	spin_lock(&__atomic64_lock); \
+	_old = *counter; \
+	stmt; \
+	spin_unlock(&__atomic64_lock); \
+	local_irq_restore(_flags); \
+	_old; })
+
+static inline uint64_t atomic64_read(atomic64_t *counter)
+{
+	return __atomic64_locked((void)0);
 }
 
-#endif
+static inline uint64_t atomic64_xchg_relaxed(atomic64_t *counter,
+    uint64_t val)
+{
+	return __atomic64_locked(*counter = val);
+}
+
+#define atomic64_set(counter, val) \
+	((void)atomic64_xchg_relaxed(counter, val))
+
+static inline uint64_t atomic64_fetch_add_relaxed(atomic64_t *counter,
+    uint64_t val)
+{
+	return __atomic64_locked(*counter = _old + val);
+}
+
+static inline uint64_t atomic64_cmpxchg_relaxed(atomic64_t *counter,
+    uint64_t old, uint64_t new)
+{
+	return __atomic64_locked(if (_old == old) *counter = new);
+}
+
+#endif	/* __LP64__ */
+
+#endif /* !__ASSEMBLER__ */
+
+#include <asm-generic/atomic.h>
+
+#endif /* _ATOMIC_H */
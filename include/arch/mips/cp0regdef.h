@@ -198,4 +198,19 @@
 
 #define EBASE_CPUNUM_MASK	0x3ff
 
+/*
+ * Context (XContext on 64-bit) register.  Hardware fills in BadVPN2
+ * (bits 13 and up of the faulting address, placed at bit 4) on TLB
+ * exceptions and leaves PTEBase to software, where we keep the CPU ID.
+ * On 64-bit, BadVPN2 and the two region bits above it grow with SEGBITS,
+ * which tlb_init() checks against the hardware.
+ */
+#define CONTEXT_BADVPN2_SHIFT	4
+#define CONTEXT_VA_SHIFT	9	/* BadVPN2 holds (va >> 13) << 4 */
+#ifndef __LP64__
+#define CONTEXT_CPUID_SHIFT	23
+#else
+#define CONTEXT_CPUID_SHIFT	(MIPS_SEGBITS - 7)
+#endif
+
 #endif
@@ -69,4 +69,24 @@
 #define LOONGSON3A_MMAP_AVAILABLE_MASK	0xf0
 #define LOONGSON3A_MMAP_PORTMASK	0x7
 
+/*
+ * Per-core inter-processor interrupt registers.  The mailboxes double as
+ * the boot protocol of PMON: a waiting core loads sp, gp and a1 from
+ * mailboxes 1 to 3 and jumps to mailbox 0 once it is non-zero.
+ */
+#define LOONGSON3A_CORES		4
+#define LOONGSON3A_COREx_IPI_BASE(x)	(0x3ff01000 + (x) * 0x100)
+#define LOONGSON3A_IPI_OFFSET_STATUS	0x00
+#define LOONGSON3A_IPI_OFFSET_ENABLE	0x04
+#define LOONGSON3A_IPI_OFFSET_SET	0x08
+#define LOONGSON3A_IPI_OFFSET_CLEAR	0x0c
+#define LOONGSON3A_IPI_OFFSET_MAILBOX(n)	(0x20 + (n) * 8)
+#define LOONGSON3A_MAILBOX_PC		0
+#define LOONGSON3A_MAILBOX_SP		1
+#define LOONGSON3A_MAILBOX_GP		2
+#define LOONGSON3A_MAILBOX_A1		3
+/* IPIs come in on this hardware interrupt; we only use bit 0 */
+#define LOONGSON3A_IPI_IRQ		6
+#define LOONGSON3A_IPI_CALL		0x1
+
 #endif
@@ -29,8 +29,15 @@
 #include <io.h>
 #include <addrspace.h>
 
+/*
+ * Reading the CPUID register gives our CPU number, writing a CPU mask to
+ * it raises the IPI on those CPUs.  Writing a mask to the IPI register
+ * takes it down again.
+ */
 #define MSIM_ORDER_REG_CPUID	0x0
 #define MSIM_ORDER_REG_IPI	0x4
+/* the hardware interrupt dorder is wired to in msim.conf */
+#define MSIM_ORDER_IRQ		6
 #define MSIM_ORDER_MAILBOX_SIZE	(1 << MSIM_ORDER_MAILBOX_ORDER)
 
 /*
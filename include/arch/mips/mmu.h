@@ -27,6 +27,9 @@
 #define PAGE_SIZE	(1 << PAGE_SHIFT)
 #define PAGE_MASK	(PAGE_SIZE - 1)
 
+/* EntryHi carries an 8-bit ASID */
+#define NR_ASIDS	256
+
 #ifndef __ASSEMBLER__
 
 #include <sys/types.h>
@@ -43,7 +43,9 @@
 /*
  * The header is included by a C header/source.
  */
-inline unsigned int __cpuid(void)
+#include <mipsregs.h>
+
+static inline unsigned int __cpuid(void)
 {
 	return read_c0_ebase() & EBASE_CPUNUM_MASK;
 }
@@ -61,4 +63,11 @@ inline unsigned int __cpuid(void)
 
 #endif	/* Rev. */
 
+#ifndef __ASSEMBLER__
+#include <sys/types.h>
+
+/* Take down the IPI of this CPU, false if it was not up.  By machines. */
+bool mach_ipi_ack(void);
+#endif	/* !__ASSEMBLER__ */
+
 #endif
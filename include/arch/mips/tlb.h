@@ -29,6 +29,17 @@
 #define tlbwr()		asm volatile ("tlbwr")
 #define tlbwi()		asm volatile ("tlbwi")
 
+/*
+ * TLB instructions must see the CP0 registers written before them, and
+ * reads after tlbp must see its result.  Release 2 clears the hazard with
+ * ehb, older cores need superscalar nops to drain the pipeline.
+ */
+#if __mips_isa_rev >= 2
+#define tlb_hazard()	asm volatile ("ehb" ::: "memory")
+#else
+#define tlb_hazard()	asm volatile ("ssnop; ssnop; ssnop" ::: "memory")
+#endif
+
 /*
  * IMPORTANT NOTE:
  * MIPS TLB doesn't allow duplicate virtual pages, so one should always
@@ -39,9 +50,19 @@
  * Other MIPS CPUs may shutdown TLB, or, in the extreme, HCF(?).
  */
 #define ENTRYHI_DUMMY(idx) ((idx) << (PAGE_SHIFT + 1))
+#define ENTRYHI_ASID_MASK	(NR_ASIDS - 1)
+#define ENTRYHI_VPN2(vaddr)	((vaddr) & ~((PAGE_SIZE << 1) - 1))
 
+/* Flush local TLB and prepare Context for the refill handler */
+void tlb_init(void);
+/* Both operate on the local TLB only, and preserve current ASID */
 void tlb_flush(void);
+/* Drop the entry for @vaddr in current address space, if any */
 void tlb_remove(addr_t vaddr);
+/* Load the page pair holding @vaddr, replacing the entry there if any */
+void tlb_write(addr_t vaddr, unsigned long lo0, unsigned long lo1);
+/* Load the page pair holding kernel address @vaddr from kern_pgindex() */
+int tlb_refill_kern(void *vaddr);
 
 #if __mips_isa_rev == 1
 extern int get_tlb_entries(void);	/* machine specific */
@@ -0,0 +1,189 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASM_GENERIC_ATOMIC_H
+#define _ASM_GENERIC_ATOMIC_H
+
+/*
+ * Atomic operations built on top of the architecture.
+ *
+ * Each arch atomic.h provides the unordered (relaxed) primitives:
+ *	atomic_fetch_add_relaxed(counter, val)
+ *	atomic_fetch_or_relaxed(counter, val)
+ *	atomic_fetch_and_relaxed(counter, val)
+ *	atomic_xchg_relaxed(counter, val)
+ *	atomic_cmpxchg_relaxed(counter, old, new)
+ *	atomic64_read(counter), atomic64_set(counter, val)
+ *	atomic64_fetch_add_relaxed(counter, val)
+ *	atomic64_xchg_relaxed(counter, val)
+ *	atomic64_cmpxchg_relaxed(counter, old, new)
+ * All of them return what the counter held before, and cmpxchg stores
+ * @new only if that was @old.
+ *
+ * From these we make the ordered variants.  An _acquire operation comes
+ * before every later memory access, a _release operation after every
+ * earlier one, and the plain names are ordered both ways.
+ */
+
+#ifndef __ASSEMBLER__
+
+#include <arch-sync.h>
+
+#define __acquire_op(op) ({ \
+	typeof(op) _r = (op); \
+	SMP_DMB(); \
+	_r; })
+#define __release_op(op) ({ \
+	SMP_DMB(); \
+	(op); })
+#define __fence_op(op) ({ \
+	typeof(op) _r; \
+	SMP_DMB(); \
+	_r = (op); \
+	SMP_DMB(); \
+	_r; })
+
+#define atomic_read(counter)	(*(volatile atomic_t *)(counter))
+#define atomic_set(counter, val) \
+	(*(volatile atomic_t *)(counter) = (val))
+
+#define atomic_fetch_add_acquire(c, v)	__acquire_op(atomic_fetch_add_relaxed(c, v))
+#define atomic_fetch_add_release(c, v)	__release_op(atomic_fetch_add_relaxed(c, v))
+#define atomic_fetch_add(c, v)		__fence_op(atomic_fetch_add_relaxed(c, v))
+
+#define atomic_fetch_or_acquire(c, v)	__acquire_op(atomic_fetch_or_relaxed(c, v))
+#define atomic_fetch_or_release(c, v)	__release_op(atomic_fetch_or_relaxed(c, v))
+#define atomic_fetch_or(c, v)		__fence_op(atomic_fetch_or_relaxed(c, v))
+
+#define atomic_fetch_and_acquire(c, v)	__acquire_op(atomic_fetch_and_relaxed(c, v))
+#define atomic_fetch_and_release(c, v)	__release_op(atomic_fetch_and_relaxed(c, v))
+#define atomic_fetch_and(c, v)		__fence_op(atomic_fetch_and_relaxed(c, v))
+
+#define atomic_xchg_acquire(c, v)	__acquire_op(atomic_xchg_relaxed(c, v))
+#define atomic_xchg_release(c, v)	__release_op(atomic_xchg_relaxed(c, v))
+#define atomic_xchg(c, v)		__fence_op(atomic_xchg_relaxed(c, v))
+
+#define atomic_cmpxchg_acquire(c, o, n)	__acquire_op(atomic_cmpxchg_relaxed(c, o, n))
+#define atomic_cmpxchg_release(c, o, n)	__release_op(atomic_cmpxchg_relaxed(c, o, n))
+#define atomic_cmpxchg(c, o, n)		__fence_op(atomic_cmpxchg_relaxed(c, o, n))
+
+/* Arithmetics, returning the old or the new value */
+#define atomic_fetch_sub_relaxed(c, v)	atomic_fetch_add_relaxed(c, -(v))
+#define atomic_fetch_sub(c, v)		atomic_fetch_add(c, -(v))
+
+#define atomic_add_return_relaxed(c, v) ({ \
+	uint32_t _v = (v); \
+	atomic_fetch_add_relaxed(c, _v) + _v; })
+#define atomic_add_return(c, v) ({ \
+	uint32_t _v = (v); \
+	atomic_fetch_add(c, _v) + _v; })
+#define atomic_sub_return_relaxed(c, v) ({ \
+	uint32_t _v = (v); \
+	atomic_fetch_add_relaxed(c, -_v) - _v; })
+#define atomic_sub_return(c, v) ({ \
+	uint32_t _v = (v); \
+	atomic_fetch_add(c, -_v) - _v; })
+#define atomic_inc_return(c)		atomic_add_return(c, 1)
+#define atomic_dec_return(c)		atomic_sub_return(c, 1)
+
+#define atomic_add(c, v)		((void)atomic_fetch_add(c, v))
+#define atomic_sub(c, v)		((void)atomic_fetch_sub(c, v))
+#define atomic_inc(c)			atomic_add(c, 1)
+#define atomic_dec(c)			atomic_sub(c, 1)
+
+/* Drop a reference, true if it was the last one */
+#define atomic_dec_and_test(c)		(atomic_dec_return(c) == 0)
+
+/*
+ * Bit operations on arrays of atomic_t.
+ * Setting and clearing are unordered, testing ones are fully ordered.
+ * The _lock and _unlock pair is for using a bit as a lock.
+ */
+#define __atomic_word(nr, addr)	((addr) + (nr) / 32)
+#define __atomic_mask(nr)	(1u << ((nr) % 32))
+
+static inline void atomic_set_bit(int nr, atomic_t *addr)
+{
+	atomic_fetch_or_relaxed(__atomic_word(nr, addr), __atomic_mask(nr));
+}
+
+static inline void atomic_clear_bit(int nr, atomic_t *addr)
+{
+	atomic_fetch_and_relaxed(__atomic_word(nr, addr), ~__atomic_mask(nr));
+}
+
+static inline bool atomic_test_bit(int nr, atomic_t *addr)
+{
+	return (atomic_read(__atomic_word(nr, addr)) & __atomic_mask(nr)) != 0;
+}
+
+static inline bool atomic_test_and_set_bit(int nr, atomic_t *addr)
+{
+	return (atomic_fetch_or(__atomic_word(nr, addr),
+	    __atomic_mask(nr)) & __atomic_mask(nr)) != 0;
+}
+
+static inline bool atomic_test_and_clear_bit(int nr, atomic_t *addr)
+{
+	return (atomic_fetch_and(__atomic_word(nr, addr),
+	    ~__atomic_mask(nr)) & __atomic_mask(nr)) != 0;
+}
+
+static inline bool atomic_test_and_set_bit_lock(int nr, atomic_t *addr)
+{
+	return (atomic_fetch_or_acquire(__atomic_word(nr, addr),
+	    __atomic_mask(nr)) & __atomic_mask(nr)) != 0;
+}
+
+static inline void atomic_clear_bit_unlock(int nr, atomic_t *addr)
+{
+	atomic_fetch_and_release(__atomic_word(nr, addr), ~__atomic_mask(nr));
+}
+
+/* 64-bit counters */
+#define atomic64_fetch_add_acquire(c, v) \
+	__acquire_op(atomic64_fetch_add_relaxed(c, v))
+#define atomic64_fetch_add_release(c, v) \
+	__release_op(atomic64_fetch_add_relaxed(c, v))
+#define atomic64_fetch_add(c, v)	__fence_op(atomic64_fetch_add_relaxed(c, v))
+
+#define atomic64_xchg_acquire(c, v)	__acquire_op(atomic64_xchg_relaxed(c, v))
+#define atomic64_xchg_release(c, v)	__release_op(atomic64_xchg_relaxed(c, v))
+#define atomic64_xchg(c, v)		__fence_op(atomic64_xchg_relaxed(c, v))
+
+#define atomic64_cmpxchg_acquire(c, o, n) \
+	__acquire_op(atomic64_cmpxchg_relaxed(c, o, n))
+#define atomic64_cmpxchg_release(c, o, n) \
+	__release_op(atomic64_cmpxchg_relaxed(c, o, n))
+#define atomic64_cmpxchg(c, o, n)	__fence_op(atomic64_cmpxchg_relaxed(c, o, n))
+
+#define atomic64_fetch_sub(c, v)	atomic64_fetch_add(c, -(v))
+#define atomic64_add_return(c, v) ({ \
+	uint64_t _v = (v); \
+	atomic64_fetch_add(c, _v) + _v; })
+#define atomic64_sub_return(c, v) ({ \
+	uint64_t _v = (v); \
+	atomic64_fetch_add(c, -_v) - _v; })
+#define atomic64_add(c, v)		((void)atomic64_fetch_add(c, v))
+#define atomic64_sub(c, v)		((void)atomic64_fetch_sub(c, v))
+#define atomic64_inc(c)			atomic64_add(c, 1)
+#define atomic64_dec(c)			atomic64_sub(c, 1)
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _ASM_GENERIC_ATOMIC_H */
@@ -49,6 +49,14 @@
 #define SMP_ISB()
 #endif
 
+/*
+ * A free running cycle counter, for measuring short intervals.  It may
+ * wrap, so only differences mean anything.
+ */
+#ifndef get_cycles
+#define get_cycles()	0UL
+#endif
+
 #endif /* __ASSEMBLER__ */
 
 #endif /* _ASM_GENERIC_SYNC_H */
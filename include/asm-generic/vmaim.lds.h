@@ -20,6 +20,7 @@
 #define _ASM_GENERIC_VMAIM_LDS_H
 
 #include <aim/export.h>
+#include <util.h>
 
 #define LOAD_OFFSET	(KERN_BASE - KERN_PHYSBASE)
 
@@ -48,6 +49,19 @@
 	. = ALIGN((align));						\
 	*(.data)
 
+/*
+ * Per-CPU data, see percpu.h.  This copy belongs to the boot CPU, the
+ * others get theirs at boot.  Lines are kept whole so that nothing else
+ * shares them.
+ */
+#define PERCPU							\
+	. = ALIGN(CACHELINE_SIZE);					\
+	SYMBOL(__percpu_start) = .;					\
+	*(.data.percpu.first)						\
+	*(.data.percpu)							\
+	. = ALIGN(CACHELINE_SIZE);					\
+	SYMBOL(__percpu_end) = .;
+
 #define __INIT_SECTIONS(sec, align)					\
 	. = ALIGN((align));						\
 	SYMBOL(sec##_init_start) = .;					\
@@ -0,0 +1,76 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DMA_H
+#define _DMA_H
+
+#include <sys/types.h>
+
+#ifndef __ASSEMBLER__
+
+/*
+ * DMA mapping layer.
+ *
+ * Drivers hand kernel buffers to devices through dma_map() and take them
+ * back with dma_unmap().  In between, the buffer belongs to the device and
+ * the CPU must not touch it.  Mapping does the cache maintenance needed on
+ * non-coherent architectures and returns the address the device should use.
+ *
+ * Buffers in the kernel linear mapping whose physical addresses fall below
+ * the device's limit are used in place.  Anything else (vmalloc() and kmmap
+ * areas, memory the device cannot address) goes through a bounce buffer.
+ *
+ * Buffers should be cache line aligned: lines partially covered by a
+ * DMA_FROM_DEVICE buffer are invalidated as a whole after the transfer.
+ */
+
+#define DMA_TO_DEVICE		1
+#define DMA_FROM_DEVICE		2
+#define DMA_BIDIRECTIONAL	(DMA_TO_DEVICE | DMA_FROM_DEVICE)
+
+/* Devices with 32-bit address registers */
+#define DMA_LIMIT_32BIT		0xFFFFFFFFULL
+
+struct dma_buf {
+	void	*vaddr;		/* kernel virtual address, set by caller */
+	size_t	size;		/* set by caller */
+	addr_t	busaddr;	/* for the device, set by dma_map() */
+	/* private */
+	void	*bounce;
+	addr_t	bounce_paddr;
+};
+
+/*
+ * Make @buf available to a device which can address up to @limit
+ * inclusive, for transfers in direction @dir.
+ * Returns 0 on success, or -ENOMEM if a bounce buffer is needed but none
+ * can be found below @limit.
+ */
+int dma_map(struct dma_buf *buf, addr_t limit, int dir);
+/* Give @buf back to the CPU once the device is done with it. */
+void dma_unmap(struct dma_buf *buf, int dir);
+
+/*
+ * Scatter list variants.  On failure nothing is left mapped.
+ */
+int dma_map_sg(struct dma_buf *sg, int nents, addr_t limit, int dir);
+void dma_unmap_sg(struct dma_buf *sg, int nents, int dir);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _DMA_H */
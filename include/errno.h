@@ -68,5 +68,6 @@
 #define	EROFS		30		/* Read-only file system */
 #define	EMLINK		31		/* Too many links */
 #define	EPIPE		32		/* Broken pipe */
+#define	ETIMEDOUT	60		/* Operation timed out */
 
 #endif
@@ -26,7 +26,7 @@ typedef signed long loff_t;
 
 struct inode {
 	/* TODO */
-	int dummy;
+	atomic_t refs;	/* held by the page cache, among others */
 };
 
 struct file {
@@ -43,7 +43,8 @@ struct file_ops {
 	//int (*readdir)(struct file *, void *, filldir_t);
 	//unsigned int (*poll)(struct file *, struct poll_table_struct *);
 	int (*ioctl)(struct file *, unsigned int, unsigned int, unsigned long);
-	//int (*mmap)(struct file *, struct vm_area_struct *);
+	/* optional, may refuse mapping with VMA flags, see mmap_uvm() */
+	int (*mmap)(struct file *, uint32_t);
 	int (*open)(struct inode *, struct file *);
 	//int (*flush)(struct file *);
 	int (*release)(struct inode *, struct file *);
@@ -19,9 +19,22 @@
 #ifndef _INIT_H
 #define _INIT_H
 
+#include <sys/types.h>
+
 void early_arch_init(void);
 void early_mach_init(void);
 
+/* per-CPU part of the architecture, run by every CPU on its way up */
 void arch_init(void);
 
+/*
+ * Secondary CPUs, see kern/init/smp.c.
+ * arch_start_cpu() kicks @cpu into slave_entry, or fails with -ENODEV if
+ * there is no such CPU.
+ */
+void smp_startup(void);
+int arch_start_cpu(int cpu);
+void set_cpu_online(int cpu);
+bool cpu_online(int cpu);
+
 #endif
@@ -0,0 +1,86 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IPI_H
+#define _IPI_H
+
+#include <sys/types.h>
+#include <atomic.h>
+
+#ifndef __ASSEMBLER__
+
+/*
+ * Cross-CPU function calls
+ *
+ * Each CPU has a lock-free queue of requests to it.  A caller queues one
+ * request for each target and raises an IPI only if the target had
+ * nothing pending, so a burst of calls to a CPU costs it one interrupt,
+ * in which ipi_handler() runs everything queued.  Functions run on the
+ * target with interrupts off and must not sleep.
+ *
+ * Each CPU keeps one request per target, so a new call to a CPU waits
+ * for its previous one to finish, even when that was made without @wait.
+ * While waiting we run calls made to us, so two CPUs calling each other
+ * do not get stuck.  Not for interrupt handlers.
+ */
+
+typedef struct {
+	atomic_t bits[(NR_CPUS + 31) / 32];
+} cpumask_t;
+
+#define cpumask_set_cpu(cpu, mask)	atomic_set_bit((cpu), (mask)->bits)
+#define cpumask_clear_cpu(cpu, mask)	atomic_clear_bit((cpu), (mask)->bits)
+#define cpumask_test_cpu(cpu, mask)	atomic_test_bit((cpu), (mask)->bits)
+
+static inline void cpumask_clear(cpumask_t *mask)
+{
+	int i;
+
+	for (i = 0; i < (NR_CPUS + 31) / 32; ++i)
+		atomic_set(&mask->bits[i], 0);
+}
+
+/* Run @func(@arg) on @cpu, which may be us.  -ENODEV if it is not up. */
+int smp_call_function_single(int cpu, void (*func)(void *arg), void *arg,
+    bool wait);
+/* Run @func(@arg) on the other online CPUs in @mask */
+void smp_call_function_many(cpumask_t *mask, void (*func)(void *arg),
+    void *arg, bool wait);
+/* Run @func(@arg) on all other online CPUs */
+void smp_call_function(void (*func)(void *arg), void *arg, bool wait);
+/* Same, and on this CPU as well */
+void on_each_cpu(void (*func)(void *arg), void *arg, bool wait);
+
+/*
+ * Run the calls queued to this CPU.  The arch code calls it on an IPI,
+ * after taking the interrupt down; it may also be polled with interrupts
+ * off.
+ */
+void ipi_handler(void);
+
+/*
+ * Implemented by architectures or machines.
+ * arch_ipi_init() lets the calling CPU take IPIs, which still arrive only
+ * while its interrupts are on.  arch_send_ipi() raises one on @cpu.
+ */
+void arch_ipi_init(void);
+void arch_send_ipi(int cpu);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _IPI_H */
@@ -0,0 +1,58 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _KSM_H
+#define _KSM_H
+
+#include <sys/types.h>
+
+#ifndef __ASSEMBLER__
+
+struct vma;
+
+/*
+ * Same-page merging
+ * Anonymous pages of VMAs created with VMA_MERGEABLE are scanned for
+ * identical contents, and identical pages end up sharing one read-only
+ * frame until somebody writes.  Merging is off until ksm_set_enabled().
+ */
+
+struct ksm_stats {
+	size_t	pages_scanned;	/* candidates looked at, all passes */
+	size_t	pages_merged;	/* frames given up by merging, all time */
+	size_t	pages_shared;	/* frames shared right now */
+	size_t	pages_sharing;	/* mappings of those frames right now */
+	size_t	full_scans;	/* passes over all candidates */
+};
+
+void ksm_set_enabled(bool enabled);
+/*
+ * Scan up to @budget candidate pages, continuing where the last call
+ * stopped.  Meant to be called periodically, e.g. from the idle loop; the
+ * budget is the rate limit.  Returns the number of pages merged.
+ */
+size_t ksm_scan(size_t budget);
+void ksm_get_stats(struct ksm_stats *stats);
+
+/* Hooks for the VMA code */
+void ksm_track(struct vma *vma);
+void ksm_forget(struct vma *vma);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _KSM_H */
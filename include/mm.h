@@ -30,6 +30,9 @@
 
 #ifndef __ASSEMBLER__
 
+#include <file.h>
+#include <ipi.h>
+
 /* premap_addr: always returns low address.
  * The function which assumes that the argument is a high address
  * becomes __premap_addr(). */
@@ -70,11 +73,14 @@ struct early_mapping {
 void early_mapping_clear(void);
 size_t early_mapping_add_memory(addr_t base, size_t size);
 size_t early_mapping_add_kmmap(addr_t base, size_t size);
+size_t early_mapping_kmmap_top(void);
 int early_mapping_add(struct early_mapping *entry);
 struct early_mapping *early_mapping_next(struct early_mapping *base);
 
 int page_index_init(pgindex_t *boot_page_index);
 int mmu_init(pgindex_t *boot_page_index);
+/* the page index built at boot, holding every kernel mapping */
+pgindex_t *kern_pgindex(void);
 
 void early_mm_init(void);	/* arch-specific */
 
@@ -141,11 +147,39 @@ struct vma {
 #define VMA_READ	0x04
 	/* More flags */
 #define VMA_FILE	0x100		/* For mmap(2) */
+#define VMA_MERGEABLE	0x200		/* Candidate for same-page merging */
+#define VMA_GROWSDOWN	0x400		/* Stack, grows on faults below */
+#define VMA_SHARED	0x800		/* Writes go to the file */
+	/* Access pattern, MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL */
+	unsigned int	advice;
 	/* Since we are not maintaining a list for all physical pages, we
 	 * have to keep a struct pages pointer with struct vma in case of
 	 * shared memory. */
 	struct pages	*pages;
 	struct list_head node;
+
+	/* Backing of VMA_FILE pages, see kern/mm/pagecache.c */
+	struct file	*file;
+	loff_t		offset;		/* of this page in @file */
+
+	/* Page reclaim, see kern/mm/reclaim.c */
+	struct mm	*mm;		/* owner */
+	unsigned int	lru;		/* reclaim and demand-zero state */
+#define VMA_LRU_NONE		0	/* not reclaimable, always mapped */
+#define VMA_LRU_ACTIVE		1	/* mapped */
+#define VMA_LRU_INACTIVE	2	/* resident, unmapped to catch access */
+#define VMA_LRU_SWAPPED		3	/* no frame, contents in swap slot */
+#define VMA_LRU_UNTOUCHED	4	/* no frame, nothing mapped yet */
+#define VMA_LRU_ZERO		5	/* no frame, zero page mapped read-only */
+#define VMA_LRU_HUGE		6	/* frame is part of a huge page */
+#define VMA_LRU_IO		7	/* off the lists, being unmapped or swapped */
+	unsigned long	swap;		/* swap slot, 0 if none */
+	struct list_head lru_node;
+
+	/* Same-page merging, see kern/mm/ksm.c */
+	struct list_head ksm_node;	/* on the scan list */
+	struct list_head ksm_hash_node;	/* in the unstable table */
+	uint32_t	ksm_hash;	/* checksum at last scan */
 };
 
 struct mm {
@@ -153,6 +187,8 @@ struct mm {
 	size_t		vma_count;	/* number of virtual memory areas */
 	size_t		ref_count;	/* reference count (may be unused) */
 	pgindex_t	*pgindex;	/* pointer to page index */
+	unsigned long	asid;		/* ASID with generation, 0 if none */
+	cpumask_t	cpus;		/* CPUs that may cache its TLB entries */
 };
 
 /*
@@ -160,7 +196,10 @@ struct mm {
  * All addresses should be page-aligned.
  * Note that these interfaces are independent of struct mm and struct vma,
  */
-/* Initialize a page index table and fill in the structure @pgindex */
+/*
+ * Initialize a page index table and fill in the structure @pgindex.
+ * The kernel part is shared with kern_pgindex().
+ */
 pgindex_t *init_pgindex(void);
 /* Destroy the page index table itself assuming that everything underlying is
  * already done with */
@@ -173,7 +212,7 @@ void destroy_pgindex(pgindex_t *pgindex);
 #define	MAP_KERN_MEM	0x10000
 #define MAP_PRIV_DEV	0x20000	/* eg. device on private bus */
 #define MAP_SHARED_DEV	0x30000	/* normal devices */
-#define MAP_LARGE	0x40000
+#define MAP_LARGE	0x40000	/* use large pages where aligned */
 int map_pages(pgindex_t *pgindex, void *vaddr, addr_t paddr, size_t size,
     uint32_t flags);
 /*
@@ -183,6 +222,63 @@ int map_pages(pgindex_t *pgindex, void *vaddr, addr_t paddr, size_t size,
  * The physical address of unmapped pages are stored in @paddr.
  */
 ssize_t unmap_pages(pgindex_t *pgindex, void *vaddr, size_t size, addr_t *paddr);
+/*
+ * Same, but TLB entries of the range and emptied page tables are left
+ * alone, so that a batch of unmappings costs one tlb_flush_all().  Neither
+ * the frames nor the addresses may be reused before that.
+ */
+ssize_t unmap_pages_noflush(pgindex_t *pgindex, void *vaddr, size_t size,
+    addr_t *paddr);
+/* Drop every TLB entry, global ones included, on all CPUs */
+void tlb_flush_all(void);
+/*
+ * Free the page tables left empty by unmap_pages_noflush() over the range,
+ * once tlb_flush_all() has run.
+ */
+void free_empty_pgtables(pgindex_t *pgindex, void *vaddr, size_t size);
+/*
+ * Make kernel mappings made later in [@vaddr, @vaddr + @size) of
+ * kern_pgindex() show up in every page index.  Where the MMU walks the
+ * tables itself, this allocates them now, to be shared by init_pgindex()
+ * and never freed.
+ */
+int share_kern_pgtables(void *vaddr, size_t size);
+/*
+ * Change the permissions of already mapped pages to VMA flags @flags,
+ * keeping the physical frames.  Unmapped pages inside the range are left
+ * untouched.  Large pages partially covered by the range are split.
+ */
+int protect_pages(pgindex_t *pgindex, void *vaddr, size_t size,
+    uint32_t flags);
+/*
+ * Switch current CPU to address space @mm.  On architectures with
+ * ASID-tagged TLBs the TLB survives the switch.
+ */
+void arch_switch_mm(struct mm *mm);
+
+/*
+ * ASID allocator, for architectures defining NR_ASIDS.
+ * Returns the hardware ASID to run @mm with on current CPU, allocating one
+ * if @mm has none from the current generation.  If @flush is set on return,
+ * the local TLB must be flushed before the ASID is used.
+ */
+unsigned long asid_switch(struct mm *mm, bool *flush);
+/* Forget @mm in the allocator before it is destroyed */
+void asid_release(struct mm *mm);
+/* Take the ASID of @mm away, so that its next switch gets a new one */
+void asid_retire(struct mm *mm);
+
+/*
+ * Data cache maintenance on a range of the kernel linear mapping, for
+ * memory shared with DMA masters.
+ * clean: write dirty lines back, before a device reads the memory.
+ * inval: drop cached lines, before the CPU reads what a device wrote.
+ * flush: both.
+ * No-ops where DMA is coherent with CPU caches.
+ */
+void dcache_clean_range(void *vaddr, size_t size);
+void dcache_inval_range(void *vaddr, size_t size);
+void dcache_flush_range(void *vaddr, size_t size);
 
 /*
  * Architecture-independent interfaces
@@ -190,8 +286,37 @@ ssize_t unmap_pages(pgindex_t *pgindex, void *vaddr, size_t size, addr_t *paddr)
  */
 /* Create a size @len user space mapping starting at virtual address @addr */
 int create_uvm(struct mm *mm, void *addr, size_t len, uint32_t flags);
+/*
+ * Map @len bytes of @file starting at page-aligned @offset to @addr.
+ * Pages come from the page cache on first access, shared with every other
+ * mapping of the file.  With VMA_SHARED, writes go to the cached page and
+ * are written back to the file when unmapped; otherwise the first write
+ * to a page gives the mapping a private copy.  @file must stay open as
+ * long as it is mapped.
+ */
+int mmap_uvm(struct mm *mm, void *addr, size_t len, uint32_t flags,
+    struct file *file, loff_t offset);
 /* Destroy a size @len user space mapping starting at @addr */
 int destroy_uvm(struct mm *mm, void *addr, size_t len);
+/*
+ * Tell the VM how a size @len user space mapping at @addr is going to be
+ * used:
+ * MADV_NORMAL, MADV_RANDOM, MADV_SEQUENTIAL: access pattern, deciding how
+ *   much is read ahead on a fault.
+ * MADV_WILLNEED: fault the pages in now.
+ * MADV_DONTNEED: drop the frames now.  Anonymous pages read as zeros
+ *   afterwards.
+ * MADV_HUGEPAGE: the range is hot, collapse it into huge pages.
+ */
+#define MADV_NORMAL	0
+#define MADV_RANDOM	1
+#define MADV_SEQUENTIAL	2
+#define MADV_WILLNEED	3
+#define MADV_DONTNEED	4
+#define MADV_HUGEPAGE	5
+int advise_uvm(struct mm *mm, void *addr, size_t len, int advice);
+/* Number of pages to read ahead of a fault on @vma */
+size_t vma_readahead(struct vma *vma);
 /* Share user space mapping between two memory mapping structures for
  * copy-on-write or shared memory.  Not implemented. */
 int share_uvm(struct mm *mm_src, void *addr_src, struct mm *mm_dst,
@@ -215,6 +340,74 @@ struct mm *mm_new(void);
 /* Destroy a struct mm and all the underlying memory mappings */
 void mm_destroy(struct mm *mm);
 
+/* Load @mm on current CPU, and remember it for the fault handler */
+void switch_mm(struct mm *mm);
+/* The address space loaded on current CPU, or NULL */
+struct mm *current_mm(void);
+/*
+ * After unmapping or write-protecting pages of @mm, make sure TLB entries
+ * of @mm cached on any CPU are never used again.  @mm gets a fresh ASID,
+ * and CPUs running it at the moment reload it before we return.
+ */
+void mm_forget_tlb(struct mm *mm);
+
+/*
+ * Resolve a fault at user address @addr in @mm, for an access of VMA flags
+ * @flags (VMA_READ, VMA_WRITE or VMA_EXEC).
+ * Returns 0 if the access can be retried, -EFAULT if @addr is not mapped,
+ * -EACCES if the access is not allowed, -ENOMEM or -EIO if the page could
+ * not be brought back.
+ */
+int handle_page_fault(struct mm *mm, void *addr, uint32_t flags);
+
+/*
+ * Page reclaim
+ * Anonymous user pages are aged on active and inactive lists, and written
+ * to swap when memory runs short.
+ */
+/* Start tracking @vma, which just got mapped to a fresh frame */
+void reclaim_track(struct vma *vma);
+/*
+ * Stop tracking @vma before it is destroyed, releasing its swap slot.
+ * Returns the state @vma was in.
+ */
+unsigned int reclaim_forget(struct vma *vma);
+/* Map an inactive or swapped out @vma back, 0 or negative error code */
+int reclaim_fault(struct vma *vma);
+/*
+ * Take resident @vma off the reclaim lists, leaving it untracked.
+ * Returns VMA_LRU_ACTIVE (still mapped) or VMA_LRU_INACTIVE (unmapped), or
+ * VMA_LRU_NONE without doing anything if @vma has no frame on the lists.
+ */
+unsigned int reclaim_isolate(struct vma *vma);
+/* Free up to @nr frames, returns number of frames freed */
+size_t reclaim_pages(size_t nr);
+/*
+ * Transparent huge pages, on architectures defining HPAGE_SIZE.
+ * A HPAGE_SIZE-aligned block of private anonymous pages, all populated and
+ * with the same protection, is moved into one physically contiguous frame
+ * mapped with a single large page.  Its VMAs stay, in state VMA_LRU_HUGE,
+ * and are not reclaimed until the block is split again.
+ */
+#ifdef HPAGE_SIZE
+/* @vma just got populated, collapse its block if it is complete now */
+void hugepage_fault(struct mm *mm, struct vma *vma);
+/* Collapse every block inside @addr..@addr+@len, returns blocks collapsed */
+int hugepage_collapse(struct mm *mm, void *addr, size_t len);
+/* Split the block @addr falls inside, unless @addr is where it starts */
+void hugepage_split_at(struct mm *mm, void *addr);
+#else /* !HPAGE_SIZE */
+static inline void hugepage_fault(struct mm *mm, struct vma *vma) {}
+static inline int hugepage_collapse(struct mm *mm, void *addr, size_t len)
+{
+	return 0;
+}
+static inline void hugepage_split_at(struct mm *mm, void *addr) {}
+#endif /* HPAGE_SIZE */
+
+/* alloc_pages(), reclaiming and retrying once on failure */
+int alloc_pages_reclaim(struct pages *pages);
+
 #endif /* !__ASSEMBLER__ */
 
 #endif /* _MM_H */
@@ -0,0 +1,65 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MUTEX_H
+#define _MUTEX_H
+
+#include <sys/types.h>
+#include <atomic.h>
+#include <proc.h>
+#include <waitqueue.h>
+
+#ifndef __ASSEMBLER__
+
+/*
+ * Sleeping mutexes
+ *
+ * For critical sections that may take long or sleep themselves, e.g.
+ * around disk I/O.  A locker finding the mutex held keeps trying while
+ * the owner is running on a CPU, as it is then likely to let go soon, and
+ * otherwise goes to sleep on the wait queue, giving its CPU away.  Not for
+ * interrupt handlers, and only the owner may unlock.
+ */
+
+struct mutex {
+	atomic_t state;
+#define MUTEX_UNLOCKED	0
+#define MUTEX_LOCKED	1
+#define MUTEX_CONTENDED	2	/* locked, and there may be sleepers */
+	struct proc *owner;	/* NULL if locked outside any proc */
+	struct waitqueue wq;
+};
+
+#define MUTEX_INIT(mutex) \
+	{ .state = MUTEX_UNLOCKED, .owner = NULL, \
+	  .wq = WAITQUEUE_INIT((mutex).wq) }
+
+void mutex_init(struct mutex *mutex);
+void mutex_lock(struct mutex *mutex);
+/* Lock without waiting, false if it is held */
+bool mutex_trylock(struct mutex *mutex);
+void mutex_unlock(struct mutex *mutex);
+
+static inline bool mutex_is_locked(struct mutex *mutex)
+{
+	return atomic_read(&mutex->state) != MUTEX_UNLOCKED;
+}
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _MUTEX_H */
@@ -0,0 +1,60 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PAGECACHE_H
+#define _PAGECACHE_H
+
+#include <sys/types.h>
+
+#ifndef __ASSEMBLER__
+
+#include <file.h>
+
+struct pages;
+
+/*
+ * Page cache
+ * Page-sized pieces of files, shared by all mappings of the same file.
+ * The cache keeps a reference to each page it holds, and every user takes
+ * another one, so a page is in use as long as its refs is above 1.
+ */
+
+/*
+ * Find or read in the page at page-aligned @offset of @file, and take a
+ * reference to it.  Returns NULL if it cannot be read.
+ */
+struct pages *pagecache_get(struct file *file, loff_t offset);
+/*
+ * Bring up to @nr pages from @offset on into the cache, without using them.
+ * Stops at the end of file.
+ */
+void pagecache_readahead(struct file *file, loff_t offset, size_t nr);
+/* @pages is about to be written to */
+void pagecache_dirty(struct pages *pages);
+/*
+ * Write @pages back to @file if dirty, for a user about to drop its
+ * reference.  Only the part before the end of file is written.  The page
+ * stays dirty while other users remain.
+ */
+int pagecache_writeback(struct file *file, struct pages *pages);
+/* Free up to @nr clean pages nobody uses, returns number freed */
+size_t pagecache_shrink(size_t nr);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _PAGECACHE_H */
@@ -23,6 +23,27 @@
 
 #include <proc.h>
 
+/*
+ * Per-CPU variables
+ *
+ * Variables defined with DEFINE_PER_CPU() go to .data.percpu.  The linked
+ * image of that section is used by the boot CPU, and percpu_init() gives
+ * each other CPU a copy of its own.  A CPU finds its copy of a variable
+ * by adding its offset to the variable's address, and keeps that offset
+ * at hand in a register (see arch-percpu.h):
+ *	this_cpu_ptr(&var)	address of our copy
+ *	this_cpu_read(var)	value of our copy
+ *	per_cpu(var, cpu)	copy of another CPU
+ * The kernel is not preemptive, so nothing moves us to another CPU while
+ * we are looking.  Copies are taken from the image as it is when
+ * percpu_init() runs, so only write per-CPU data after that.
+ */
+
+#define DEFINE_PER_CPU(type, name) \
+	__attribute__((__section__(".data.percpu"))) type name
+#define DECLARE_PER_CPU(type, name) \
+	extern type name
+
 struct percpu {
 	/*
 	 * to retrieve the kernel stack, this pointer need to be accessed from
@@ -30,8 +51,39 @@ struct percpu {
 	 */
 	struct proc *curr;
 
+	unsigned long offset;	/* of this copy from the linked image */
+	int cpu;
+
 	/* other stuff go here */
 };
 
-#endif /* _PERCPU_H */
+/* Always first in the section, so that each copy starts with it */
+DECLARE_PER_CPU(struct percpu, cpu_data);
+
+extern char __percpu_start[], __percpu_end[];
+extern unsigned long __percpu_offset[];
 
+#include <arch-percpu.h>
+
+#define per_cpu_ptr(ptr, cpu) \
+	((typeof(ptr))((char *)(ptr) + __percpu_offset[(cpu)]))
+#define per_cpu(var, cpu)	(*per_cpu_ptr(&(var), (cpu)))
+
+#define this_cpu_ptr(ptr) \
+	((typeof(ptr))((char *)(ptr) + __this_cpu_offset()))
+/* architectures may have a quicker way */
+#ifndef this_cpu_read
+#define this_cpu_read(var)	(*this_cpu_ptr(&(var)))
+#endif
+#define this_cpu_write(var, val) \
+	(*this_cpu_ptr(&(var)) = (val))
+
+/* Make copies for all CPUs, run by the boot CPU */
+void percpu_init(void);
+/* Point the calling CPU at its copy, for secondary CPUs coming up */
+void percpu_load(void);
+
+/* Load @offset into the register of the calling CPU */
+void arch_percpu_load(unsigned long offset);
+
+#endif /* _PERCPU_H */
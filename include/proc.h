@@ -20,6 +20,7 @@
 #define _PROC_H
 
 #include <sys/types.h>
+#include <list.h>
 #include <namespace.h>
 
 #define PROC_NAME_LEN_MAX	256
@@ -61,7 +62,7 @@ struct proc {
 	 */
 	struct regs	*context;	/* Context before switch */
 	struct trapframe *tf;		/* Current trap frame */
-	size_t		heapsize;	/* Expandable heap size */
+	size_t		heapsize;	/* Expandable heap size, see proc_brk() */
 
 	/* TODO: do we need these? */
 	uintptr_t	ustacktop;	/* User stack top */
@@ -80,5 +81,14 @@ struct proc {
 /* Create a struct proc and */
 struct proc *newproc(void);
 
+/*
+ * Move the program break, i.e. the top of the heap, to @brk.
+ * Returns 0, -EINVAL if @brk is below the heap, or -ENOMEM if the heap
+ * cannot grow that far.
+ */
+int proc_brk(struct proc *proc, uintptr_t brk);
+/* Move the program break by @incr, storing the old break in @oldbrk */
+int proc_sbrk(struct proc *proc, ssize_t incr, uintptr_t *oldbrk);
+
 #endif /* _PROC_H */
 
@@ -0,0 +1,78 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RCU_H
+#define _RCU_H
+
+#include <sys/types.h>
+#include <aim/sync.h>
+
+#ifndef __ASSEMBLER__
+
+/*
+ * Read-copy-update
+ *
+ * Readers walk shared data without locks and without writing anything
+ * shared.  Writers publish new versions with rcu_assign_pointer() and
+ * hand old ones to call_rcu(), which frees them once every CPU has passed
+ * a quiescent state, i.e. once no reader can still be looking at them.
+ *
+ * The kernel is not preemptive, so a CPU is quiescent whenever it is not
+ * inside kernel code reading RCU data.  The scheduler reports this with
+ * rcu_qs() on each context switch, tick and trip through the idle loop;
+ * read-side sections must not sleep.
+ *
+ * Callbacks are queued per CPU under a global lock, so call_rcu() is not
+ * for interrupt handlers.
+ */
+
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+/* Read-side sections only keep the compiler from moving accesses out */
+#define rcu_read_lock() \
+	asm volatile ("" : : : "memory")
+#define rcu_read_unlock() \
+	asm volatile ("" : : : "memory")
+
+/* Fetch a pointer published by rcu_assign_pointer() */
+#define rcu_dereference(p) ({ \
+	typeof(p) _p = *(volatile typeof(p) *)&(p); \
+	SMP_DMB(); \
+	_p; })
+
+/* Publish @v in @p, after everything written to what @v points to */
+#define rcu_assign_pointer(p, v) ({ \
+	SMP_DMB(); \
+	*(volatile typeof(p) *)&(p) = (v); })
+
+/* Run @func on @head after a grace period */
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+/* Wait for a grace period, for writers that would rather not keep a head */
+void synchronize_rcu(void);
+
+/* Quiescent state of the calling CPU, see above */
+void rcu_qs(void);
+/* Called by each CPU on its way up, before it reads RCU data */
+void rcu_cpu_online(void);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _RCU_H */
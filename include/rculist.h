@@ -0,0 +1,71 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RCULIST_H
+#define _RCULIST_H
+
+#include <list.h>
+#include <rcu.h>
+
+/*
+ * List operations safe against concurrent RCU readers.
+ * Writers still need a lock among themselves. Readers only ever follow
+ * next pointers, so prev pointers are kept the plain way.
+ */
+
+static inline void __list_add_rcu(struct list_head *new,
+    struct list_head *prev, struct list_head *next)
+{
+	new->next = next;
+	new->prev = prev;
+	rcu_assign_pointer(prev->next, new);
+	next->prev = new;
+}
+
+static inline void list_add_rcu(struct list_head *new, struct list_head *head)
+{
+	__list_add_rcu(new, head, head->next);
+}
+
+static inline void list_add_tail_rcu(struct list_head *new,
+    struct list_head *head)
+{
+	__list_add_rcu(new, head->prev, head);
+}
+
+#define list_add_after_rcu(new, head)	list_add_rcu(new, head)
+#define list_add_before_rcu(new, head)	list_add_tail_rcu(new, head)
+
+/*
+ * Readers may still be standing on @entry, so its next pointer is left
+ * alone; free it with call_rcu().
+ */
+static inline void list_del_rcu(struct list_head *entry)
+{
+	__list_del(entry->prev, entry->next);
+}
+
+/* Use between rcu_read_lock() and rcu_read_unlock() */
+#define for_each_entry_rcu(pos, head, member) \
+	for (pos = list_entry(rcu_dereference((head)->next), \
+		typeof(*pos), member); \
+	     &pos->member != (head); \
+	     pos = list_entry(rcu_dereference(pos->member.next), \
+		typeof(*pos), member))
+
+#endif /* _RCULIST_H */
@@ -0,0 +1,282 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RING_H
+#define _RING_H
+
+#include <sys/types.h>
+#include <atomic.h>
+#include <errno.h>
+#include <util.h>
+
+#ifndef __ASSEMBLER__
+
+/*
+ * Lock-free queues.
+ *
+ * None of these take a lock, so they can be used between interrupt
+ * handlers and the rest of the kernel, or between CPUs, as long as each
+ * side sticks to its role:
+ *	spsc_ring	one producer, one consumer, bounded
+ *	mpsc_queue	any number of producers, one consumer, unbounded,
+ *			producers bring their own nodes
+ *	mpmc_ring	any number of producers and consumers, bounded
+ * The rings carry unsigned long values, large enough for a pointer.  Ring
+ * sizes must be powers of 2, and the storage is handed in by the caller.
+ *
+ * Indices written by different sides live on lines of their own, so the
+ * structures themselves want CACHELINE_SIZE alignment; static ones get it
+ * from their type.
+ */
+
+/* Single producer, single consumer */
+
+struct spsc_ring {
+	unsigned long	*slots;
+	uint32_t	mask;
+	atomic_t	head __cacheline_aligned;	/* next to pop */
+	atomic_t	tail __cacheline_aligned;	/* next to push */
+};
+
+static inline int spsc_ring_init(struct spsc_ring *ring,
+    unsigned long *slots, uint32_t size)
+{
+	if (size == 0 || (size & (size - 1)) != 0)
+		return -EINVAL;
+	ring->slots = slots;
+	ring->mask = size - 1;
+	ring->head = ring->tail = 0;
+	return 0;
+}
+
+/* Producer side, false if the ring is full */
+static inline bool spsc_ring_push(struct spsc_ring *ring, unsigned long val)
+{
+	uint32_t tail = ring->tail;
+
+	/* the consumer must be done with the slot before we reuse it */
+	if (tail - atomic_read(&ring->head) > ring->mask)
+		return false;
+	SMP_DMB();
+	ring->slots[tail & ring->mask] = val;
+	SMP_DMB();
+	atomic_set(&ring->tail, tail + 1);
+	return true;
+}
+
+/* Consumer side, false if the ring is empty */
+static inline bool spsc_ring_pop(struct spsc_ring *ring, unsigned long *val)
+{
+	uint32_t head = ring->head;
+
+	if (head == atomic_read(&ring->tail))
+		return false;
+	SMP_DMB();
+	*val = ring->slots[head & ring->mask];
+	SMP_DMB();
+	atomic_set(&ring->head, head + 1);
+	return true;
+}
+
+/* A snapshot, exact only on the consumer side */
+static inline uint32_t spsc_ring_count(struct spsc_ring *ring)
+{
+	return atomic_read(&ring->tail) - atomic_read(&ring->head);
+}
+
+/*
+ * Multiple producers, single consumer
+ *
+ * An intrusive linked queue: a producer swaps its node in as the new head
+ * and then links the old head to it.  Between the two steps the consumer
+ * finds the chain broken and sees the queue as empty, so it should check
+ * again on the next occasion, e.g. the next interrupt.  A stub node keeps
+ * the queue from ever running out of nodes.
+ */
+
+struct mpsc_node {
+	struct mpsc_node *next;
+};
+
+struct mpsc_queue {
+	struct mpsc_node *head __cacheline_aligned;	/* producers */
+	struct mpsc_node *tail __cacheline_aligned;	/* consumer */
+	struct mpsc_node stub;
+};
+
+#ifdef __LP64__
+#define __mpsc_xchg(pp, node) \
+	((struct mpsc_node *)atomic64_xchg((atomic64_t *)(pp), \
+	    (uint64_t)(node)))
+#else
+#define __mpsc_xchg(pp, node) \
+	((struct mpsc_node *)atomic_xchg((atomic_t *)(pp), \
+	    (uint32_t)(node)))
+#endif
+
+static inline void mpsc_queue_init(struct mpsc_queue *queue)
+{
+	queue->stub.next = NULL;
+	queue->head = queue->tail = &queue->stub;
+}
+
+static inline void mpsc_queue_push(struct mpsc_queue *queue,
+    struct mpsc_node *node)
+{
+	struct mpsc_node *prev;
+
+	node->next = NULL;
+	prev = __mpsc_xchg(&queue->head, node);
+	*(struct mpsc_node * volatile *)&prev->next = node;
+}
+
+static inline struct mpsc_node *__mpsc_next(struct mpsc_node *node)
+{
+	struct mpsc_node *next = *(struct mpsc_node * volatile *)&node->next;
+
+	SMP_DMB();
+	return next;
+}
+
+/* Consumer side, NULL if empty or a push is still halfway */
+static inline struct mpsc_node *mpsc_queue_pop(struct mpsc_queue *queue)
+{
+	struct mpsc_node *tail = queue->tail, *next = __mpsc_next(tail);
+
+	if (tail == &queue->stub) {
+		if (next == NULL)
+			return NULL;
+		queue->tail = tail = next;
+		next = __mpsc_next(next);
+	}
+	if (next != NULL) {
+		queue->tail = next;
+		return tail;
+	}
+
+	/* @tail is the last node; put the stub behind it to take it out */
+	if (tail != *(struct mpsc_node * volatile *)&queue->head)
+		return NULL;
+	mpsc_queue_push(queue, &queue->stub);
+	next = __mpsc_next(tail);
+	if (next != NULL) {
+		queue->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+/*
+ * Multiple producers, multiple consumers
+ *
+ * Each cell carries a sequence number telling whose turn it is: equal to
+ * the position for the producer that will fill it, one past that for the
+ * consumer that will empty it.  Producers and consumers claim positions
+ * by compare-and-swap on their own index and never touch the other one.
+ */
+
+struct mpmc_cell {
+	atomic_t	seq;
+	unsigned long	val;
+};
+
+struct mpmc_ring {
+	struct mpmc_cell *cells;
+	uint32_t	mask;
+	atomic_t	head __cacheline_aligned;	/* next to pop */
+	atomic_t	tail __cacheline_aligned;	/* next to push */
+};
+
+static inline int mpmc_ring_init(struct mpmc_ring *ring,
+    struct mpmc_cell *cells, uint32_t size)
+{
+	uint32_t i;
+
+	if (size == 0 || (size & (size - 1)) != 0)
+		return -EINVAL;
+	for (i = 0; i < size; ++i)
+		cells[i].seq = i;
+	ring->cells = cells;
+	ring->mask = size - 1;
+	ring->head = ring->tail = 0;
+	return 0;
+}
+
+/* False if the ring is full */
+static inline bool mpmc_ring_push(struct mpmc_ring *ring, unsigned long val)
+{
+	struct mpmc_cell *cell;
+	uint32_t pos = atomic_read(&ring->tail), prev;
+	int32_t diff;
+
+	for (;;) {
+		cell = &ring->cells[pos & ring->mask];
+		diff = (int32_t)(atomic_read(&cell->seq) - pos);
+		SMP_DMB();
+		if (diff < 0)
+			return false;
+		if (diff > 0) {
+			/* somebody else took @pos */
+			pos = atomic_read(&ring->tail);
+			continue;
+		}
+		prev = atomic_cmpxchg_relaxed(&ring->tail, pos, pos + 1);
+		if (prev == pos)
+			break;
+		pos = prev;
+	}
+
+	cell->val = val;
+	SMP_DMB();
+	atomic_set(&cell->seq, pos + 1);
+	return true;
+}
+
+/* False if the ring is empty */
+static inline bool mpmc_ring_pop(struct mpmc_ring *ring, unsigned long *val)
+{
+	struct mpmc_cell *cell;
+	uint32_t pos = atomic_read(&ring->head), prev;
+	int32_t diff;
+
+	for (;;) {
+		cell = &ring->cells[pos & ring->mask];
+		diff = (int32_t)(atomic_read(&cell->seq) - (pos + 1));
+		SMP_DMB();
+		if (diff < 0)
+			return false;
+		if (diff > 0) {
+			pos = atomic_read(&ring->head);
+			continue;
+		}
+		prev = atomic_cmpxchg_relaxed(&ring->head, pos, pos + 1);
+		if (prev == pos)
+			break;
+		pos = prev;
+	}
+
+	*val = cell->val;
+	SMP_DMB();
+	/* hand the cell to the producer one lap later */
+	atomic_set(&cell->seq, pos + ring->mask + 1);
+	return true;
+}
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _RING_H */
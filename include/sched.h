@@ -21,6 +21,7 @@
 
 #include <proc.h>
 #include <namespace.h>
+#include <percpu.h>
 
 /* struct proclist is implemented in scheduler source. */
 struct proclist;
@@ -42,4 +43,16 @@ struct scheduler {
 	struct proc *	(*find)(pid_t pid, struct namespace *ns);
 };
 
+/* The proc running on this CPU, NULL while none is */
+#define current_proc()	this_cpu_read(cpu_data.curr)
+
+/*
+ * Give up the CPU, for a proc that has gone to sleep or has run long
+ * enough.  Those asleep are skipped until proc_wakeup() makes them
+ * runnable again.  Callers waiting for something check again when we
+ * return, as the wakeup may have come first.
+ */
+void schedule(void);
+void proc_wakeup(struct proc *proc);
+
 #endif
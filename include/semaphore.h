@@ -0,0 +1,54 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SEMAPHORE_H
+#define _SEMAPHORE_H
+
+#include <sys/types.h>
+#include <waitqueue.h>
+
+#ifndef __ASSEMBLER__
+
+/*
+ * Counting semaphores
+ *
+ * semaphore_dec() takes one off the count, sleeping while it is zero, and
+ * semaphore_inc() puts one back and wakes up a sleeper.  The count starts
+ * at its limit, and going over it means somebody gave back what they did
+ * not take, which panics.  Not for interrupt handlers.
+ */
+
+typedef struct {
+	atomic_t val;
+	int limit;
+	struct waitqueue wq;
+} semaphore_t;
+
+void semaphore_init(semaphore_t *sem, int val);
+void semaphore_dec(semaphore_t *sem);
+/* Take one without waiting, false if the count is zero */
+bool semaphore_trydec(semaphore_t *sem);
+void semaphore_inc(semaphore_t *sem);
+#define semaphore_pass(sem) ({ \
+	semaphore_t *_sem = sem; \
+	semaphore_dec(_sem); \
+	semaphore_inc(_sem); })
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _SEMAPHORE_H */
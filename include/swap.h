@@ -0,0 +1,49 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SWAP_H
+#define _SWAP_H
+
+#include <sys/types.h>
+#include <file.h>
+
+#ifndef __ASSEMBLER__
+
+struct blk_device;
+
+/*
+ * Swap area
+ * A single area of page-sized slots on a block device (msim ddisk, ATA
+ * disk, RAM disk...).  Slot numbers start from 1, so that 0 can mean
+ * "no slot".
+ */
+
+/* Swap on the swap partition of the primary storage, if any */
+void swap_init(void);
+/* Use @size bytes of @dev from @offset on as swap */
+int swap_on(struct blk_device *dev, loff_t offset, size_t size);
+/* Returns a free slot, or 0 if swap is full or off */
+unsigned long swap_alloc(void);
+void swap_free(unsigned long slot);
+/* Page-sized transfers between kernel address @kva and @slot */
+int swap_write(unsigned long slot, void *kva);
+int swap_read(unsigned long slot, void *kva);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _SWAP_H */
@@ -52,6 +52,7 @@ typedef signed long long	int64_t;
 
 typedef uint32_t atomic_t;
 typedef int32_t satomic_t;
+typedef uint64_t atomic64_t;
 
 typedef unsigned long ulong;
 
@@ -83,6 +84,7 @@ typedef signed long long saddr_t;
  * This is only a design pattern.
  */
 typedef ulong	devid_t;
+typedef int	pid_t;
 
 /* A generic void function pointer type, allow any number of arguments */
 typedef void (*generic_fp)();
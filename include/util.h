@@ -33,10 +33,16 @@
 #define BITS_PER_LONG	32
 #endif
 
+/* No smaller than the L1 line of any CPU we run on */
+#define CACHELINE_SIZE	64
+
 #ifndef __ASSEMBLER__
 
 #include <sys/types.h>
 
+/* Keep data written by different CPUs off each other's lines */
+#define __cacheline_aligned	__attribute__((aligned(CACHELINE_SIZE)))
+
 #define offsetof(TYPE, MEMBER) ((size_t) &((TYPE *)0)->MEMBER)
 
 /**
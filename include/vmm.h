@@ -79,6 +79,13 @@ void *kmalloc(size_t size, gfp_t flags);
 void kfree(void *obj);
 size_t ksize(void *obj);
 
+/*
+ * Virtually contiguous kernel memory built from single pages, for buffers
+ * too large to find physically contiguous.  Lives in the kmmap window.
+ */
+void *vmalloc(size_t size);
+void vfree(void *addr);
+
 int cache_create(struct allocator_cache *cache);
 int cache_destroy(struct allocator_cache *cache);
 void *cache_alloc(struct allocator_cache *cache);
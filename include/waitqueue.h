@@ -0,0 +1,84 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WAITQUEUE_H
+#define _WAITQUEUE_H
+
+#include <sys/types.h>
+#include <aim/sync.h>
+#include <list.h>
+#include <proc.h>
+
+#ifndef __ASSEMBLER__
+
+/*
+ * Wait queues
+ *
+ * A proc waiting for something puts an entry of its own, usually on its
+ * stack, on the queue for it, and sleeps until whoever makes it happen
+ * wakes it up:
+ *	prepare_to_wait(&wq, &wait);
+ *	if (!condition)
+ *		wait_woken(&wait);
+ *	finish_wait(&wq, &wait);
+ * prepare_to_wait() is a full barrier, so a waker changing the condition
+ * and then calling wake_up() either is seen by the check or finds the
+ * entry on the queue.  Wakeups are first come first served: wake_up()
+ * takes the oldest entry off the queue.
+ */
+
+struct waitqueue {
+	lock_t lock;
+	struct list_head head;
+};
+
+struct wait_entry {
+	struct proc *proc;	/* NULL outside any proc */
+	volatile bool woken;
+	struct list_head node;
+};
+
+#define WAITQUEUE_INIT(wq) \
+	{ .lock = UNLOCKED, .head = EMPTY_LIST((wq).head) }
+
+void waitqueue_init(struct waitqueue *wq);
+void prepare_to_wait(struct waitqueue *wq, struct wait_entry *wait);
+/* Sleep until the entry is taken off its queue by a wakeup */
+void wait_woken(struct wait_entry *wait);
+/* Leave the queue if no wakeup took us off it, and run again */
+void finish_wait(struct waitqueue *wq, struct wait_entry *wait);
+/* Wake up the oldest waiter, false if there is none */
+bool wake_up(struct waitqueue *wq);
+void wake_up_all(struct waitqueue *wq);
+
+/* Sleep on @wq until @cond holds */
+#define wait_event(wq, cond) \
+	do { \
+		struct wait_entry _wait; \
+		for (;;) { \
+			prepare_to_wait((wq), &_wait); \
+			if (cond) \
+				break; \
+			wait_woken(&_wait); \
+		} \
+		finish_wait((wq), &_wait); \
+	} while (0)
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _WAITQUEUE_H */
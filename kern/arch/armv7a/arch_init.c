@@ -24,12 +24,14 @@
 #include <sys/types.h>
 #include <init.h>
 #include <mm.h>
+#include <percpu.h>
 #include <drivers/io/io-mem.h>
 
 void early_arch_init(void)
 {
 	io_mem_init(&early_memory_bus);
 	early_mach_init();
+	cache_early_init();
 
 	/* extra low address mapping */
 	addr_t mem_base = get_mem_physbase();
@@ -48,7 +50,30 @@ void early_arch_init(void)
 		(size_t)get_mem_size());
 }
 
+/* PMCR: enable, reset the cycle counter; PMCNTENSET: cycle counter */
+#define PMCR_E		(1 << 0)
+#define PMCR_C		(1 << 2)
+#define PMCNTEN_C	(1 << 31)
+
 void arch_init(void)
 {
+	/* the linked per-CPU image, until percpu_init() */
+	arch_percpu_load(0);
+
+	/* start the cycle counter for get_cycles() */
+	asm volatile (
+		"mcr	p15, 0, %[pmcr], c9, c12, 0;"
+		"mcr	p15, 0, %[pmcnten], c9, c12, 1;"
+		"isb;"
+		:: [pmcr] "r" (PMCR_E | PMCR_C),
+		   [pmcnten] "r" (PMCNTEN_C)
+	);
+}
+
+void arch_percpu_load(unsigned long offset)
+{
+	char *this = (char *)&cpu_data + offset;
+
+	asm volatile ("mcr	p15, 0, %0, c13, c0, 4" : : "r" (this));
 }
 
@@ -0,0 +1,259 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+/* from kernel */
+#include <sys/types.h>
+#include <aim/sync.h>
+#include <io.h>
+#include <mach.h>
+#include <mm.h>
+#include <mmu.h>
+#include <panic.h>
+#include <util.h>
+
+/*
+ * Cortex-A9 MPCore caches: private L1 I/D caches kept coherent by the SCU,
+ * and a shared PL310 L2 in front of memory.
+ *
+ * cache_init() runs with the MMU off, on every CPU, before its MMU is
+ * turned on, so it only touches physical addresses.  The range routines
+ * run later, with the PL310 reached through an early kmmap mapping.
+ */
+
+#define SCU_OFFSET_CTRL		0x00
+#define SCU_OFFSET_INVAL_ALL	0x0C
+#define SCU_CTRL_EN		0x1
+
+#define L2C_OFFSET_CTRL		0x100
+#define L2C_OFFSET_AUX_CTRL	0x104
+#define L2C_OFFSET_TAG_LATENCY	0x108
+#define L2C_OFFSET_DATA_LATENCY	0x10C
+#define L2C_OFFSET_INT_MASK	0x214
+#define L2C_OFFSET_INT_CLEAR	0x220
+#define L2C_OFFSET_SYNC		0x730
+#define L2C_OFFSET_INVAL_PA	0x770
+#define L2C_OFFSET_INVAL_WAY	0x77C
+#define L2C_OFFSET_CLEAN_PA	0x7B0
+#define L2C_OFFSET_FLUSH_PA	0x7F0
+#define L2C_CTRL_EN		0x1
+#define L2C_WAY_MASK		0xFF
+#define L2C_INT_MASK		0x1FF
+#define L2C_LINE_SIZE		32
+
+/* ACTLR: take part in coherency, broadcast cache and TLB maintenance */
+#define ACTLR_SMP		(1 << 6)
+#define ACTLR_FW		(1 << 0)
+
+static size_t __l1_line_size;
+static size_t __mpcore_mapped_base;
+/* virtual base of the PL310, 0 until the MMU is on */
+static size_t __l2c_base;
+static lock_t __l2c_lock = UNLOCKED;
+
+static void __scu_enable(void)
+{
+	uint32_t ctrl = read32(MPCORE_PHYSBASE + SCU_OFFSET_CTRL);
+
+	if (ctrl & SCU_CTRL_EN)
+		return;
+	/* invalidate all tag RAMs of all CPUs, then enable */
+	write32(MPCORE_PHYSBASE + SCU_OFFSET_INVAL_ALL, 0xFFFF);
+	write32(MPCORE_PHYSBASE + SCU_OFFSET_CTRL, ctrl | SCU_CTRL_EN);
+}
+
+static void __l2c_enable(void)
+{
+	uint32_t base = L2C_PHYSBASE;
+
+	/* CPU1 finds the L2 already on, and must not wipe it */
+	if (read32(base + L2C_OFFSET_CTRL) & L2C_CTRL_EN)
+		return;
+
+	write32(base + L2C_OFFSET_AUX_CTRL, L2C_AUX_CTRL_VAL);
+	write32(base + L2C_OFFSET_TAG_LATENCY, L2C_TAG_LATENCY_VAL);
+	write32(base + L2C_OFFSET_DATA_LATENCY, L2C_DATA_LATENCY_VAL);
+
+	write32(base + L2C_OFFSET_INVAL_WAY, L2C_WAY_MASK);
+	while (read32(base + L2C_OFFSET_INVAL_WAY) & L2C_WAY_MASK)
+		/* nothing */;
+	write32(base + L2C_OFFSET_SYNC, 0);
+	while (read32(base + L2C_OFFSET_SYNC) & 0x1)
+		/* nothing */;
+
+	write32(base + L2C_OFFSET_INT_MASK, 0);
+	write32(base + L2C_OFFSET_INT_CLEAR, L2C_INT_MASK);
+	write32(base + L2C_OFFSET_CTRL, L2C_CTRL_EN);
+}
+
+/* L1 contents are undefined out of reset, invalidate by set/way */
+static void __l1_dcache_inval_all(void)
+{
+	uint32_t ccsidr, sets, ways, line_shift, way_shift, set, way;
+
+	/* select L1 data cache */
+	asm volatile (
+		"mcr	p15, 2, %[zero], c0, c0, 0;"
+		"isb;"
+		"mrc	p15, 1, %[ccsidr], c0, c0, 0;"
+		: [ccsidr] "=r" (ccsidr)
+		: [zero] "r" (0)
+	);
+	line_shift = (ccsidr & 0x7) + 4;
+	ways = ((ccsidr >> 3) & 0x3FF) + 1;
+	sets = ((ccsidr >> 13) & 0x7FFF) + 1;
+	way_shift = (ways > 1) ? __builtin_clz(ways - 1) : 0;
+
+	for (way = 0; way < ways; ++way)
+		for (set = 0; set < sets; ++set)
+			asm volatile (
+				"mcr	p15, 0, %[sw], c7, c6, 2"
+				:: [sw] "r" ((way << way_shift) |
+					(set << line_shift))
+			);
+	asm volatile ("dsb");
+}
+
+static void __l1_init(void)
+{
+	uint32_t ctr, actlr;
+
+	asm volatile (
+		"mrc	p15, 0, %[ctr], c0, c0, 1"
+		: [ctr] "=r" (ctr)
+	);
+	/* DminLine, log2 of the number of words */
+	__l1_line_size = 4 << ((ctr >> 16) & 0xF);
+
+	__l1_dcache_inval_all();
+	asm volatile (
+		/* ICIALLU, BPIALL, TLBIALL */
+		"mcr	p15, 0, %[zero], c7, c5, 0;"
+		"mcr	p15, 0, %[zero], c7, c5, 6;"
+		"mcr	p15, 0, %[zero], c8, c7, 0;"
+		"dsb;"
+		"isb;"
+		:: [zero] "r" (0)
+	);
+
+	asm volatile (
+		"mrc	p15, 0, %[actlr], c1, c0, 1"
+		: [actlr] "=r" (actlr)
+	);
+	actlr |= ACTLR_SMP | ACTLR_FW;
+	asm volatile (
+		"mcr	p15, 0, %[actlr], c1, c0, 1;"
+		"isb;"
+		:: [actlr] "r" (actlr)
+	);
+}
+
+/*
+ * cache_init()
+ * Bring this CPU's caches to a clean state and make it coherent. Caches are
+ * turned on by mmu_init() afterwards, along with the MMU.
+ */
+void cache_init(void)
+{
+	__scu_enable();
+	__l1_init();
+	__l2c_enable();
+}
+
+static void __mmu_handler(void)
+{
+	__l2c_base = __mpcore_mapped_base + L2C_PHYSBASE - MPCORE_PHYSBASE;
+}
+
+/*
+ * cache_early_init()
+ * Map the MPCore private region for later L2 maintenance.
+ */
+void cache_early_init(void)
+{
+	__mpcore_mapped_base =
+		early_mapping_add_kmmap(MPCORE_PHYSBASE, ARM_SECT_SIZE);
+	if (__mpcore_mapped_base == 0)
+		panic("Cannot map MPCore private region.\n");
+	if (mmu_handlers_add(__mmu_handler) != 0)
+		panic("Cannot register cache MMU handler.\n");
+}
+
+static inline void __l2c_sync(void)
+{
+	write32(__l2c_base + L2C_OFFSET_SYNC, 0);
+	while (read32(__l2c_base + L2C_OFFSET_SYNC) & 0x1)
+		/* nothing */;
+}
+
+static void __l2c_range(void *vaddr, size_t size, uint32_t offset)
+{
+	size_t start, end;
+
+	if (__l2c_base == 0)
+		return;
+	start = ALIGN_BELOW((size_t)vaddr, L2C_LINE_SIZE);
+	end = (size_t)vaddr + size;
+	spin_lock(&__l2c_lock);
+	for (; start < end; start += L2C_LINE_SIZE)
+		write32(__l2c_base + offset, (uint32_t)kva2pa(start));
+	__l2c_sync();
+	spin_unlock(&__l2c_lock);
+}
+
+/* DCCMVAC, DCIMVAC and DCCIMVAC differ in opc2 only */
+#define __l1_range(vaddr, size, opc2) \
+	do { \
+		size_t __p = ALIGN_BELOW((size_t)(vaddr), __l1_line_size); \
+		size_t __end = (size_t)(vaddr) + (size); \
+		for (; __p < __end; __p += __l1_line_size) \
+			asm volatile ( \
+				"mcr	p15, 0, %[p], c7, " opc2 \
+				:: [p] "r" (__p) : "memory" \
+			); \
+		asm volatile ("dsb" ::: "memory"); \
+	} while (0)
+
+/*
+ * Range operations on the kernel linear mapping, for DMA.
+ * Partial lines at both ends are affected as a whole, so buffers handed to
+ * devices should be cache line aligned.
+ */
+void dcache_clean_range(void *vaddr, size_t size)
+{
+	/* inner first, so lines reach the L2 before it is cleaned */
+	__l1_range(vaddr, size, "c10, 1");
+	__l2c_range(vaddr, size, L2C_OFFSET_CLEAN_PA);
+}
+
+void dcache_inval_range(void *vaddr, size_t size)
+{
+	/* outer first, or L1 may refill from stale L2 lines */
+	__l2c_range(vaddr, size, L2C_OFFSET_INVAL_PA);
+	__l1_range(vaddr, size, "c6, 1");
+}
+
+void dcache_flush_range(void *vaddr, size_t size)
+{
+	__l1_range(vaddr, size, "c10, 1");
+	__l2c_range(vaddr, size, L2C_OFFSET_FLUSH_PA);
+	__l1_range(vaddr, size, "c14, 1");
+}
@@ -20,8 +20,25 @@
 #include <config.h>
 #endif /* HAVE_CONFIG_H */
 
+/* from kernel */
+#include <sys/types.h>
+#include <io.h>
+#include <mach.h>
+
+#ifdef SD_ZYNQ
+#include <drivers/sd/sd.h>
+#endif /* SD_ZYNQ */
+
 void early_mach_init(void)
 {
+	/* L2 RAM timing, required by the TRM before the PL310 is turned on */
+	write32(SLCR_PHYSBASE + SLCR_OFFSET_UNLOCK, SLCR_UNLOCK_KEY);
+	write32(SLCR_PHYSBASE + SLCR_OFFSET_L2C_RAM, SLCR_L2C_RAM_VAL);
+	write32(SLCR_PHYSBASE + SLCR_OFFSET_LOCK, SLCR_LOCK_KEY);
 
+	smp_early_init();
+#ifdef SD_ZYNQ
+	sd_early_init();
+#endif /* SD_ZYNQ */
 }
 
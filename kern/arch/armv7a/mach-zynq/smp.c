@@ -0,0 +1,108 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+/* from kernel */
+#include <sys/types.h>
+#include <errno.h>
+#include <init.h>
+#include <io.h>
+#include <ipi.h>
+#include <mach.h>
+#include <mm.h>
+#include <mmu.h>
+#include <panic.h>
+#include <util.h>
+
+/* the start address word of CPU1, in the top of on-chip memory */
+static size_t __cpu1_start;
+/* the GIC, for IPIs */
+static size_t __gicc_base;
+static size_t __gicd_base;
+
+/*
+ * smp_early_init()
+ * Map the top of OCM, so that we can hand CPU1 its start address later,
+ * and the GIC.
+ */
+void smp_early_init(void)
+{
+	size_t base = ALIGN_BELOW(CPU1_START_PHYSADDR, ARM_SECT_SIZE);
+	size_t mapped;
+
+	mapped = early_mapping_add_kmmap(base, ARM_SECT_SIZE);
+	if (mapped == 0)
+		panic("Cannot map on-chip memory.\n");
+	__cpu1_start = mapped + CPU1_START_PHYSADDR - base;
+
+	mapped = early_mapping_add_kmmap(MPCORE_PHYSBASE, ARM_SECT_SIZE);
+	if (mapped == 0)
+		panic("Cannot map GIC.\n");
+	__gicc_base = mapped + GICC_OFFSET;
+	__gicd_base = mapped + GICD_OFFSET;
+}
+
+int arch_start_cpu(int cpu)
+{
+	extern uint32_t slave_entry;
+
+	if (cpu != 1)
+		return -ENODEV;
+	write32(__cpu1_start, (uint32_t)premap_addr(&slave_entry));
+	asm volatile (
+		"dsb;"
+		"sev;"
+		::: "memory"
+	);
+	return 0;
+}
+
+/*
+ * IPIs are software generated interrupts, which the distributor always
+ * delivers to the CPU interface once both are on.  Whichever CPU comes
+ * first turns the distributor on.
+ */
+void arch_ipi_init(void)
+{
+	write32(__gicd_base + GICD_OFFSET_ISENABLER0, 1 << GIC_SGI_IPI);
+	write32(__gicd_base + GICD_OFFSET_CTLR, GIC_CTLR_EN);
+	write32(__gicc_base + GICC_OFFSET_PMR, GIC_PMR_ALL);
+	write32(__gicc_base + GICC_OFFSET_CTLR, GIC_CTLR_EN);
+}
+
+void arch_send_ipi(int cpu)
+{
+	/* the queued request must be visible before the interrupt is */
+	SMP_DSB();
+	write32(__gicd_base + GICD_OFFSET_SGIR,
+	    (1 << (cpu + GIC_SGIR_TARGET_SHIFT)) | GIC_SGI_IPI);
+}
+
+/* Nothing but the IPI is enabled, anything else is only acknowledged */
+bool mach_ipi_ack(void)
+{
+	uint32_t iar = read32(__gicc_base + GICC_OFFSET_IAR);
+
+	if (GIC_IAR_ID(iar) == GIC_ID_SPURIOUS)
+		return false;
+	write32(__gicc_base + GICC_OFFSET_EOIR, iar);
+	return GIC_IAR_ID(iar) == GIC_SGI_IPI;
+}
@@ -83,89 +83,439 @@ static void __pt_l2_clear(void *pt)
 	} \
 	} while (0)
 
-/* internal routines does not check for bad parameters */
-/* does nothing if not mapped */
-static inline void __arm_unmap_l1(arm_pte_l1_t *page_table, size_t vaddr)
+/* L2 tables are linked into L1 entries by their physical address */
+#define l2_table(e1) \
+	((arm_pte_l2_t *)pa2kva((e1) & ARM_PT_L1_TABLE_BASE_MASK))
+#define l1_index(vaddr)	((vaddr) >> ARM_SECT_SHIFT)
+#define l2_index(vaddr)	(((vaddr) >> ARM_PAGE_SHIFT) & (ARM_PT_L2_LENGTH - 1))
+
+/* a small page entry has bit 1 set, bit 0 being XN */
+static inline uint32_t __arm_l2_type(arm_pte_l2_t e2)
 {
-	arm_pte_l1_t entry;
+	if (e2 & ARM_PT_L2_PAGE)
+		return ARM_PT_L2_PAGE;
+	return e2 & ARM_PT_L2_LARGE;
+}
 
-	entry = page_table[vaddr >> ARM_SECT_SHIFT];
-	if ((entry & ARM_PT_L1_TYPE_MASK) == ARM_PT_L1_TABLE) {
-		entry &= ARM_PT_L1_TABLE_BASE_MASK;
-		cache_free(pt_l2_cache, (void *)entry);
+/* supersections and large pages take 16 entries, others take one */
+static inline int __arm_nr_entries(size_t size)
+{
+	switch (size) {
+		case ARM_SUPERSECT_SIZE:
+		case ARM_LARGE_PAGE_SIZE:
+			return ARM_PT_REPEAT;
+		default:
+			return 1;
 	}
-	page_table[vaddr >> ARM_SECT_SHIFT] = 0;
 }
 
-static inline void __arm_map_sect(arm_pte_l1_t *page_table, addr_t paddr,
-	size_t vaddr, uint32_t flags)
+static inline void __arm_fill(uint32_t *entry, uint32_t val, size_t size)
+{
+	int i;
+
+	for (i = 0; i < __arm_nr_entries(size); i += 1)
+		entry[i] = val;
+}
+
+/*
+ * Build a page table entry mapping a @size block at @paddr.
+ * Sections and supersections share one format, so do small and large pages,
+ * but with attribute bits at different places.
+ */
+static uint32_t __arm_mk_entry(addr_t paddr, size_t size, uint32_t flags)
 {
 	uint32_t ap, tex, c, b, s, xn;
-	arm_pte_l1_t entry;
+	uint32_t entry;
 
-	kprintf("DEBUG: map_sect(pt=0x%08x, paddr=0x%08x, vaddr=0x%08x, flags=0x%08x)\n",
-		page_table, (size_t)paddr, vaddr, flags);
 	/* process flags */
 	convert_flags(flags, ap, tex, c, b, s, xn);
-	/* cleanup */
-	__arm_unmap_l1(page_table, vaddr);
-	/* apply map */
-	entry = ARM_PT_L1_SECT;
-	entry |= paddr;
-	entry |= s << 16;
-	entry |= tex << 12;
-	entry |= ap << 10;
-	entry |= xn << 4;
+	switch (size) {
+		case ARM_SUPERSECT_SIZE:
+		case ARM_SECT_SIZE:
+			entry = ARM_PT_L1_SECT;
+			if (size == ARM_SUPERSECT_SIZE)
+				entry |= ARM_PT_L1_SUPERSECT;
+			entry |= paddr;
+			entry |= s << 16;
+			entry |= tex << 12;
+			entry |= ap << 10;
+			entry |= xn << 4;
+			break;
+		case ARM_LARGE_PAGE_SIZE:
+			entry = ARM_PT_L2_LARGE;
+			entry |= paddr;
+			entry |= xn << 15;
+			entry |= tex << 12;
+			entry |= s << 10;
+			entry |= ap << 4;
+			break;
+		default:
+			entry = ARM_PT_L2_PAGE;
+			entry |= paddr;
+			entry |= s << 10;
+			entry |= tex << 6;
+			entry |= ap << 4;
+			entry |= xn;
+			break;
+	}
 	entry |= c << 3;
 	entry |= b << 2;
-	page_table[vaddr >> ARM_SECT_SHIFT] = entry;
+	/* user memory is tagged with the ASID of its address space */
+	if ((flags & MAP_TYPE_MASK) == MAP_USER_MEM)
+		entry |= (size >= ARM_SECT_SIZE) ? ARM_PT_L1_NG : ARM_PT_L2_NG;
+	return entry;
+}
+
+/* attribute bits of a section entry, moved to small page positions */
+static inline arm_pte_l2_t __arm_sect_to_page(arm_pte_l1_t e1)
+{
+	arm_pte_l2_t e2 = ARM_PT_L2_PAGE;
+
+	e2 |= ((e1 >> 17) & 0x1) << 11;	/* nG */
+	e2 |= ((e1 >> 16) & 0x1) << 10;	/* S */
+	e2 |= ((e1 >> 15) & 0x1) << 9;	/* APX */
+	e2 |= ((e1 >> 12) & 0x7) << 6;	/* TEX */
+	e2 |= ((e1 >> 10) & 0x3) << 4;	/* AP */
+	e2 |= e1 & 0xC;			/* C, B */
+	e2 |= (e1 >> 4) & 0x1;		/* XN */
+	return e2;
 }
 
-/* does nothing if there's a table mapped already. */
-static inline void __arm_map_table(arm_pte_l1_t *page_table, size_t vaddr)
+/* attribute bits of a large page entry, moved to small page positions */
+static inline arm_pte_l2_t __arm_large_to_page(arm_pte_l2_t e2)
+{
+	arm_pte_l2_t page = ARM_PT_L2_PAGE;
+
+	page |= e2 & 0xE3C;		/* nG, S, APX, AP, C, B */
+	page |= ((e2 >> 12) & 0x7) << 6;	/* TEX */
+	page |= (e2 >> 15) & 0x1;	/* XN */
+	return page;
+}
+
+/*
+ * Describes the block mapping some virtual address.
+ * @entry points to the first of the repeated entries.
+ */
+struct arm_mapping {
+	uint32_t	*entry;
+	addr_t		paddr;
+	size_t		size;	/* 0 if not mapped */
+};
+
+static void __arm_lookup(arm_pte_l1_t *page_table, size_t vaddr,
+	struct arm_mapping *m)
+{
+	arm_pte_l1_t e1 = page_table[l1_index(vaddr)];
+	arm_pte_l2_t *t2;
+
+	m->size = 0;
+	switch (e1 & ARM_PT_L1_TYPE_MASK) {
+		case ARM_PT_L1_SECT:
+			if (e1 & ARM_PT_L1_SUPERSECT) {
+				vaddr = ALIGN_BELOW(vaddr, ARM_SUPERSECT_SIZE);
+				m->paddr = e1 & ARM_PT_L1_SUPERSECT_BASE_MASK;
+				m->size = ARM_SUPERSECT_SIZE;
+			} else {
+				m->paddr = e1 & ARM_PT_L1_SECT_BASE_MASK;
+				m->size = ARM_SECT_SIZE;
+			}
+			m->entry = &page_table[l1_index(vaddr)];
+			break;
+		case ARM_PT_L1_TABLE:
+			t2 = l2_table(e1);
+			switch (__arm_l2_type(t2[l2_index(vaddr)])) {
+				case ARM_PT_L2_PAGE:
+					m->entry = &t2[l2_index(vaddr)];
+					m->paddr = *m->entry &
+						ARM_PT_L2_PAGE_BASE_MASK;
+					m->size = ARM_PAGE_SIZE;
+					break;
+				case ARM_PT_L2_LARGE:
+					vaddr = ALIGN_BELOW(vaddr,
+						ARM_LARGE_PAGE_SIZE);
+					m->entry = &t2[l2_index(vaddr)];
+					m->paddr = *m->entry &
+						ARM_PT_L2_LARGE_BASE_MASK;
+					m->size = ARM_LARGE_PAGE_SIZE;
+					break;
+			}
+			break;
+	}
+}
+
+/*
+ * TLB maintenance after page table updates.
+ * Entries are dropped one by one by MVA for all ASIDs, broadcast to the
+ * inner shareable domain. Past ARM_TLB_INVAL_MAX entries we give up and
+ * invalidate the whole TLB once in __arm_tlb_done().
+ */
+#define ARM_TLB_INVAL_MAX	64
+
+static inline void __arm_tlb_inval_mva(size_t vaddr)
+{
+	/* make the table update visible to the walker first */
+	asm volatile (
+		"dsb;"
+		"mcr	p15, 0, %[mva], c8, c3, 3;"	/* TLBIMVAAIS */
+		::
+		[mva] "r" (ALIGN_BELOW(vaddr, ARM_PAGE_SIZE))
+		: "memory"
+	);
+}
+
+static inline void __arm_tlb_note(int *count, size_t vaddr)
+{
+	if (*count < ARM_TLB_INVAL_MAX)
+		__arm_tlb_inval_mva(vaddr);
+	*count += 1;
+}
+
+static inline void __arm_tlb_done(int count)
+{
+	if (count > ARM_TLB_INVAL_MAX) {
+		asm volatile (
+			"dsb;"
+			"mcr	p15, 0, %[zero], c8, c3, 0;"	/* TLBIALLIS */
+			::
+			[zero] "r" (0)
+			: "memory"
+		);
+	}
+	if (count > 0) {
+		asm volatile (
+			"dsb;"
+			"isb;"
+			::: "memory"
+		);
+	}
+}
+
+/*
+ * Splitting keeps the translation of every address, but the TLB may then
+ * hold the old block and the new ones for the same address, which ARMv7
+ * leaves unpredictable.  The old entry is dropped right after the new
+ * ones are in place.
+ * @vaddr is anywhere inside the block being split.
+ */
+static inline void __arm_split_done(size_t vaddr)
+{
+	__arm_tlb_inval_mva(vaddr);
+	__arm_tlb_done(1);
+}
+
+static void __arm_split_supersect(arm_pte_l1_t *entry, size_t vaddr)
+{
+	arm_pte_l1_t attr;
+	addr_t base;
+	int i;
+
+	/* drop base address bits, including extended ones in the domain */
+	attr = entry[0] & ~(ARM_PT_L1_SECT_BASE_MASK | ARM_PT_L1_SUPERSECT |
+		0x1E0);
+	base = entry[0] & ARM_PT_L1_SUPERSECT_BASE_MASK;
+	for (i = 0; i < ARM_PT_REPEAT; i += 1)
+		entry[i] = attr | (base + (i << ARM_SECT_SHIFT));
+	__arm_split_done(vaddr);
+}
+
+static int __arm_split_sect(arm_pte_l1_t *entry, size_t vaddr)
+{
+	arm_pte_l2_t *t2, attr;
+	addr_t base;
+	int i;
+
+	t2 = cache_alloc(pt_l2_cache);
+	if (t2 == NULL)
+		return EOF;
+	attr = __arm_sect_to_page(*entry);
+	base = *entry & ARM_PT_L1_SECT_BASE_MASK;
+	for (i = 0; i < ARM_PT_L2_LENGTH; i += 1)
+		t2[i] = attr | (base + (i << ARM_PAGE_SHIFT));
+	*entry = ARM_PT_L1_TABLE | kva2pa((uint32_t)t2);
+	__arm_split_done(vaddr);
+	return 0;
+}
+
+static void __arm_split_large(arm_pte_l2_t *entry, size_t vaddr)
+{
+	arm_pte_l2_t attr;
+	addr_t base;
+	int i;
+
+	attr = __arm_large_to_page(entry[0]);
+	base = entry[0] & ARM_PT_L2_LARGE_BASE_MASK;
+	for (i = 0; i < ARM_PT_REPEAT; i += 1)
+		entry[i] = attr | (base + (i << ARM_PAGE_SHIFT));
+	__arm_split_done(vaddr);
+}
+
+/*
+ * Split the block mapping @vaddr until it starts at @vaddr and ends no later
+ * than @vend. The resulting block is described in @m.
+ */
+static int __arm_fit(arm_pte_l1_t *page_table, size_t vaddr, size_t vend,
+	struct arm_mapping *m)
+{
+	for (;;) {
+		__arm_lookup(page_table, vaddr, m);
+		if (m->size == 0)
+			return 0;
+		if (IS_ALIGNED(vaddr, m->size) && vend - vaddr >= m->size)
+			return 0;
+		switch (m->size) {
+			case ARM_SUPERSECT_SIZE:
+				__arm_split_supersect(m->entry, vaddr);
+				break;
+			case ARM_SECT_SIZE:
+				if (__arm_split_sect(m->entry, vaddr) != 0)
+					return EOF;
+				break;
+			case ARM_LARGE_PAGE_SIZE:
+				__arm_split_large(m->entry, vaddr);
+				break;
+			default:
+				panic("ARM: unaligned range 0x%08x-0x%08x\n",
+					vaddr, vend);
+		}
+	}
+}
+
+/* internal routines does not check for bad parameters */
+/* does nothing if not mapped */
+static inline void __arm_unmap_l1(arm_pte_l1_t *page_table, size_t vaddr)
 {
 	arm_pte_l1_t entry;
 
-	/* check whether we map at all */
-	entry = page_table[vaddr >> ARM_SECT_SHIFT];
+	entry = page_table[l1_index(vaddr)];
 	if ((entry & ARM_PT_L1_TYPE_MASK) == ARM_PT_L1_TABLE)
-		return;
-	/* allocate a L2 table */
-	void *l2 = cache_alloc(pt_l2_cache);
-	assert(l2 != NULL);
+		cache_free(pt_l2_cache, l2_table(entry));
+	page_table[l1_index(vaddr)] = 0;
+}
+
+static inline void __arm_map_supersect(arm_pte_l1_t *page_table,
+	addr_t paddr, size_t vaddr, uint32_t flags)
+{
+	int i;
+
+	/* cleanup, an old supersection here can only be in the same place */
+	for (i = 0; i < ARM_PT_REPEAT; i += 1)
+		__arm_unmap_l1(page_table, vaddr + (i << ARM_SECT_SHIFT));
 	/* apply map */
-	entry = ARM_PT_L1_TABLE;
-	entry |= kva2pa((uint32_t)l2);
-	page_table[vaddr >> ARM_SECT_SHIFT] = entry;
+	__arm_fill(&page_table[l1_index(vaddr)],
+		__arm_mk_entry(paddr, ARM_SUPERSECT_SIZE, flags),
+		ARM_SUPERSECT_SIZE);
 }
 
-static inline void __arm_map_page(arm_pte_l1_t *page_table, addr_t paddr,
+static inline void __arm_map_sect(arm_pte_l1_t *page_table, addr_t paddr,
 	size_t vaddr, uint32_t flags)
 {
-	uint32_t ap, tex, c, b, s, xn;
-	arm_pte_l1_t *t1, e1;
-	arm_pte_l2_t *t2, e2;
+	arm_pte_l1_t entry;
 
-	kprintf("DEBUG: map_page(pt=0x%08x, paddr=0x%08x, vaddr=0x%08x, flags=0x%08x)\n",
-		page_table, (size_t)paddr, vaddr, flags);
-	/* process flags */
-	convert_flags(flags, ap, tex, c, b, s, xn);
-	/* make sure a table is mapped */
-	__arm_map_table(page_table, ALIGN_BELOW(vaddr, ARM_SECT_SIZE));
-	/* get the L2 table */
-	t1 = page_table;
-	e1 = t1[vaddr >> ARM_SECT_SHIFT];
-	t2 = (arm_pte_l2_t *)(e1 & ARM_PT_L1_TABLE_BASE_MASK);
+	/* cleanup, keeping the rest of a supersection */
+	entry = page_table[l1_index(vaddr)];
+	if ((entry & ARM_PT_L1_TYPE_MASK) == ARM_PT_L1_SECT &&
+	    (entry & ARM_PT_L1_SUPERSECT))
+		__arm_split_supersect(&page_table[
+			l1_index(ALIGN_BELOW(vaddr, ARM_SUPERSECT_SIZE))], vaddr);
+	__arm_unmap_l1(page_table, vaddr);
+	/* apply map */
+	page_table[l1_index(vaddr)] =
+		__arm_mk_entry(paddr, ARM_SECT_SIZE, flags);
+}
+
+/*
+ * Returns the L2 table for @vaddr, allocating one if needed. A section
+ * already there is split into pages, so the rest of it stays mapped.
+ */
+static arm_pte_l2_t *__arm_map_table(arm_pte_l1_t *page_table, size_t vaddr)
+{
+	arm_pte_l1_t *entry = &page_table[l1_index(vaddr)];
+	struct arm_mapping m;
+	arm_pte_l2_t *t2;
+
+	switch (*entry & ARM_PT_L1_TYPE_MASK) {
+		case ARM_PT_L1_TABLE:
+			break;
+		case ARM_PT_L1_SECT:
+			__arm_lookup(page_table, vaddr, &m);
+			if (m.size == ARM_SUPERSECT_SIZE)
+				__arm_split_supersect(m.entry, vaddr);
+			if (__arm_split_sect(entry, vaddr) != 0)
+				return NULL;
+			break;
+		default:
+			/* allocate a L2 table */
+			t2 = cache_alloc(pt_l2_cache);
+			if (t2 == NULL)
+				return NULL;
+			/* apply map */
+			*entry = ARM_PT_L1_TABLE | kva2pa((uint32_t)t2);
+			break;
+	}
+	return l2_table(*entry);
+}
+
+static inline int __arm_map_large(arm_pte_l1_t *page_table, addr_t paddr,
+	size_t vaddr, uint32_t flags)
+{
+	arm_pte_l2_t *t2;
+
+	t2 = __arm_map_table(page_table, vaddr);
+	if (t2 == NULL)
+		return EOF;
+	/* whatever was here occupied the same 16 entries or less */
+	__arm_fill(&t2[l2_index(vaddr)],
+		__arm_mk_entry(paddr, ARM_LARGE_PAGE_SIZE, flags),
+		ARM_LARGE_PAGE_SIZE);
+	return 0;
+}
+
+static inline int __arm_map_page(arm_pte_l1_t *page_table, addr_t paddr,
+	size_t vaddr, uint32_t flags)
+{
+	arm_pte_l2_t *t2;
+
+	t2 = __arm_map_table(page_table, vaddr);
+	if (t2 == NULL)
+		return EOF;
+	/* keep the rest of a large page */
+	if (__arm_l2_type(t2[l2_index(vaddr)]) == ARM_PT_L2_LARGE)
+		__arm_split_large(&t2[
+			l2_index(ALIGN_BELOW(vaddr, ARM_LARGE_PAGE_SIZE))], vaddr);
 	/* apply map */
-	e2 = ARM_PT_L2_PAGE;
-	e2 |= paddr;
-	e2 |= s << 10;
-	e2 |= tex << 6;
-	e2 |= ap << 4;
-	e2 |= c << 3;
-	e2 |= b << 2;
-	e2 |= xn;
-	t2[(vaddr >> ARM_PAGE_SHIFT) & 0xFF] = e2;
+	t2[l2_index(vaddr)] = __arm_mk_entry(paddr, ARM_PAGE_SIZE, flags);
+	return 0;
+}
+
+/* free L2 tables in [vstart, vend) left with no mappings */
+static void __arm_free_empty_l2(arm_pte_l1_t *page_table, size_t vstart,
+	size_t vend)
+{
+	arm_pte_l1_t *entry;
+	arm_pte_l2_t *t2;
+	size_t vaddr;
+	int i;
+
+	for (vaddr = ALIGN_BELOW(vstart, ARM_SECT_SIZE); vaddr < vend;
+	    vaddr += ARM_SECT_SIZE) {
+		/* kernel L2 tables are shared, see init_pgindex() */
+		if (vaddr >= KERN_BASE)
+			break;
+		entry = &page_table[l1_index(vaddr)];
+		if ((*entry & ARM_PT_L1_TYPE_MASK) != ARM_PT_L1_TABLE)
+			continue;
+		t2 = l2_table(*entry);
+		for (i = 0; i < ARM_PT_L2_LENGTH; i += 1)
+			if (t2[i] != ARM_PT_L2_FREE)
+				break;
+		if (i < ARM_PT_L2_LENGTH)
+			continue;
+		/* the walker may still hold the table, drop it first */
+		*entry = ARM_PT_L1_FREE;
+		__arm_tlb_inval_mva(vaddr);
+		__arm_tlb_done(1);
+		cache_free(pt_l2_cache, t2);
+	}
 }
 
 /*
@@ -182,9 +532,19 @@ int page_index_early_map(pgindex_t *index, addr_t paddr, size_t vaddr,
 	}
 	/* map each ARM SECT */
 	size_t vend = vaddr + length;
+	addr_t mem_base = get_mem_physbase();
+	addr_t mem_end = mem_base + get_mem_size();
 	while (vaddr < vend) {
-		/* Failsafe attributes for early mappings */
-		__arm_map_sect(index, paddr, vaddr, MAP_SHARED_DEV | VMA_EXEC);
+		/*
+		 * RAM is normal cacheable memory, everything else gets the
+		 * failsafe device attributes.
+		 */
+		if (paddr >= mem_base && paddr < mem_end)
+			__arm_map_sect(index, paddr, vaddr,
+				MAP_KERN_MEM | VMA_EXEC);
+		else
+			__arm_map_sect(index, paddr, vaddr,
+				MAP_SHARED_DEV | VMA_EXEC);
 		paddr += ARM_SECT_SIZE;
 		vaddr += ARM_SECT_SIZE;
 	}
@@ -197,23 +557,70 @@ int page_index_early_map(pgindex_t *index, addr_t paddr, size_t vaddr,
  */
 int mmu_init(pgindex_t *index)
 {
+    /* caches must be clean and coherent before they are turned on */
+    cache_init();
     asm volatile (
-        /* Address */
-        "mcr     p15, 0, %[index], c2, c0, 0;"
+        /* Address, with table walks going through the caches */
+        "orr     r0, %[index], %[ttb_flags];"
+        "mcr     p15, 0, r0, c2, c0, 0;"
         /* access permission */
         "mov     r0, #0x1;"
         "mcr     p15, 0, r0, c3, c0, 0;"
-        /* turn on MMU */
+        /* turn on MMU, caches and branch prediction */
         "mrc     p15, 0, r0, c1, c0, 0;"
-        "orr     r0, r0, #0x1;"
+        "orr     r0, r0, %[sctlr];"
         "mcr     p15, 0, r0, c1, c0, 0;"
+        "isb;"
         ::
         /* For ARM cores, we have low address now, don't translate address. */
-        [index] "r" (index)
+        [index] "r" (index),
+        [ttb_flags] "i" (ARM_TTB_FLAGS),
+        [sctlr] "r" (ARM_SCTLR_M | ARM_SCTLR_C | ARM_SCTLR_Z | ARM_SCTLR_I)
+        : "r0", "memory"
     );
     return 0;
 }
 
+/*
+ * arch_switch_mm()
+ * TTBR0 changes under the reserved ASID 0, so that no translation of the
+ * old table gets tagged with the new ASID or vice versa.
+ */
+void arch_switch_mm(struct mm *mm)
+{
+	unsigned long asid;
+	bool flush;
+
+	asid = asid_switch(mm, &flush);
+	asm volatile (
+		"mcr	p15, 0, %[zero], c13, c0, 1;"	/* CONTEXTIDR */
+		"isb;"
+		"mcr	p15, 0, %[ttbr], c2, c0, 0;"	/* TTBR0 */
+		"isb;"
+		::
+		[zero] "r" (0),
+		[ttbr] "r" (kva2pa((uint32_t)mm->pgindex) | ARM_TTB_FLAGS)
+		: "memory"
+	);
+	if (flush) {
+		asm volatile (
+			"mcr	p15, 0, %[zero], c8, c7, 0;"	/* TLBIALL */
+			"dsb;"
+			"isb;"
+			::
+			[zero] "r" (0)
+			: "memory"
+		);
+	}
+	asm volatile (
+		"mcr	p15, 0, %[asid], c13, c0, 1;"	/* CONTEXTIDR */
+		"isb;"
+		::
+		[asid] "r" (asid)
+		: "memory"
+	);
+}
+
 /* add memory chunks to page allocator */
 void add_memory_pages(void)
 {
@@ -266,13 +673,46 @@ void arch_mm_init(void)
 	pt_l2_cache->create_obj = __pt_l2_clear;
 	pt_l2_cache->destroy_obj = __pt_l2_clear;
 	assert(cache_create(pt_l2_cache) == 0);
-
-	/* SCU, cache and branch predict goes here */
 }
 
+/*
+ * The kernel part of the L1 table is copied from kern_pgindex(), so that
+ * both point to the same L2 tables.  These are never freed, and
+ * share_kern_pgtables() creates the ones for later kernel mappings
+ * beforehand.
+ */
 pgindex_t *init_pgindex(void)
 {
-	return (pgindex_t *)cache_alloc(pt_l1_cache);
+	arm_pte_l1_t *table, *kern = kern_pgindex();
+
+	table = cache_alloc(pt_l1_cache);
+	if (table == NULL)
+		return NULL;
+	memcpy(&table[l1_index(KERN_BASE)], &kern[l1_index(KERN_BASE)],
+		(ARM_PT_L1_LENGTH - l1_index(KERN_BASE)) *
+		sizeof(arm_pte_l1_t));
+	return table;
+}
+
+int share_kern_pgtables(void *vaddr, size_t size)
+{
+	arm_pte_l1_t *kern = kern_pgindex();
+	arm_pte_l2_t *t2;
+	size_t i, iend;
+
+	if (size == 0)
+		return 0;
+	iend = l1_index((size_t)vaddr + size - ARM_PAGE_SIZE);
+	for (i = l1_index((size_t)vaddr); i <= iend; i += 1) {
+		/* sections need no table */
+		if (kern[i] != ARM_PT_L1_FREE)
+			continue;
+		t2 = cache_alloc(pt_l2_cache);
+		if (t2 == NULL)
+			return EOF;
+		kern[i] = ARM_PT_L1_TABLE | kva2pa((uint32_t)t2);
+	}
+	return 0;
 }
 
 void destroy_pgindex(pgindex_t *pgindex)
@@ -280,94 +720,209 @@ void destroy_pgindex(pgindex_t *pgindex)
 	arm_pte_l1_t *table = pgindex;
 	int i;
 
-	/* free L2 tables (if any) */
-	for (i = 0; i < ARM_PT_L1_LENGTH; i += 1) {
+	/* free L2 tables (if any), except the shared kernel ones */
+	for (i = 0; i < l1_index(KERN_BASE); i += 1) {
 		uint32_t type = table[i] & ARM_PT_L1_TYPE_MASK;
-		if (type == ARM_PT_L1_TABLE) {
-			uint32_t l2table =
-				table[i] & ARM_PT_L1_TABLE_BASE_MASK;
-			cache_free(pt_l2_cache, (void *)l2table);
-		}
+		if (type == ARM_PT_L1_TABLE)
+			cache_free(pt_l2_cache, l2_table(table[i]));
 	}
 
 	/* free the L1 table itself */
 	cache_free(pt_l1_cache, pgindex);
 }
 
+/* whether a block of @blk bytes can map @vaddr to @paddr */
+#define can_map(vaddr, paddr, size, blk) \
+	(IS_ALIGNED((vaddr), (blk)) && IS_ALIGNED((paddr), (blk)) && \
+	 (size) >= (blk))
+
+/*
+ * Whether a @blk block at @vaddr would only take free entries.  Sections
+ * never replace an L2 table, even an empty one, as other page indexes may
+ * share it.
+ */
+static bool __arm_block_free(arm_pte_l1_t *page_table, size_t vaddr,
+	size_t blk)
+{
+	arm_pte_l1_t e1 = page_table[l1_index(vaddr)];
+	arm_pte_l2_t *t2;
+	int i;
+
+	if (blk >= ARM_SECT_SIZE) {
+		for (i = 0; i < __arm_nr_entries(blk); i += 1)
+			if (page_table[l1_index(vaddr) + i] != ARM_PT_L1_FREE)
+				return false;
+		return true;
+	}
+	if (e1 == ARM_PT_L1_FREE)
+		return true;
+	if ((e1 & ARM_PT_L1_TYPE_MASK) != ARM_PT_L1_TABLE)
+		return false;
+	t2 = l2_table(e1);
+	for (i = 0; i < __arm_nr_entries(blk); i += 1)
+		if (t2[l2_index(vaddr) + i] != ARM_PT_L2_FREE)
+			return false;
+	return true;
+}
+
+static ssize_t __unmap_pages(pgindex_t *pgindex, void *vaddr, size_t size,
+    addr_t *paddr, bool flush);
+
+/*
+ * Like on other architectures, mapping over anything already mapped fails,
+ * and a failure leaves the range as it was.
+ */
 int map_pages(pgindex_t *pgindex, void *vaddr, addr_t paddr, size_t size,
     uint32_t flags)
 {
+	size_t vstart = (size_t)vaddr, vcur = vstart, vend = vstart + size;
+	size_t blk;
+	int ret;
+
 	if (pgindex == NULL) return EOF;
 	/* make sure we are page aligned */
 	if (!(
-		IS_ALIGNED((size_t)vaddr, ARM_PAGE_SIZE) &&
+		IS_ALIGNED(vcur, ARM_PAGE_SIZE) &&
 		IS_ALIGNED(paddr, ARM_PAGE_SIZE) &&
 		IS_ALIGNED(size, ARM_PAGE_SIZE)
 	)) return EOF;
-	/* apply mappings */
-	while (size > 0) {
-		if (
-			IS_ALIGNED((size_t)vaddr, ARM_SECT_SIZE) &&
-			IS_ALIGNED(paddr, ARM_SECT_SIZE) &&
-			size >= ARM_SECT_SIZE
-		) {
-			/* allowed and possible, map a section */
-			__arm_map_sect(pgindex, paddr, (size_t)vaddr, flags);
-			vaddr += ARM_SECT_SIZE;
-			paddr += ARM_SECT_SIZE;
-			size -= ARM_SECT_SIZE;
+	/* apply mappings, with the largest block allowed and possible */
+	while (vcur < vend) {
+		if (can_map(vcur, paddr, vend - vcur, ARM_SUPERSECT_SIZE) &&
+		    __arm_block_free(pgindex, vcur, ARM_SUPERSECT_SIZE)) {
+			blk = ARM_SUPERSECT_SIZE;
+			__arm_map_supersect(pgindex, paddr, vcur, flags);
+			ret = 0;
+		} else if (can_map(vcur, paddr, vend - vcur, ARM_SECT_SIZE) &&
+		    __arm_block_free(pgindex, vcur, ARM_SECT_SIZE)) {
+			blk = ARM_SECT_SIZE;
+			__arm_map_sect(pgindex, paddr, vcur, flags);
+			ret = 0;
+		} else if (can_map(vcur, paddr, vend - vcur,
+		    ARM_LARGE_PAGE_SIZE)) {
+			blk = ARM_LARGE_PAGE_SIZE;
+			ret = EOF;
+			if (__arm_block_free(pgindex, vcur, blk))
+				ret = __arm_map_large(pgindex, paddr, vcur,
+					flags);
 		} else {
-			/* allowed and possible, map a section */
-			__arm_map_page(pgindex, paddr, (size_t)vaddr, flags);
-			vaddr += ARM_PAGE_SIZE;
-			paddr += ARM_PAGE_SIZE;
-			size -= ARM_PAGE_SIZE;
+			blk = ARM_PAGE_SIZE;
+			ret = EOF;
+			if (__arm_block_free(pgindex, vcur, blk))
+				ret = __arm_map_page(pgindex, paddr, vcur,
+					flags);
 		}
+		if (ret != 0)
+			goto rollback;
+		vcur += blk;
+		paddr += blk;
 	}
 	return 0;
+
+rollback:
+	if (vcur != vstart)
+		__unmap_pages(pgindex, vaddr, vcur - vstart, NULL, true);
+	return EOF;
 }
 
-#define get_mapped(pt, vaddr, paddr, size) \
-	do { \
-	arm_pte_l1_t e1 = (pt)[(vaddr) >> ARM_SECT_SHIFT]; \
-	arm_pte_l2_t *t2, e2; \
-	switch (e1 & ARM_PT_L1_TYPE_MASK) { \
-		case ARM_PT_L1_TABLE: \
-			t2 = (arm_pte_l2_t *)(e1 & ARM_PT_L1_TABLE_BASE_MASK); \
-			e2 = t2[(vaddr >> ARM_PAGE_SHIFT) & 0xFF]; \
-			(paddr) = e2 & ARM_PT_L2_PAGE_BASE_MASK; \
-			(size) = ARM_PAGE_SIZE; \
-			break; \
-		case ARM_PT_L1_SECT: \
-			(paddr) = e1 & ARM_PT_L1_SECT_BASE_MASK; \
-			(size) = ARM_SECT_SIZE; \
-			break; \
-		default: (paddr)=0; (size)=0; \
-	} \
-	} while (0)
+static ssize_t __unmap_pages(pgindex_t *pgindex, void *vaddr, size_t size,
+    addr_t *paddr, bool flush)
+{
+	arm_pte_l1_t *table = pgindex;
+	struct arm_mapping m;
+	size_t vstart = (size_t)vaddr, vcur = vstart, vend = vstart + size;
+	addr_t head_paddr = 0;
+	int ninval = 0;
+
+	while (vcur < vend) {
+		/* blocks crossing the range are split, keeping the rest */
+		if (__arm_fit(table, vcur, vend, &m) != 0)
+			break;
+		if (m.size == 0)
+			break;
+		if (vcur == vstart)
+			head_paddr = m.paddr;
+		else if (m.paddr != head_paddr + (vcur - vstart))
+			break;
+		/* unmap */
+		__arm_fill(m.entry, 0, m.size);
+		if (flush)
+			__arm_tlb_note(&ninval, vcur);
+		vcur += m.size;
+	}
+	if (flush) {
+		__arm_tlb_done(ninval);
+		__arm_free_empty_l2(table, vstart, vcur);
+	}
+
+	if (paddr != NULL && vcur != vstart)
+		*paddr = head_paddr;
+	return vcur - vstart;
+}
 
 ssize_t unmap_pages(pgindex_t *pgindex, void *vaddr, size_t size, addr_t *paddr)
+{
+	return __unmap_pages(pgindex, vaddr, size, paddr, true);
+}
+
+ssize_t unmap_pages_noflush(pgindex_t *pgindex, void *vaddr, size_t size,
+    addr_t *paddr)
+{
+	return __unmap_pages(pgindex, vaddr, size, paddr, false);
+}
+
+void free_empty_pgtables(pgindex_t *pgindex, void *vaddr, size_t size)
+{
+	__arm_free_empty_l2(pgindex, (size_t)vaddr, (size_t)vaddr + size);
+}
+
+/* TLBIALLIS reaches every core in the inner shareable domain */
+void tlb_flush_all(void)
+{
+	asm volatile (
+		"dsb;"
+		"mcr	p15, 0, %[zero], c8, c3, 0;"	/* TLBIALLIS */
+		"dsb;"
+		"isb;"
+		::
+		[zero] "r" (0)
+		: "memory"
+	);
+}
+
+int protect_pages(pgindex_t *pgindex, void *vaddr, size_t size,
+    uint32_t flags)
 {
 	arm_pte_l1_t *table = pgindex;
-	addr_t head_paddr, this_paddr;
-	size_t block_size, this_size;
-
-	/* find a start point */
-	get_mapped(table, (size_t)vaddr, this_paddr, this_size);
-	if (this_size == 0) return 0;
-	head_paddr = this_paddr;
-	block_size = this_size;
-	while (block_size < size) {
-		/* unmap */
-		/* increment address */
-		vaddr += this_size;
-		get_mapped(table, (size_t)vaddr, this_paddr, this_size);
-		if (this_size == 0 || this_paddr != head_paddr + block_size) {
-			return block_size;
-		} else {
-			block_size += this_size;
+	struct arm_mapping m;
+	size_t vcur = (size_t)vaddr, vend = vcur + size;
+	int ninval = 0, ret = 0;
+
+	if (pgindex == NULL) return EOF;
+	if (!(
+		IS_ALIGNED(vcur, ARM_PAGE_SIZE) &&
+		IS_ALIGNED(size, ARM_PAGE_SIZE)
+	)) return EOF;
+	while (vcur < vend) {
+		if (__arm_fit(table, vcur, vend, &m) != 0) {
+			ret = EOF;
+			break;
 		}
+		if (m.size == 0) {
+			/* skip the hole */
+			if ((table[l1_index(vcur)] & ARM_PT_L1_TYPE_MASK) ==
+			    ARM_PT_L1_FREE)
+				vcur = ALIGN_BELOW(vcur, ARM_SECT_SIZE) +
+					ARM_SECT_SIZE;
+			else
+				vcur += ARM_PAGE_SIZE;
+			continue;
+		}
+		__arm_fill(m.entry, __arm_mk_entry(m.paddr, m.size, flags),
+			m.size);
+		__arm_tlb_note(&ninval, vcur);
+		vcur += m.size;
 	}
-	return block_size;
+	__arm_tlb_done(ninval);
+	return ret;
 }
-
@@ -32,6 +32,7 @@
  * spinlock
  * Note that the lock option is written out explicitly in entry.S
  * The implementation there MUST work together with this one.
+ * Waiters sleep with WFE, and unlocking wakes them with SEV.
  */
 
 void spinlock_init(lock_t *lock)
@@ -42,103 +43,147 @@ void spinlock_init(lock_t *lock)
 	SMP_DMB();
 }
 
-void spin_lock(lock_t *lock)
+void arch_spin_lock(lock_t *lock)
 {
-	register int val;
+	register lock_t val, tmp;
 	int ret = ARM_STREX_FAIL;
+	uint16_t ticket;
 
+	/* take a ticket */
 	while (ret != ARM_STREX_SUCCESS) {
 		asm volatile (
 			"ldrex		%[val], [%[addr]];"
-			"cmp		%[val], %[unlocked];"
-			"wfene;"
-			"strexeq	%[ret], %[locked], [%[addr]];"
-			: [val] "=r" (val),
-			  [ret] "=r" (ret)
-			: [locked] "r" (LOCKED),
-			  [unlocked] "i" (UNLOCKED),
+			"add		%[tmp], %[val], %[inc];"
+			"strex		%[ret], %[tmp], [%[addr]];"
+			: [val] "=&r" (val),
+			  [tmp] "=&r" (tmp),
+			  [ret] "=&r" (ret)
+			: [inc] "r" (1 << LOCK_TICKET_SHIFT),
 			  [addr] "r" (lock)
+			: "memory"
 		);
 	}
+
+	/* and wait for it */
+	ticket = lock_next(val);
+	while (lock_owner(val) != ticket) {
+		asm volatile ("wfe");
+		val = *(volatile lock_t *)lock;
+	}
 	SMP_DMB();
 }
 
-void spin_unlock(lock_t *lock)
+void arch_spin_unlock(lock_t *lock)
 {
+	lock_t val = *lock;
+
 	/*
 	 * if caller trys to unlock a lock that is not locked (by him),
 	 * some data structure must be broken.
 	 */
-	if (*lock == UNLOCKED)
+	if (!lock_held(val))
 		panic("Unlocking not-owned lock at 0x%08x\n", lock);
 
 	SMP_DMB();
-	*lock = UNLOCKED;
+	lock_owner_half(lock) = lock_owner(val) + 1;
 	SMP_DSB();
 	asm volatile ("sev");
 }
 
-/* Semaphore */
+/*
+ * Reader-writer spinlock
+ * Waiters sleep with WFE like arch_spin_lock(). The last reader out and the
+ * writer leaving send the event.
+ */
 
-void semaphore_init(semaphore_t *sem, int val)
+void rwlock_init(rwlock_t *lock)
 {
-	/* we write it out directly */
-	sem->val = val;
-	sem->limit = val;
-	/* make it visible */
+	*lock = RW_UNLOCKED;
 	SMP_DMB();
 }
 
-void semaphore_dec(semaphore_t *sem)
+void read_lock(rwlock_t *lock)
 {
-	register int val;
+	register rwlock_t val;
 	int ret = ARM_STREX_FAIL;
 
 	while (ret != ARM_STREX_SUCCESS) {
 		asm volatile (
 			"ldrex		%[val], [%[addr]];"
-			"subs		%[val], %[val], %[amount];"
-			"wfemi;"/* minus */
-			"strexpl	%[ret], %[val], [%[addr]];"
-			/* pl means positive or zero */
-			: [val] "=r" (val),
-			  [ret] "=r" (ret)
-			: [amount] "i" (1),
-			  [addr] "r" (&sem->val)
+			"tst		%[val], %[writer];"
+			"movne		%[ret], %[fail];"
+			"addeq		%[val], %[val], #1;"
+			"strexeq	%[ret], %[val], [%[addr]];"
+			: [val] "=&r" (val),
+			  [ret] "=&r" (ret)
+			: [writer] "r" (RW_WRITER),
+			  [fail] "i" (ARM_STREX_FAIL),
+			  [addr] "r" (lock)
+			: "cc", "memory"
 		);
+		if (val & RW_WRITER)
+			asm volatile ("wfe");
 	}
 	SMP_DMB();
 }
 
-void semaphore_inc(semaphore_t *sem)
+void read_unlock(rwlock_t *lock)
 {
-	register int val;
+	register rwlock_t val;
 	int ret = ARM_STREX_FAIL;
 
-	/*
-	 * Things are put inside the loop because LDREX gets a different
-	 * value per try. ONE SINGLE OVERFLOW MEANS DATA CORRUPTION.
-	 */
-	while (ret == ARM_STREX_FAIL) {
-		SMP_DMB();
+	SMP_DMB();
+	while (ret != ARM_STREX_SUCCESS) {
 		asm volatile (
 			"ldrex		%[val], [%[addr]];"
-			"add		%[val], %[val], %[amount];"
-			"cmp		%[val], %[limit];"
-			"movgt		%[ret], %[corrupt];"
-			"strexle	%[ret], %[val], [%[addr]];"
-			/* STREX happens only at signed less or equal. */
-			: [val] "=r" (val),
-			  [ret] "=r" (ret)
-			: [amount] "i" (1),
-			  [corrupt] "i" (ARM_STREX_CORRUPT),
-			  [limit] "ir" (sem->limit),
-			  [addr] "r" (&sem->val)
+			"sub		%[val], %[val], #1;"
+			"strex		%[ret], %[val], [%[addr]];"
+			: [val] "=&r" (val),
+			  [ret] "=&r" (ret)
+			: [addr] "r" (lock)
+			: "memory"
 		);
 	}
-	if (ret == ARM_STREX_CORRUPT)
-		panic("Increasing semaphore at 0x%08x to %d/%d\n", \
-			sem, val, sem->limit);
-	SMP_DSB();
+	/* a writer may be waiting for us */
+	if ((val & RW_READERS) == 0) {
+		SMP_DSB();
+		asm volatile ("sev");
+	}
 }
 
+void write_lock(rwlock_t *lock)
+{
+	register rwlock_t val;
+	int ret = ARM_STREX_FAIL;
+
+	/* keep new readers out, then wait for those inside */
+	while (ret != ARM_STREX_SUCCESS) {
+		asm volatile (
+			"ldrex		%[val], [%[addr]];"
+			"tst		%[val], %[writer];"
+			"movne		%[ret], %[fail];"
+			"orreq		%[val], %[val], %[writer];"
+			"strexeq	%[ret], %[val], [%[addr]];"
+			: [val] "=&r" (val),
+			  [ret] "=&r" (ret)
+			: [writer] "r" (RW_WRITER),
+			  [fail] "i" (ARM_STREX_FAIL),
+			  [addr] "r" (lock)
+			: "cc", "memory"
+		);
+		if (ret != ARM_STREX_SUCCESS && (val & RW_WRITER))
+			asm volatile ("wfe");
+	}
+	while (*(volatile rwlock_t *)lock & RW_READERS)
+		asm volatile ("wfe");
+	SMP_DMB();
+}
+
+void write_unlock(rwlock_t *lock)
+{
+	/* no reader can get in while we are here */
+	SMP_DMB();
+	*(volatile rwlock_t *)lock = RW_UNLOCKED;
+	SMP_DSB();
+	asm volatile ("sev");
+}
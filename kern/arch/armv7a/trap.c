@@ -25,6 +25,8 @@
 #include <panic.h>
 #include <console.h>
 #include <regs.h>
+#include <ipi.h>
+#include <mach.h>
 
 #include <arm-trap.h>
 
@@ -102,6 +104,45 @@ void trap_return(struct regs *regs)
 	panic("Control flow went beyond trap_return().");
 }
 
+/* fault status from DFSR and IFSR, short-descriptor format */
+#define ARM_FSR_STATUS(fsr)	(((fsr) & 0xF) | (((fsr) >> 6) & 0x10))
+#define ARM_FSR_TRANS_SECT	0x5
+#define ARM_FSR_TRANS_PAGE	0x7
+#define ARM_FSR_PERM_SECT	0xD
+#define ARM_FSR_PERM_PAGE	0xF
+#define ARM_DFSR_WNR		(1 << 11)
+
+static int arm_handle_abort(uint32_t type)
+{
+	uint32_t far, fsr, flags;
+
+	if (type == ARM_DATA_ABT) {
+		asm volatile (
+			"mrc	p15, 0, %[far], c6, c0, 0;"	/* DFAR */
+			"mrc	p15, 0, %[fsr], c5, c0, 0;"	/* DFSR */
+			: [far] "=r" (far), [fsr] "=r" (fsr)
+		);
+		flags = (fsr & ARM_DFSR_WNR) ? VMA_WRITE : VMA_READ;
+	} else {
+		asm volatile (
+			"mrc	p15, 0, %[far], c6, c0, 2;"	/* IFAR */
+			"mrc	p15, 0, %[fsr], c5, c0, 1;"	/* IFSR */
+			: [far] "=r" (far), [fsr] "=r" (fsr)
+		);
+		flags = VMA_EXEC;
+	}
+
+	switch (ARM_FSR_STATUS(fsr)) {
+	case ARM_FSR_TRANS_SECT:
+	case ARM_FSR_TRANS_PAGE:
+	case ARM_FSR_PERM_SECT:
+	case ARM_FSR_PERM_PAGE:
+		return handle_page_fault(current_mm(), (void *)far, flags);
+	default:
+		return -1;
+	}
+}
+
 __noreturn
 void arm_handle_trap(struct regs *regs, uint32_t type)
 {
@@ -115,6 +156,14 @@ void arm_handle_trap(struct regs *regs, uint32_t type)
 	 * you are RECOMMENDED to store regs on stack and not on heap.
 	 * see trap_return for details.
 	 */
+	if ((type == ARM_DATA_ABT || type == ARM_PREF_ABT) &&
+	    arm_handle_abort(type) == 0)
+		trap_return(regs);
+	if (type == ARM_IRQ && mach_ipi_ack()) {
+		ipi_handler();
+		trap_return(regs);
+	}
+
 	kprintf("DEBUG: Enter vector slot %d handler!\n", type);
 	kprintf("DEBUG: r0 = 0x%08x\n", regs->r0);
 	kprintf("DEBUG: r1 = 0x%08x\n", regs->r1);
@@ -26,8 +26,11 @@
 #include <util.h>
 #include <mm.h>
 #include <memlayout.h>
+#include <percpu.h>
 #include <segment.h>
 #include <asm.h>
+#include <lapic.h>
+#include <smp.h>
 
 /* FIXME: put in mm.c? */
 static size_t mem_size = 0;
@@ -95,42 +98,52 @@ void early_arch_init(void)
 	portio_bus_init(&portio_bus);
 
 	probe_memory();
+	lapic_early_init();
 }
 
-/* TODO: put into per-CPU structure */
-static struct segdesc gdt[NR_SEGMENTS] = {
+/*
+ * Each CPU loads its own copy of these, and finds it before its per-CPU
+ * segment is set up: the linked image on the boot CPU, which is all there
+ * is before percpu_init(), and the copy made by percpu_init() on others.
+ */
+static DEFINE_PER_CPU(struct segdesc, gdt[NR_SEGMENTS]) = {
 	[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_KERNEL),
 	[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, DPL_KERNEL),
+	/* based at our per-CPU offset, the linked image until percpu_init() */
+	[SEG_KCPU] = SEG(STA_W, 0, 0xffffffff, DPL_KERNEL),
 	[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER),
 	[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER)
 };
-static struct taskstate ts = {0};
-static unsigned char tempkstack[2048] = {0};
+static DEFINE_PER_CPU(struct taskstate, ts) = {0};
+static DEFINE_PER_CPU(unsigned char, tempkstack[2048]) = {0};
 
-static void segment_init(void)
+static void segment_init(struct segdesc *gdt)
 {
-	lgdt(gdt, sizeof(gdt));
+	lgdt(gdt, sizeof(struct segdesc) * NR_SEGMENTS);
 	uint16_t reg;
 	asm volatile (
 		"	movw	%2, %0;"
 		"	movw	%0, %%ds;"
 		"	movw	%0, %%es;"
-		"	movw	%0, %%fs;"
 		"	movw	%0, %%gs;"
 		"	movw	%0, %%ss;"
+		"	movw	%3, %0;"
+		"	movw	%0, %%fs;"
 		"	ljmp	%1, $1f;"
 		"1:"
 		: "=r"(reg)
-		: "i"(KERNEL_CS), "i"(KERNEL_DS)
+		: "i"(KERNEL_CS), "i"(KERNEL_DS), "i"(KERNEL_CPU)
 	);
 }
 
-static void taskstate_init(void)
+static void taskstate_init(struct segdesc *gdt, struct taskstate *ts,
+    unsigned char *kstack)
 {
-	ts.ts_esp0 = tempkstack;
-	ts.ts_ss0 = KERNEL_DS;
+	ts->ts_esp0 = kstack;
+	ts->ts_ss0 = KERNEL_DS;
 
-	gdt[SEG_TSS] = SEG16(STS_T32A, (uint32_t)&ts, sizeof(ts), DPL_KERNEL);
+	/* also drops the busy bit the copy got from the boot CPU */
+	gdt[SEG_TSS] = SEG16(STS_T32A, (uint32_t)ts, sizeof(*ts), DPL_KERNEL);
 	gdt[SEG_TSS].s = 0;
 }
 
@@ -139,10 +152,31 @@ static void taskstate_load(void)
 	ltr(SEG_TSS << 3);
 }
 
+void arch_percpu_load(unsigned long offset)
+{
+	struct segdesc *mygdt = (struct segdesc *)((char *)gdt + offset);
+	uint16_t reg;
+
+	mygdt[SEG_KCPU] = SEG(STA_W, offset, 0xffffffff, DPL_KERNEL);
+	/* the new base is only picked up when the selector is loaded */
+	asm volatile (
+		"	movw	%1, %0;"
+		"	movw	%0, %%fs;"
+		: "=r"(reg)
+		: "i"(KERNEL_CPU)
+		: "memory"
+	);
+}
+
 void arch_init(void)
 {
-	taskstate_init();
-	segment_init();
+	int cpu = cpuid();
+	struct segdesc *mygdt = per_cpu_ptr(&gdt[0], cpu);
+
+	taskstate_init(mygdt, per_cpu_ptr(&ts, cpu),
+	    per_cpu_ptr(&tempkstack[0], cpu));
+	segment_init(mygdt);
 	taskstate_load();
+	lapic_init();
 }
 
@@ -0,0 +1,145 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+/* from kernel */
+#include <sys/types.h>
+#include <asm.h>
+#include <errno.h>
+#include <io.h>
+#include <lapic.h>
+#include <mm.h>
+#include <mmu.h>
+#include <panic.h>
+#include <util.h>
+
+/*
+ * Local APIC of each CPU.  All of them sit at the same physical address,
+ * each CPU seeing its own, so one mapping serves everybody.
+ */
+
+size_t lapic_base;
+static size_t __lapic_mapped_base;
+
+/* CMOS shutdown code and the warm reset vector, for the BIOS */
+#define CMOS_PORT		0x70
+#define CMOS_SHUTDOWN		0x0F
+#define CMOS_SHUTDOWN_JMP	0x0A
+#define WARM_RESET_VECTOR	0x467
+
+/* each write to the POST port takes about a microsecond */
+static void __udelay(int us)
+{
+	for (; us > 0; --us)
+		outb(0x80, 0);
+}
+
+static inline void __lapic_write(uint32_t offset, uint32_t val)
+{
+	write32(lapic_base + offset, val);
+	/* wait for the write to finish, by reading */
+	read32(lapic_base + LAPIC_OFFSET_ID);
+}
+
+static void __mmu_handler(void)
+{
+	lapic_base = __lapic_mapped_base;
+}
+
+/*
+ * lapic_early_init()
+ * Map the local APIC.  Early mappings come in extended pages, so we map
+ * the one it sits in.
+ */
+void lapic_early_init(void)
+{
+	size_t base = ALIGN_BELOW(LAPIC_PHYSBASE, XPAGE_SIZE);
+	size_t mapped;
+
+	mapped = early_mapping_add_kmmap(base, XPAGE_SIZE);
+	if (mapped == 0)
+		panic("Cannot map local APIC.\n");
+	__lapic_mapped_base = mapped + LAPIC_PHYSBASE - base;
+	if (mmu_handlers_add(__mmu_handler) != 0)
+		panic("Cannot register local APIC MMU handler.\n");
+}
+
+/*
+ * lapic_init()
+ * Turn on the local APIC of this CPU, accepting all interrupts.
+ */
+void lapic_init(void)
+{
+	__lapic_write(LAPIC_OFFSET_SVR, LAPIC_SVR_ENABLE | LAPIC_SVR_SPURIOUS);
+	__lapic_write(LAPIC_OFFSET_TPR, 0);
+	__lapic_write(LAPIC_OFFSET_EOI, 0);
+}
+
+void lapic_eoi(void)
+{
+	write32(lapic_base + LAPIC_OFFSET_EOI, 0);
+}
+
+void lapic_send_ipi(int apicid, int vector)
+{
+	/* the ICR is not ours again until the last one went out */
+	while (read32(lapic_base + LAPIC_OFFSET_ICRLO) & LAPIC_ICR_BUSY)
+		/* nothing */;
+	__lapic_write(LAPIC_OFFSET_ICRHI, apicid << LAPIC_ICR_DEST_SHIFT);
+	__lapic_write(LAPIC_OFFSET_ICRLO, LAPIC_ICR_FIXED | vector);
+}
+
+/*
+ * lapic_start_cpu()
+ * The universal startup algorithm of the MultiProcessor Specification:
+ * an INIT, then two STARTUPs with the page number of @entry, which must
+ * be a page aligned real mode address.
+ */
+int lapic_start_cpu(int apicid, uint32_t entry)
+{
+	uint16_t *warm_reset = (uint16_t *)pa2kva(WARM_RESET_VECTOR);
+	int i;
+
+	if (!IS_ALIGNED(entry, PAGE_SIZE) || entry >= 0x100000)
+		return -EINVAL;
+
+	/* older CPUs come back through the BIOS after INIT */
+	outb(CMOS_PORT, CMOS_SHUTDOWN);
+	outb(CMOS_PORT + 1, CMOS_SHUTDOWN_JMP);
+	warm_reset[0] = 0;
+	warm_reset[1] = entry >> 4;
+
+	__lapic_write(LAPIC_OFFSET_ICRHI, apicid << LAPIC_ICR_DEST_SHIFT);
+	__lapic_write(LAPIC_OFFSET_ICRLO,
+	    LAPIC_ICR_INIT | LAPIC_ICR_LEVEL | LAPIC_ICR_ASSERT);
+	__udelay(200);
+	__lapic_write(LAPIC_OFFSET_ICRLO, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL);
+	__udelay(100);
+
+	for (i = 0; i < 2; ++i) {
+		__lapic_write(LAPIC_OFFSET_ICRHI,
+		    apicid << LAPIC_ICR_DEST_SHIFT);
+		__lapic_write(LAPIC_OFFSET_ICRLO,
+		    LAPIC_ICR_STARTUP | (entry >> PAGE_SHIFT));
+		__udelay(200);
+	}
+	return 0;
+}
@@ -91,6 +91,30 @@ int mmu_init(pgindex_t *index)
 	return 0;
 }
 
+/* No ASIDs here, loading CR3 drops all non-global TLB entries */
+void arch_switch_mm(struct mm *mm)
+{
+	asm volatile (
+		"movl	%[index], %%cr3"
+		: /* no output */
+		: [index]	"r" (kva2pa(mm->pgindex))
+		: "memory"
+	);
+}
+
+/* DMA snoops the caches on PC */
+void dcache_clean_range(void *vaddr, size_t size)
+{
+}
+
+void dcache_inval_range(void *vaddr, size_t size)
+{
+}
+
+void dcache_flush_range(void *vaddr, size_t size)
+{
+}
+
 /* initialize free page block from at least @start to at most @end */
 static void __init_free_pages(addr_t start, addr_t end)
 {
@@ -17,6 +17,7 @@
  */
 
 #include <mm.h>
+#include <ipi.h>
 #include <pmm.h>
 #include <vmm.h>
 #include <mmu.h>
@@ -36,6 +37,9 @@ struct pagedesc {
 /*
  * Get a page index descriptor (PDE, PTE in our case) for the page table,
  * possibly creating leaf page tables if needed.
+ *
+ * 4MB large pages have no leaf page table; -EEXIST is returned for them
+ * and callers should either fail or split the large page first.
  */
 static int 
 __getpagedesc(pgindex_t *pgindex,
@@ -47,7 +51,9 @@ __getpagedesc(pgindex_t *pgindex,
 	pde_t *pde = (pde_t *)pgindex;
 	pd->pdep = pde;
 	pd->pdx = PDX(addr);
-	if (pde[pd->pdx] & PTE_P) {
+	if (pde[pd->pdx] & PTE_S) {
+		return -EEXIST;
+	} else if (pde[pd->pdx] & PTE_P) {
 		/* We already have the intermediate directory */
 		pd->ptep = (pte_t *)pa2kva(PTE_PADDR(pde[pd->pdx]));
 	} else {
@@ -65,6 +71,52 @@ __getpagedesc(pgindex_t *pgindex,
 	return 0;
 }
 
+/*
+ * Number of leaf page table entries starting from @vcur, up to either
+ * @vend or the end of the leaf page table containing @vcur, whichever
+ * comes first.
+ */
+static inline int
+__ptrun(void *vcur, void *vend)
+{
+	size_t left = (vend - vcur) >> PAGE_SHIFT;
+	size_t room = NR_PTENTRIES - PTX(vcur);
+	return (int)min2(left, room);
+}
+
+static inline bool
+__is_xpage(pde_t pde)
+{
+	return (pde & (PTE_P | PTE_S)) == (PTE_P | PTE_S);
+}
+
+static inline void
+__tlb_invalidate(void *vaddr)
+{
+	asm volatile ("invlpg	(%0)" : : "r"(vaddr) : "memory");
+}
+
+/*
+ * Split the 4MB large page at page directory index @pdx into a leaf page
+ * table with 1024 4KB entries carrying the same translation and flags,
+ * so that part of it can be unmapped or have its permissions changed.
+ */
+static int
+__split_xpage(pde_t *pde, int pdx)
+{
+	addr_t paddr, base = ALIGN_BELOW(pde[pdx], XPAGE_SIZE);
+	uint32_t flags = PTE_FLAGS(pde[pdx]) & ~PTE_S;
+	pte_t *pte;
+
+	if ((paddr = pgalloc()) == -1)
+		return -ENOMEM;
+	pte = (pte_t *)pa2kva(paddr);
+	for (int i = 0; i < NR_PTENTRIES; ++i)
+		pte[i] = mkpte(base + i * PAGE_SIZE, flags);
+	pde[pdx] = mkpde(paddr, PTE_P | PTE_R | PTE_U);
+	return 0;
+}
+
 /*
  * This function assumes that:
  * 1. (Leaf) page table entries for vaddr..vaddr+size are already zero.
@@ -74,30 +126,97 @@ static void
 __free_intermediate_pgtable(pgindex_t *pgindex, void *vaddr, size_t size)
 {
 	pde_t *pde = (pde_t *)pgindex;
-	int pdx = PDX(vaddr), pdx_end = PDX(vaddr + size - PAGE_SIZE);
+	int pdx, pdx_end;
+
+	if (size == 0)
+		return;
+
+	pdx = PDX(vaddr);
+	pdx_end = PDX(vaddr + size - PAGE_SIZE);
 	for (; pdx <= pdx_end; ++pdx) {
+		/* kernel page tables are shared, see init_pgindex() */
+		if (pdx >= PDX(KERN_BASE))
+			break;
+		if (!(pde[pdx] & PTE_P) || (pde[pdx] & PTE_S))
+			continue;
 		pte_t *pte = (pte_t *)pa2kva(PTE_PADDR(pde[pdx]));
 		for (int i = 0; i < NR_PTENTRIES; ++i) {
 			if (pte[i] & PTE_P)
 				goto rollback_next_pde;
 		}
-		pgfree(kva2pa(PTE_PADDR(pde[pdx])));
-		pde[pdx] &= ~PTE_P;
+		pgfree(PTE_PADDR(pde[pdx]));
+		pde[pdx] = 0;
 rollback_next_pde:
 		/* nothing */;
 	}
 }
 
+/*
+ * Clear leaf page table entries for vaddr..vaddr+size, one leaf page
+ * table at a time.  Missing leaf page tables are skipped.
+ * Large pages are dropped as a whole; this is only used to rollback
+ * map_pages(), which never creates a large page crossing the range.
+ */
+static void
+__clear_range(pgindex_t *pgindex, void *vaddr, size_t size)
+{
+	struct pagedesc pd;
+	pde_t *pde = (pde_t *)pgindex;
+	void *vcur, *vend = vaddr + size;
+	int n;
+
+	for (vcur = vaddr; vcur < vend; vcur += n * PAGE_SIZE) {
+		n = __ptrun(vcur, vend);
+		if (__is_xpage(pde[PDX(vcur)])) {
+			pde[PDX(vcur)] = 0;
+			continue;
+		}
+		if (__getpagedesc(pgindex, vcur, false, &pd) < 0)
+			continue;
+		memset(&pd.ptep[pd.ptx], 0, n * sizeof(pte_t));
+	}
+}
+
+/*
+ * The kernel part of the page directory is copied from kern_pgindex(), so
+ * that both point to the same leaf page tables.  These are never freed,
+ * and share_kern_pgtables() creates the ones for later kernel mappings
+ * beforehand.
+ */
 pgindex_t *
 init_pgindex(void)
 {
+	pde_t *pde, *kern = (pde_t *)kern_pgindex();
 	addr_t paddr = pgalloc();
 	if (paddr == -1)
 		return NULL;
 
-	memset(pa2kva(paddr), 0, PAGE_SIZE);
+	pde = pa2kva(paddr);
+	memset(pde, 0, PDX(KERN_BASE) * sizeof(pde_t));
+	memcpy(&pde[PDX(KERN_BASE)], &kern[PDX(KERN_BASE)],
+	    (NR_PTENTRIES - PDX(KERN_BASE)) * sizeof(pde_t));
+
+	return pde;
+}
+
+int
+share_kern_pgtables(void *vaddr, size_t size)
+{
+	struct pagedesc pd;
+	int pdx, pdx_end, retcode;
+
+	if (size == 0)
+		return 0;
 
-	return pa2kva(paddr);
+	pdx_end = PDX(vaddr + size - PAGE_SIZE);
+	for (pdx = PDX(vaddr); pdx <= pdx_end; ++pdx) {
+		retcode = __getpagedesc(kern_pgindex(),
+		    (void *)((size_t)pdx << PDX_SHIFT), true, &pd);
+		/* large pages need no table */
+		if (retcode < 0 && retcode != -EEXIST)
+			return retcode;
+	}
+	return 0;
 }
 
 void
@@ -134,10 +253,12 @@ map_pages(pgindex_t *pgindex,
 	  uint32_t flags)
 {
 	struct pagedesc pd;
-	int retcode;
-	addr_t pend = paddr + size;
+	int retcode, i, n;
+	pde_t *pde = (pde_t *)pgindex;
+	pte_t *pte;
+	uint32_t perm = __pgtable_perm(flags);
 	addr_t pcur = paddr;
-	void *vcur = vaddr;
+	void *vcur = vaddr, *vend = vaddr + size;
 
 	if (!IS_ALIGNED(paddr, PAGE_SIZE) ||
 	    !IS_ALIGNED(size, PAGE_SIZE) ||
@@ -145,71 +266,204 @@ map_pages(pgindex_t *pgindex,
 		return -EINVAL;
 
 	/*
-	 * 1st pass: allocate leaf page tables if needed, and validate
-	 * if there are any conflicts or memory shortage, in either case
-	 * we need to rollback.
+	 * Walk the range one leaf page table at a time, so that the page
+	 * directory is indexed once per 4MB instead of once per page.
+	 * Inside each leaf page table, we first validate the whole run of
+	 * entries (allocating the table if needed), then fill them in a
+	 * tight loop.  If there are any conflicts or memory shortage, we
+	 * clear what we have filled so far and rollback.
+	 *
+	 * With MAP_LARGE, every 4MB-aligned 4MB chunk whose page directory
+	 * entry is still free becomes a single large page (PSE is enabled
+	 * in mmu_init()).
 	 */
-	for (; pcur < pend; pcur += PAGE_SIZE, vcur += PAGE_SIZE) {
+	for (; vcur < vend; vcur += n * PAGE_SIZE, pcur += n * PAGE_SIZE) {
+		n = __ptrun(vcur, vend);
+		if ((flags & MAP_LARGE) &&
+		    n == NR_PTENTRIES &&
+		    IS_ALIGNED(pcur, XPAGE_SIZE) &&
+		    !(pde[PDX(vcur)] & PTE_P)) {
+			pde[PDX(vcur)] = mkxpte(pcur, perm | PTE_S);
+			continue;
+		}
+
 		retcode = __getpagedesc(pgindex, vcur, true, &pd);
-		if (retcode == -ENOMEM)
+		if (retcode < 0)
 			goto rollback;
 
-		if (pd.ptep[pd.ptx] & PTE_P) {
-			/* we are mapping on the exact same virtual
-			 * page which is either valid or invalid (paged
-			 * out), fail */
-			retcode = -EEXIST;
-			goto rollback;
+		pte = &pd.ptep[pd.ptx];
+		for (i = 0; i < n; ++i) {
+			if (pte[i] & PTE_P) {
+				/* we are mapping on the exact same virtual
+				 * page which is either valid or invalid
+				 * (paged out), fail */
+				retcode = -EEXIST;
+				goto rollback;
+			}
 		}
-	}
-
-	/* 2nd pass: fill the entries as there shouldn't be any failure */
-	pcur = paddr;
-	vcur = vaddr;
-	for (; pcur < pend; pcur += PAGE_SIZE, vcur += PAGE_SIZE) {
-		__getpagedesc(pgindex, vcur, false, &pd);
-		pd.ptep[pd.ptx] = pcur | __pgtable_perm(flags);
+		for (i = 0; i < n; ++i)
+			pte[i] = mkpte(pcur + i * PAGE_SIZE, perm);
 	}
 
 	return 0;
 
 rollback:
+	__clear_range(pgindex, vaddr, vcur - vaddr);
 	__free_intermediate_pgtable(pgindex, vaddr, vcur - vaddr);
 	return retcode;
 }
 
-ssize_t
-unmap_pages(pgindex_t *pgindex,
-	    void *vaddr,
-	    size_t size,
-	    addr_t *paddr)
+static ssize_t
+__unmap_pages(pgindex_t *pgindex,
+	      void *vaddr,
+	      size_t size,
+	      addr_t *paddr,
+	      bool flush)
 {
 	void *vcur = vaddr, *vend = vaddr + size;
 	ssize_t unmapped_bytes = 0;
-	struct pagedesc pd = {0};	/* suppresses warning */
+	struct pagedesc pd;
+	pde_t *pde = (pde_t *)pgindex;
+	pte_t *pte;
 	addr_t pcur = 0;
+	int i, n;
 
-	for (; vcur < vend; vcur += PAGE_SIZE,
-			    unmapped_bytes += PAGE_SIZE,
-			    pcur += PAGE_SIZE) {
+	for (; vcur < vend; vcur += n * PAGE_SIZE) {
+		n = __ptrun(vcur, vend);
+		if (__is_xpage(pde[PDX(vcur)])) {
+			if (unmapped_bytes == 0) {
+				pcur = ALIGN_BELOW(pde[PDX(vcur)],
+				    XPAGE_SIZE) + PTX(vcur) * PAGE_SIZE;
+				if (paddr != NULL)
+					*paddr = pcur;
+			}
+			if (n == NR_PTENTRIES &&
+			    ALIGN_BELOW(pde[PDX(vcur)], XPAGE_SIZE) == pcur) {
+				/* the whole large page goes away */
+				pde[PDX(vcur)] = 0;
+				if (flush)
+					__tlb_invalidate(vcur);
+				unmapped_bytes += XPAGE_SIZE;
+				pcur += XPAGE_SIZE;
+				continue;
+			}
+			/* partial unmap: fall back to 4KB pages */
+			if (__split_xpage(pde, PDX(vcur)) < 0)
+				panic("unmap_pages cannot split: %p %p\n",
+				    pgindex, vcur);
+		}
 		if (__getpagedesc(pgindex, vcur, false, &pd) < 0)
 			/* may return -ENOENT? */
 			panic("unmap_pages non-existent: %p %p\n",
 			    pgindex, vcur);
+		pte = &pd.ptep[pd.ptx];
 		if (unmapped_bytes == 0) {
 			/* unmapping the first page: store the physical
 			 * address */
-			pcur = PTE_PADDR(pd.ptep[pd.ptx]);
+			pcur = PTE_PADDR(pte[0]);
 			if (paddr != NULL)
 				*paddr = pcur;
-		} else if (pd.ptep[pd.ptx] != pcur) {
-			break;
 		}
-		pd.ptep[pd.ptx] = 0;
+		/* stop at the first physically discontiguous page */
+		for (i = 0; i < n; ++i, pcur += PAGE_SIZE) {
+			if (PTE_PADDR(pte[i]) != pcur)
+				break;
+			pte[i] = 0;
+			if (flush)
+				__tlb_invalidate(vcur + i * PAGE_SIZE);
+		}
+		unmapped_bytes += i * PAGE_SIZE;
+		if (i < n)
+			break;
 	}
 
-	__free_intermediate_pgtable(pgindex, vaddr, unmapped_bytes);
+	if (flush)
+		__free_intermediate_pgtable(pgindex, vaddr, unmapped_bytes);
 
 	return unmapped_bytes;
 }
 
+ssize_t
+unmap_pages(pgindex_t *pgindex,
+	    void *vaddr,
+	    size_t size,
+	    addr_t *paddr)
+{
+	return __unmap_pages(pgindex, vaddr, size, paddr, true);
+}
+
+ssize_t
+unmap_pages_noflush(pgindex_t *pgindex,
+		    void *vaddr,
+		    size_t size,
+		    addr_t *paddr)
+{
+	return __unmap_pages(pgindex, vaddr, size, paddr, false);
+}
+
+void
+free_empty_pgtables(pgindex_t *pgindex, void *vaddr, size_t size)
+{
+	__free_intermediate_pgtable(pgindex, vaddr, size);
+}
+
+static void
+__tlb_flush(void *arg)
+{
+	/* we map no global pages, so reloading CR3 drops everything */
+	asm volatile (
+		"movl	%%cr3, %%eax;"
+		"movl	%%eax, %%cr3"
+		::: "eax", "memory"
+	);
+}
+
+void
+tlb_flush_all(void)
+{
+	on_each_cpu(__tlb_flush, NULL, true);
+}
+
+int
+protect_pages(pgindex_t *pgindex,
+	      void *vaddr,
+	      size_t size,
+	      uint32_t flags)
+{
+	void *vcur = vaddr, *vend = vaddr + size;
+	struct pagedesc pd;
+	pde_t *pde = (pde_t *)pgindex;
+	pte_t *pte;
+	uint32_t perm = __pgtable_perm(flags);
+	int i, n, retcode;
+
+	if (!IS_ALIGNED(size, PAGE_SIZE) ||
+	    !PTR_IS_ALIGNED(vaddr, PAGE_SIZE))
+		return -EINVAL;
+
+	for (; vcur < vend; vcur += n * PAGE_SIZE) {
+		n = __ptrun(vcur, vend);
+		if (__is_xpage(pde[PDX(vcur)])) {
+			if (n == NR_PTENTRIES) {
+				pde[PDX(vcur)] = mkxpte(pde[PDX(vcur)],
+				    perm | PTE_S);
+				__tlb_invalidate(vcur);
+				continue;
+			}
+			/* changing part of a large page: split it */
+			if ((retcode = __split_xpage(pde, PDX(vcur))) < 0)
+				return retcode;
+		}
+		if (__getpagedesc(pgindex, vcur, false, &pd) < 0)
+			continue;
+		pte = &pd.ptep[pd.ptx];
+		for (i = 0; i < n; ++i) {
+			if (!(pte[i] & PTE_P))
+				continue;
+			pte[i] = mkpte(pte[i], perm);
+			__tlb_invalidate(vcur + i * PAGE_SIZE);
+		}
+	}
+
+	return 0;
+}
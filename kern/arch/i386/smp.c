@@ -0,0 +1,195 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+/* from kernel */
+#include <sys/types.h>
+#include <errno.h>
+#include <init.h>
+#include <ipi.h>
+#include <lapic.h>
+#include <memlayout.h>
+#include <mm.h>
+#include <mmu.h>
+#include <arch-trap.h>
+#include <libc/string.h>
+
+/*
+ * MultiProcessor Specification tables.  The BIOS leaves a floating pointer
+ * structure in low memory, pointing to a configuration table which lists
+ * the processors among other things.
+ */
+struct mp_fptr {
+	char		signature[4];	/* "_MP_" */
+	uint32_t	physaddr;	/* of struct mp_conf */
+	uint8_t		length;		/* in 16 bytes */
+	uint8_t		specrev;
+	uint8_t		checksum;
+	uint8_t		type;
+	uint8_t		imcrp;
+	uint8_t		reserved[3];
+};
+
+struct mp_conf {
+	char		signature[4];	/* "PCMP" */
+	uint16_t	length;		/* including the entries */
+	uint8_t		version;
+	uint8_t		checksum;
+	char		product[20];
+	uint32_t	oemtable;
+	uint16_t	oemlength;
+	uint16_t	entry;		/* number of entries */
+	uint32_t	lapicaddr;
+	uint16_t	xlength;
+	uint8_t		xchecksum;
+	uint8_t		reserved;
+};
+
+struct mp_proc {
+	uint8_t		type;
+#define MP_PROC		0	/* the other entry types are 8 bytes long */
+	uint8_t		apicid;
+	uint8_t		version;
+	uint8_t		flags;
+#define MP_PROC_EN	0x01
+	uint8_t		signature[4];
+	uint32_t	feature;
+	uint8_t		reserved[8];
+};
+
+#define MP_ENTRY_SIZE	8
+
+/* BIOS data area words locating the EBDA and the end of base memory */
+#define BDA_EBDA_SEG	0x40E
+#define BDA_BASE_KB	0x413
+
+/* APIC IDs of the CPUs the BIOS found usable */
+static cpumask_t __cpu_present;
+static bool __mp_probed;
+
+static uint8_t __mp_sum(void *addr, size_t len)
+{
+	uint8_t *p = addr, sum = 0;
+
+	for (; len > 0; --len)
+		sum += *p++;
+	return sum;
+}
+
+static struct mp_fptr *__mp_search(size_t pa, size_t len)
+{
+	uint8_t *p = pa2kva(pa), *end = p + len;
+
+	for (; p < end; p += sizeof(struct mp_fptr)) {
+		if (memcmp(p, "_MP_", 4) == 0 &&
+		    __mp_sum(p, sizeof(struct mp_fptr)) == 0)
+			return (struct mp_fptr *)p;
+	}
+	return NULL;
+}
+
+/*
+ * The floating pointer lies in the first KB of the EBDA, in the last KB
+ * of base memory if there is no EBDA, or in the BIOS ROM.
+ */
+static struct mp_fptr *__mp_find(void)
+{
+	size_t pa = *(uint16_t *)pa2kva(BDA_EBDA_SEG) << 4;
+	struct mp_fptr *fptr;
+
+	if (pa == 0)
+		pa = (*(uint16_t *)pa2kva(BDA_BASE_KB) - 1) * 1024;
+	if ((fptr = __mp_search(pa, 1024)) != NULL)
+		return fptr;
+	return __mp_search(0xF0000, 0x10000);
+}
+
+/*
+ * Mark the usable processors listed in the MP configuration table.
+ * Returns false if there is no (sane) table.
+ */
+static bool __mp_probe(void)
+{
+	struct mp_fptr *fptr;
+	struct mp_conf *conf;
+	struct mp_proc *proc;
+	uint8_t *p, *end;
+
+	if ((fptr = __mp_find()) == NULL || fptr->physaddr == 0)
+		return false;
+	/* anything past the BIOS area is not mapped for us */
+	if (fptr->physaddr + sizeof(*conf) > 0x100000)
+		return false;
+	conf = pa2kva(fptr->physaddr);
+	if (memcmp(conf->signature, "PCMP", 4) != 0 ||
+	    fptr->physaddr + conf->length > 0x100000 ||
+	    __mp_sum(conf, conf->length) != 0)
+		return false;
+
+	p = (uint8_t *)(conf + 1);
+	end = (uint8_t *)conf + conf->length;
+	while (p < end) {
+		if (*p != MP_PROC) {
+			p += MP_ENTRY_SIZE;
+			continue;
+		}
+		proc = (struct mp_proc *)p;
+		if ((proc->flags & MP_PROC_EN) && proc->apicid < NR_CPUS)
+			cpumask_set_cpu(proc->apicid, &__cpu_present);
+		p += sizeof(*proc);
+	}
+	return true;
+}
+
+/*
+ * CPUs are started through their local APICs, at the real mode trampoline
+ * in smpboot.S.  CPU numbers are APIC IDs, which the MP table tells us are
+ * there.  Without a table we take NR_CPUS for granted.
+ */
+int arch_start_cpu(int cpu)
+{
+	extern char smpboot_start[], smpboot_end[];
+	int i;
+
+	/* the master starts the slaves one at a time */
+	if (!__mp_probed) {
+		if (!__mp_probe()) {
+			for (i = 0; i < NR_CPUS; ++i)
+				cpumask_set_cpu(i, &__cpu_present);
+		}
+		__mp_probed = true;
+	}
+	if (cpu >= NR_CPUS || !cpumask_test_cpu(cpu, &__cpu_present))
+		return -ENODEV;
+	memcpy(pa2kva(SMPBOOT_ADDR), smpboot_start,
+	    smpboot_end - smpboot_start);
+	return lapic_start_cpu(cpu, SMPBOOT_ADDR);
+}
+
+/* lapic_init() already lets all interrupts in */
+void arch_ipi_init(void)
+{
+}
+
+void arch_send_ipi(int cpu)
+{
+	lapic_send_ipi(cpu, T_IRQ0 + IRQ_IPI);
+}
@@ -28,14 +28,69 @@ void spinlock_init(lock_t *lock)
 	*lock = UNLOCKED;
 }
 
-void spin_lock(lock_t *lock)
+void arch_spin_lock(lock_t *lock)
 {
-	while (xchg(lock, LOCKED) != 0)
-		/* nothing */;
+	lock_t val = xadd(lock, 1 << LOCK_TICKET_SHIFT);
+	uint16_t ticket = lock_next(val);
+
+	while (lock_owner(val) != ticket) {
+		pause();
+		val = *(volatile lock_t *)lock;
+	}
+	/* x86 does not reorder loads with older loads */
+	asm volatile ("" : : : "memory");
+}
+
+void arch_spin_unlock(lock_t *lock)
+{
+	/* stores are not reordered with older stores either */
+	asm volatile ("" : : : "memory");
+	lock_owner_half(lock) = lock_owner(*lock) + 1;
+}
+
+
+void rwlock_init(rwlock_t *lock)
+{
+	*lock = RW_UNLOCKED;
+}
+
+void read_lock(rwlock_t *lock)
+{
+	rwlock_t val;
+
+	for (;;) {
+		val = *(volatile rwlock_t *)lock;
+		if (!(val & RW_WRITER) && cmpxchg(lock, val, val + 1) == val)
+			break;
+		pause();
+	}
 }
 
-void spin_unlock(lock_t *lock)
+void read_unlock(rwlock_t *lock)
 {
-	xchg(lock, UNLOCKED);
+	xadd(lock, -1);
 }
 
+void write_lock(rwlock_t *lock)
+{
+	rwlock_t val;
+
+	/* keep new readers out, then wait for those inside */
+	for (;;) {
+		val = *(volatile rwlock_t *)lock;
+		if (!(val & RW_WRITER) &&
+		    cmpxchg(lock, val, val | RW_WRITER) == val)
+			break;
+		pause();
+	}
+	while (*(volatile rwlock_t *)lock & RW_READERS)
+		pause();
+	asm volatile ("" : : : "memory");
+}
+
+void write_unlock(rwlock_t *lock)
+{
+	/* no reader can get in while we are here */
+	asm volatile ("" : : : "memory");
+	*(volatile rwlock_t *)lock = RW_UNLOCKED;
+}
@@ -26,7 +26,10 @@
 #include <asm.h>
 #include <regs.h>
 #include <console.h>
+#include <mm.h>
 #include <panic.h>
+#include <ipi.h>
+#include <lapic.h>
 
 #define MAX_IDT_ENTRIES	256
 
@@ -84,8 +87,22 @@ void trap_init(void)
 	lidt(idt, sizeof(idt));
 }
 
+/* Page fault error code bits */
+#define PGFLT_WRITE	0x2
+
 void trap_handler(struct trapframe *tf)
 {
+	if (tf->trapno == T_IRQ0 + IRQ_IPI) {
+		lapic_eoi();
+		ipi_handler();
+		return;
+	}
+
+	if (tf->trapno == T_PGFLT &&
+	    handle_page_fault(current_mm(), (void *)rcr2(),
+	    (tf->err & PGFLT_WRITE) ? VMA_WRITE : VMA_READ) == 0)
+		return;
+
 	kprintf("Caught exception %d (%s)\n", tf->trapno,
 	    tf->trapno <= T_MSG_MAX ? trapmsg[tf->trapno] : "");
 	panic("Dying...\n");
@@ -22,6 +22,8 @@
 
 #include <init.h>
 #include <console.h>
+#include <percpu.h>
+#include <tlb.h>
 #include <drivers/io/io-mem.h>
 
 unsigned long kernelsp[NR_CPUS];
@@ -44,5 +46,12 @@ void early_arch_init(void)
 
 void arch_init(void)
 {
+	/* also gives percpu_load() our CPU number, see below */
+	tlb_init();
+}
+
+void arch_percpu_load(unsigned long offset)
+{
+	/* tlb_init() put our CPU number in Context, nothing else to do */
 }
 
@@ -0,0 +1,82 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <arch-sync.h>
+#include <errno.h>
+#include <init.h>
+#include <io.h>
+#include <ipi.h>
+#include <mipsregs.h>
+#include <cp0regdef.h>
+#include <platform.h>
+#include <smp.h>
+
+#define __mailbox(cpu, n) \
+	(LOONGSON3A_COREx_IPI_BASE(cpu) + LOONGSON3A_IPI_OFFSET_MAILBOX(n))
+#define __ipi_reg(cpu, offset) \
+	(LOONGSON3A_COREx_IPI_BASE(cpu) + LOONGSON3A_IPI_OFFSET_##offset)
+
+/*
+ * PMON parks the other cores polling their mailboxes, see platform.h.
+ * slave_entry sets up sp and gp on its own, but we follow the protocol
+ * anyway.  The entry goes last, as it is what the core is waiting for.
+ */
+int arch_start_cpu(int cpu)
+{
+	extern uint32_t slave_entry;
+	extern uint32_t _gp;
+	extern void *slave_early_stack;
+
+	if (cpu >= LOONGSON3A_CORES)
+		return -ENODEV;
+	write64(__mailbox(cpu, LOONGSON3A_MAILBOX_A1), cpu);
+	write64(__mailbox(cpu, LOONGSON3A_MAILBOX_GP), (unsigned long)&_gp);
+	write64(__mailbox(cpu, LOONGSON3A_MAILBOX_SP),
+	    (unsigned long)slave_early_stack);
+	smp_mb();
+	write64(__mailbox(cpu, LOONGSON3A_MAILBOX_PC),
+	    (unsigned long)&slave_entry);
+	return 0;
+}
+
+void arch_ipi_init(void)
+{
+	write32(__ipi_reg(cpuid(), ENABLE), LOONGSON3A_IPI_CALL);
+	write_c0_status(read_c0_status() | ST_IMx(LOONGSON3A_IPI_IRQ));
+}
+
+void arch_send_ipi(int cpu)
+{
+	write32(__ipi_reg(cpu, SET), LOONGSON3A_IPI_CALL);
+}
+
+bool mach_ipi_ack(void)
+{
+	int cpu = cpuid();
+	uint32_t status = read32(__ipi_reg(cpu, STATUS));
+
+	if (status == 0)
+		return false;
+	write32(__ipi_reg(cpu, CLEAR), status);
+	return true;
+}
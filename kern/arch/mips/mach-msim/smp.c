@@ -0,0 +1,67 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <errno.h>
+#include <init.h>
+#include <io.h>
+#include <ipi.h>
+#include <mipsregs.h>
+#include <cp0regdef.h>
+#include <smp.h>
+
+/*
+ * Slaves are spinning on their mailboxes in firmware (see slave_hangup),
+ * and jump to whatever address shows up there.  msim.conf has exactly
+ * NR_CPUS processors.
+ */
+int arch_start_cpu(int cpu)
+{
+	extern uint32_t slave_entry;
+
+	if (cpu >= NR_CPUS)
+		return -ENODEV;
+#ifdef __LP64__
+	write64(msim_mailbox(cpu), (unsigned long)&slave_entry);
+#else
+	write32(msim_mailbox(cpu), (unsigned long)&slave_entry);
+#endif
+	return 0;
+}
+
+void arch_ipi_init(void)
+{
+	write_c0_status(read_c0_status() | ST_IMx(MSIM_ORDER_IRQ));
+}
+
+void arch_send_ipi(int cpu)
+{
+	write32(MSIM_ORDER_PHYSADDR + MSIM_ORDER_REG_CPUID, 1 << cpu);
+}
+
+bool mach_ipi_ack(void)
+{
+	if (!(read_c0_cause() & CR_IPx(MSIM_ORDER_IRQ)))
+		return false;
+	write32(MSIM_ORDER_PHYSADDR + MSIM_ORDER_REG_IPI, 1 << cpuid());
+	return true;
+}
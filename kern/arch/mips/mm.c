@@ -20,10 +20,13 @@
 #include <config.h>
 #endif
 
+#include <mm.h>
 #include <mmu.h>
 #include <sys/types.h>
 #include <tlb.h>
+#include <smp.h>
 #include <mipsregs.h>
+#include <panic.h>
 
 void page_index_clear(pgindex_t * index)
 {
@@ -67,18 +70,117 @@ void add_memory_pages(void)
 
 void tlb_flush(void)
 {
+	unsigned long entryhi = read_c0_entryhi();
 	int nr_entries = get_tlb_entries();
 	for (int i = 0; i < nr_entries; ++i) {
 		write_c0_index(i);
 		write_c0_entryhi(ENTRYHI_DUMMY(i));
 		write_c0_entrylo0(0);
 		write_c0_entrylo1(0);
+		tlb_hazard();
 		tlbwi();
 	}
+	write_c0_entryhi(entryhi);
 }
 
-void arch_mm_init(void)
+void tlb_init(void)
 {
+	/* The refill handler finds its per-CPU page index slot from here */
+#ifndef __LP64__
+	write_c0_context((unsigned long)cpuid() << CONTEXT_CPUID_SHIFT);
+#else
+	unsigned long entryhi = read_c0_entryhi(), vpn2;
+
+	/* unimplemented VPN2 bits read back as zeros */
+	write_c0_entryhi(ENTRYHI_VPN2(~0UL >> 2));
+	vpn2 = read_c0_entryhi() >> (PAGE_SHIFT + 1);
+	write_c0_entryhi(entryhi);
+	if (vpn2 != (1UL << (MIPS_SEGBITS - PAGE_SHIFT - 1)) - 1)
+		panic("CPU %d does not implement %d address bits\n", cpuid(),
+		    MIPS_SEGBITS);
+	write_c0_xcontext((unsigned long)cpuid() << CONTEXT_CPUID_SHIFT);
+#endif
 	tlb_flush();
 }
 
+void tlb_remove(addr_t vaddr)
+{
+	unsigned long entryhi = read_c0_entryhi();
+	int index;
+
+	/* global entries match regardless of ASID */
+	write_c0_entryhi(ENTRYHI_VPN2(vaddr) | (entryhi & ENTRYHI_ASID_MASK));
+	tlb_hazard();
+	tlbp();
+	tlb_hazard();
+	index = read_c0_index();
+	if (index >= 0) {
+		write_c0_entryhi(ENTRYHI_DUMMY(index));
+		write_c0_entrylo0(0);
+		write_c0_entrylo1(0);
+		tlb_hazard();
+		tlbwi();
+	}
+	write_c0_entryhi(entryhi);
+}
+
+void tlb_write(addr_t vaddr, unsigned long lo0, unsigned long lo1)
+{
+	unsigned long entryhi = read_c0_entryhi();
+	int index;
+
+	write_c0_entryhi(ENTRYHI_VPN2(vaddr) | (entryhi & ENTRYHI_ASID_MASK));
+	tlb_hazard();
+	tlbp();
+	tlb_hazard();
+	index = read_c0_index();
+	write_c0_entrylo0(lo0);
+	write_c0_entrylo1(lo1);
+	tlb_hazard();
+	/* an invalid entry may be there already, duplicates are fatal */
+	if (index >= 0)
+		tlbwi();
+	else
+		tlbwr();
+	write_c0_entryhi(entryhi);
+}
+
+/*
+ * The TLB refill handler finds current page index in a per-CPU slot at
+ * PGDIR_SLOT_BASE.  TLB entries of other address spaces are left alone,
+ * being tagged with their own ASIDs.
+ */
+void arch_switch_mm(struct mm *mm)
+{
+	pgindex_t **pgdir_slot = (pgindex_t **)PGDIR_SLOT_BASE;
+	unsigned long asid;
+	bool flush;
+
+	asid = asid_switch(mm, &flush);
+	pgdir_slot[cpuid()] = mm->pgindex;
+	if (flush)
+		tlb_flush();
+	write_c0_entryhi(asid);
+}
+
+/*
+ * MSIM does not model caches, and Loongson 3A keeps DMA coherent with
+ * its caches in hardware.
+ */
+void dcache_clean_range(void *vaddr, size_t size)
+{
+}
+
+void dcache_inval_range(void *vaddr, size_t size)
+{
+}
+
+void dcache_flush_range(void *vaddr, size_t size)
+{
+}
+
+void arch_mm_init(void)
+{
+	/* tlb_init() is per CPU, in arch_init() */
+}
+
@@ -48,6 +48,7 @@
  */
 
 #include <mm.h>
+#include <ipi.h>
 #include <pmm.h>
 #include <vmm.h>
 #include <mmu.h>
@@ -56,6 +57,8 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <util.h>
+#include <panic.h>
+#include <tlb.h>
 
 #ifndef __LP64__	/* 32 bit */
 
@@ -107,8 +110,16 @@ static void
 __free_intermediate_pgtable(pgindex_t *pgindex, void *vaddr, size_t size)
 {
 	pde_t *pde = (pde_t *)pgindex;
-	int pdx = PDX(vaddr), pdx_end = PDX(vaddr + size - PAGE_SIZE);
+	int pdx, pdx_end;
+
+	if (size == 0)
+		return;
+
+	pdx = PDX(vaddr);
+	pdx_end = PDX(vaddr + size - PAGE_SIZE);
 	for (; pdx <= pdx_end; ++pdx) {
+		if (pde[pdx] == 0)
+			continue;
 		pte_t *pte = (pte_t *)pde[pdx];
 		for (int i = 0; i < NR_PTENTRIES; ++i) {
 			if (pte[i] != 0)
@@ -163,7 +174,7 @@ __del_empty_pgdir(uint64_t *vpgdir, int index)
 {
 	uint64_t *vsubpgdir = (uint64_t *)vpgdir[index];
 	for (int i = 0; i < NR_PTENTRIES; ++i) {
-		if (vsubpgdir[i] == 0)
+		if (vsubpgdir[i] != 0)
 			return 1;
 	}
 	__delpgdir(vpgdir, index);
@@ -196,20 +207,21 @@ __getpagedesc(pgindex_t *pgindex,
 	}
 
 	if (pgd[pd->pgx] == 0 && __addpgdir(pgd, pd->pgx) == NULL)
-		goto nomem;
+		return -ENOMEM;
 	pud = (pud_t *)(pd->pudv = pgd[pd->pgx]);
 	if (pud[pd->pux] == 0 && __addpgdir(pud, pd->pux) == NULL)
-		goto nomem;
+		goto nomem_pud;
 	pmd = (pmd_t *)(pd->pmdv = pud[pd->pux]);
 	if (pmd[pd->pmx] == 0 && __addpgdir(pmd, pd->pmx) == NULL)
-		goto nomem;
+		goto nomem_pmd;
 	pte = (pte_t *)(pd->ptev = pmd[pd->pmx]);
 
 	return 0;
 
-nomem:
-	__del_empty_pgdir(pmd, pd->pmx);
-	__del_empty_pgdir(pud, pd->pux);
+nomem_pmd:
+	if (__del_empty_pgdir(pud, pd->pux))
+		return -ENOMEM;
+nomem_pud:
 	__del_empty_pgdir(pgd, pd->pgx);
 	return -ENOMEM;
 }
@@ -217,27 +229,61 @@ nomem:
 static void
 __free_intermediate_pgtable(pgindex_t *pgindex, void *vaddr, size_t size)
 {
-	/* A very inefficient implementation */
 	pgd_t *pgd = (pgd_t *)pgindex;
 	pud_t *pud;
 	pmd_t *pmd;
-	pte_t *pte;
 	struct pagedesc pd;
+	void *vcur, *vend = vaddr + size;
 
-	for (int sz = 0; sz < size; sz += PAGE_SIZE) {
-		__getpagedesc(pgindex, vaddr + sz, false, &pd);
-		pte = (pte_t *)pd.ptev;
-		pmd = (pmd_t *)pd.pmdv;
-		pud = (pud_t *)pd.pudv;
-		if (__del_empty_pgdir(pmd, pd.pmx) ||
-		    __del_empty_pgdir(pud, pd.pux) ||
-		    __del_empty_pgdir(pgd, pd.pgx))
-			continue;
+	/* Visit each leaf page table once, climbing up while empty */
+	vcur = vaddr;
+	while (vcur < vend) {
+		if (__getpagedesc(pgindex, vcur, false, &pd) == 0) {
+			pmd = (pmd_t *)pd.pmdv;
+			pud = (pud_t *)pd.pudv;
+			if (!__del_empty_pgdir(pmd, pd.pmx) &&
+			    !__del_empty_pgdir(pud, pd.pux))
+				__del_empty_pgdir(pgd, pd.pgx);
+		}
+		vcur = PTR_ALIGN_BELOW(vcur, PAGE_SIZE * NR_PTENTRIES) +
+		    PAGE_SIZE * NR_PTENTRIES;
 	}
 }
 
 #endif	/* !__LP64__ */
 
+/*
+ * Number of leaf page table entries starting from @vcur, up to either
+ * @vend or the end of the leaf page table containing @vcur, whichever
+ * comes first.
+ */
+static inline int
+__ptrun(void *vcur, void *vend)
+{
+	size_t left = (vend - vcur) >> PAGE_SHIFT;
+	size_t room = NR_PTENTRIES - PTX(vcur);
+	return (int)min2(left, room);
+}
+
+/*
+ * Clear leaf page table entries for vaddr..vaddr+size, one leaf page
+ * table at a time.  Missing leaf page tables are skipped.
+ */
+static void
+__clear_range(pgindex_t *pgindex, void *vaddr, size_t size)
+{
+	struct pagedesc pd;
+	void *vcur, *vend = vaddr + size;
+	int n;
+
+	for (vcur = vaddr; vcur < vend; vcur += n * PAGE_SIZE) {
+		n = __ptrun(vcur, vend);
+		if (__getpagedesc(pgindex, vcur, false, &pd) < 0)
+			continue;
+		memset(&((pte_t *)pd.ptev)[pd.ptx], 0, n * sizeof(pte_t));
+	}
+}
+
 pgindex_t *
 init_pgindex(void)
 {
@@ -271,12 +317,38 @@ __pgtable_perm(uint32_t vma_flags)
 	 * I prepended the function with double underscores to indicate
 	 * that this function should not be called elsewhere.
 	 */
-	uint32_t flags = PTE_VALID | PTE_GLOBAL | PTE_CACHEABLE |
+	uint32_t flags = PTE_VALID | PTE_CACHEABLE |
 		((vma_flags & VMA_WRITE) ? PTE_DIRTY : 0) |
 		__mach_pgtable_perm(vma_flags);
+	/* user pages are tagged with the ASID of their address space */
+	if ((vma_flags & MAP_TYPE_MASK) != MAP_USER_MEM)
+		flags |= PTE_GLOBAL;
 	return flags;
 }
 
+/*
+ * Drop TLB entries of [vaddr, vaddr + size) in current address space.
+ * Once the range covers as many page pairs as the TLB holds, flushing
+ * everything is cheaper than probing.
+ * User pages cached elsewhere, or under another ASID, are left to
+ * mm_forget_tlb(), which callers run after changing a user mapping.
+ */
+static void
+__tlb_invalidate_range(void *vaddr, size_t size)
+{
+	void *vcur, *vend = vaddr + size;
+
+	if (size == 0)
+		return;
+	if (size / (PAGE_SIZE * 2) >= get_tlb_entries()) {
+		tlb_flush();
+		return;
+	}
+	for (vcur = PTR_ALIGN_BELOW(vaddr, PAGE_SIZE * 2); vcur < vend;
+	    vcur += PAGE_SIZE * 2)
+		tlb_remove((addr_t)(unsigned long)vcur);
+}
+
 int
 map_pages(pgindex_t *pgindex,
 	  void *vaddr,
@@ -285,11 +357,11 @@ map_pages(pgindex_t *pgindex,
 	  uint32_t flags)
 {
 	struct pagedesc pd;
-	int retcode;
+	int retcode, i, n;
 	pte_t *pte;
-	addr_t pend = paddr + size;
+	uint32_t perm = __pgtable_perm(flags);
 	addr_t pcur = paddr;
-	void *vcur = vaddr;
+	void *vcur = vaddr, *vend = vaddr + size;
 
 	if (!IS_ALIGNED(paddr, PAGE_SIZE) ||
 	    !IS_ALIGNED(size, PAGE_SIZE) ||
@@ -297,75 +369,188 @@ map_pages(pgindex_t *pgindex,
 		return -EINVAL;
 
 	/*
-	 * 1st pass: allocate leaf page tables if needed, and validate
-	 * if there are any conflicts or memory shortage, in either case
-	 * we need to rollback.
+	 * Walk the range one leaf page table at a time, so that the
+	 * intermediate directories are walked once per leaf page table
+	 * instead of once per page.  Inside each leaf page table, we first
+	 * validate the whole run of entries (allocating directories if
+	 * needed), then fill them in a tight loop.  If there are any
+	 * conflicts or memory shortage, we clear what we have filled so
+	 * far and rollback.
 	 */
-	for (; pcur < pend; pcur += PAGE_SIZE, vcur += PAGE_SIZE) {
+	for (; vcur < vend; vcur += n * PAGE_SIZE, pcur += n * PAGE_SIZE) {
+		n = __ptrun(vcur, vend);
 		retcode = __getpagedesc(pgindex, vcur, true, &pd);
-		if (retcode == -ENOMEM)
+		if (retcode < 0)
 			goto rollback;
 
-		pte = (pte_t *)pd.ptev;
-		if (pte[pd.ptx] != 0) {
-			/* we are mapping on the exact same virtual
-			 * page which is either valid or invalid (paged
-			 * out), fail */
-			retcode = -EEXIST;
-			goto rollback;
+		pte = &((pte_t *)pd.ptev)[pd.ptx];
+		for (i = 0; i < n; ++i) {
+			if (pte[i] != 0) {
+				/* we are mapping on the exact same virtual
+				 * page which is either valid or invalid
+				 * (paged out), fail */
+				retcode = -EEXIST;
+				goto rollback;
+			}
 		}
+		for (i = 0; i < n; ++i)
+			pte[i] = (pcur + i * PAGE_SIZE) | perm;
 	}
 
-	/* 2nd pass: fill the entries as there shouldn't be any failure */
-	pcur = paddr;
-	vcur = vaddr;
-	for (; pcur < pend; pcur += PAGE_SIZE, vcur += PAGE_SIZE) {
-		__getpagedesc(pgindex, vcur, false, &pd);
-		pte = (pte_t *)pd.ptev;
-		pte[pd.ptx] = pcur | __pgtable_perm(flags);
-	}
-
+	/*
+	 * The refill handler loads both pages of a pair without checking,
+	 * so invalid entries for these pages may already be in the TLB.
+	 */
+	__tlb_invalidate_range(vaddr, size);
 	return 0;
 
 rollback:
+	__clear_range(pgindex, vaddr, vcur - vaddr);
 	__free_intermediate_pgtable(pgindex, vaddr, vcur - vaddr);
 	return retcode;
 }
 
-ssize_t
-unmap_pages(pgindex_t *pgindex,
-	    void *vaddr,
-	    size_t size,
-	    addr_t *paddr)
+static ssize_t
+__unmap_pages(pgindex_t *pgindex,
+	      void *vaddr,
+	      size_t size,
+	      addr_t *paddr,
+	      bool flush)
 {
 	void *vcur = vaddr, *vend = vaddr + size;
 	ssize_t unmapped_bytes = 0;
 	struct pagedesc pd;
 	pte_t *pte;
 	addr_t pcur = 0;
+	int i, n;
 
-	for (; vcur < vend; vcur += PAGE_SIZE,
-			    unmapped_bytes += PAGE_SIZE,
-			    pcur += PAGE_SIZE) {
+	for (; vcur < vend; vcur += n * PAGE_SIZE) {
+		n = __ptrun(vcur, vend);
 		if (__getpagedesc(pgindex, vcur, false, &pd) < 0)
 			/* may return -ENOENT? */
 			panic("unmap_pages non-existent: %p %p\n",
 			    pgindex, vcur);
-		pte = (pte_t *)pd.ptev;
+		pte = &((pte_t *)pd.ptev)[pd.ptx];
 		if (unmapped_bytes == 0) {
 			/* unmapping the first page: store the physical
 			 * address */
-			pcur = PTE_PADDR(pte[pd.ptx]);
+			pcur = PTE_PADDR(pte[0]);
 			if (paddr != NULL)
 				*paddr = pcur;
-		} else if (pte[pd.ptx] != pcur) {
-			break;
 		}
-		pte[pd.ptx] = 0;
+		/* stop at the first physically discontiguous page */
+		for (i = 0; i < n; ++i, pcur += PAGE_SIZE) {
+			if (PTE_PADDR(pte[i]) != pcur)
+				break;
+			pte[i] = 0;
+		}
+		unmapped_bytes += i * PAGE_SIZE;
+		if (i < n)
+			break;
 	}
 
-	__free_intermediate_pgtable(pgindex, vaddr, unmapped_bytes);
+	if (flush) {
+		__tlb_invalidate_range(vaddr, unmapped_bytes);
+		__free_intermediate_pgtable(pgindex, vaddr, unmapped_bytes);
+	}
 
 	return unmapped_bytes;
 }
 
+ssize_t
+unmap_pages(pgindex_t *pgindex,
+	    void *vaddr,
+	    size_t size,
+	    addr_t *paddr)
+{
+	return __unmap_pages(pgindex, vaddr, size, paddr, true);
+}
+
+ssize_t
+unmap_pages_noflush(pgindex_t *pgindex,
+		    void *vaddr,
+		    size_t size,
+		    addr_t *paddr)
+{
+	return __unmap_pages(pgindex, vaddr, size, paddr, false);
+}
+
+void
+free_empty_pgtables(pgindex_t *pgindex, void *vaddr, size_t size)
+{
+	__free_intermediate_pgtable(pgindex, vaddr, size);
+}
+
+static void
+__tlb_flush(void *arg)
+{
+	tlb_flush();
+}
+
+void
+tlb_flush_all(void)
+{
+	on_each_cpu(__tlb_flush, NULL, true);
+}
+
+/*
+ * The refill handler only walks the page index of the current address
+ * space, which has no kernel mappings.  Those made in kern_pgindex() at
+ * run time are loaded from there by tlb_refill_kern() instead, on the slow
+ * path, so page indexes share nothing and its page tables can go away.
+ */
+int
+share_kern_pgtables(void *vaddr, size_t size)
+{
+	return 0;
+}
+
+int
+tlb_refill_kern(void *vaddr)
+{
+	struct pagedesc pd;
+	pte_t *pte, global;
+
+	if (__getpagedesc(kern_pgindex(), vaddr, false, &pd) < 0)
+		return -EFAULT;
+	pte = &((pte_t *)pd.ptev)[pd.ptx & ~1];
+	if (!(pte[pd.ptx & 1] & PTE_VALID))
+		return -EFAULT;
+	/* the entry is only global if both halves are */
+	global = (pte[0] | pte[1]) & PTE_GLOBAL;
+	tlb_write((addr_t)(unsigned long)vaddr,
+	    (pte[0] | global) >> PTE_SOFT_SHIFT,
+	    (pte[1] | global) >> PTE_SOFT_SHIFT);
+	return 0;
+}
+
+int
+protect_pages(pgindex_t *pgindex,
+	      void *vaddr,
+	      size_t size,
+	      uint32_t flags)
+{
+	uint32_t perm = __pgtable_perm(flags);
+	void *vcur = vaddr, *vend = vaddr + size;
+	struct pagedesc pd;
+	pte_t *pte;
+	int i, n;
+
+	if (!IS_ALIGNED(size, PAGE_SIZE) ||
+	    !PTR_IS_ALIGNED(vaddr, PAGE_SIZE))
+		return -EINVAL;
+
+	for (; vcur < vend; vcur += n * PAGE_SIZE) {
+		n = __ptrun(vcur, vend);
+		if (__getpagedesc(pgindex, vcur, false, &pd) < 0)
+			continue;
+		pte = &((pte_t *)pd.ptev)[pd.ptx];
+		/* invalid (e.g. paged out) entries keep their contents */
+		for (i = 0; i < n; ++i)
+			if (pte[i] & PTE_VALID)
+				pte[i] = PTE_PADDR(pte[i]) | perm;
+	}
+
+	__tlb_invalidate_range(vaddr, size);
+	return 0;
+}
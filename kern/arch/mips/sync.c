@@ -21,9 +21,15 @@
 #endif
 
 #include <aim/sync.h>
+#include <arch-sync.h>
 #include <panic.h>
 #include <sys/types.h>
 
+#ifndef __LP64__
+/* serializes 64-bit atomics, see atomic.h */
+lock_t __atomic64_lock = UNLOCKED;
+#endif /* !__LP64__ */
+
 void spinlock_init(lock_t *lock)
 {
 	*lock = UNLOCKED;
@@ -32,30 +38,120 @@ void spinlock_init(lock_t *lock)
 	 * barriers here. */
 }
 
-void spin_lock(lock_t *lock)
+/*
+ * MIPS has nothing like PAUSE or WFE, so a waiter backs off for a while
+ * proportional to its distance from the head of the queue before looking
+ * at the lock again, keeping the line quiet for the one about to get it.
+ */
+#define SPIN_BACKOFF	32
+
+static inline void __backoff(int n)
 {
-	uint32_t reg;
+	for (n *= SPIN_BACKOFF; n > 0; --n)
+		asm volatile ("nop");
+}
+
+void arch_spin_lock(lock_t *lock)
+{
+	uint32_t val, tmp;
+	uint16_t ticket;
+
 	asm volatile (
-		"1:	ll	%[reg], %[mem];"
-		"	beqz	%[reg], 2f;"
-		"	sc	%[reg], %[mem];"
-		"	b	1b;"
-		"2:	or	%[reg], 1;"
-		"	sc	%[reg], %[mem];"
-		"	beqz	%[reg], 1b;"
-		: [reg]"=&r"(reg), [mem]"+m"(*lock)
+		"1:	ll	%[val], %[mem];"
+		"	addu	%[tmp], %[val], %[inc];"
+		"	sc	%[tmp], %[mem];"
+		"	beqz	%[tmp], 1b;"
+		: [val]"=&r"(val), [tmp]"=&r"(tmp), [mem]"+m"(*lock)
+		: [inc]"r"(1 << LOCK_TICKET_SHIFT)
 	);
+
+	ticket = lock_next(val);
+	while (lock_owner(val) != ticket) {
+		__backoff((uint16_t)(ticket - lock_owner(val)));
+		val = *(volatile lock_t *)lock;
+	}
+	smp_mb();
 }
 
-void spin_unlock(lock_t *lock)
+void arch_spin_unlock(lock_t *lock)
 {
-	uint32_t reg;
+	smp_mb();
+	lock_owner_half(lock) = lock_owner(*lock) + 1;
+}
+
+/*
+ * Reader-writer spinlock
+ * RW_WRITER is the sign bit, so one branch tells whether a writer is in.
+ */
+
+void rwlock_init(rwlock_t *lock)
+{
+	*lock = RW_UNLOCKED;
+}
+
+void read_lock(rwlock_t *lock)
+{
+	uint32_t val, tmp;
+
+	for (;;) {
+		asm volatile (
+			"1:	ll	%[val], %[mem];"
+			"	bltz	%[val], 2f;"
+			"	addiu	%[tmp], %[val], 1;"
+			"	sc	%[tmp], %[mem];"
+			"	beqz	%[tmp], 1b;"
+			"2:"
+			: [val]"=&r"(val), [tmp]"=&r"(tmp), [mem]"+m"(*lock)
+		);
+		if (!(val & RW_WRITER))
+			break;
+		__backoff(1);
+	}
+	smp_mb();
+}
+
+void read_unlock(rwlock_t *lock)
+{
+	uint32_t tmp;
+
+	smp_mb();
 	asm volatile (
-		"1:	ll	%[reg], %[mem];"
-		"	and	%[reg], ~1;"
-		"	sc	%[reg], %[mem];"
-		"	beqz	%[reg], 1b;"
-		: [reg]"=&r"(reg), [mem]"+m"(*lock)
+		"1:	ll	%[tmp], %[mem];"
+		"	addiu	%[tmp], %[tmp], -1;"
+		"	sc	%[tmp], %[mem];"
+		"	beqz	%[tmp], 1b;"
+		: [tmp]"=&r"(tmp), [mem]"+m"(*lock)
 	);
 }
 
+void write_lock(rwlock_t *lock)
+{
+	uint32_t val, tmp;
+
+	/* keep new readers out, then wait for those inside */
+	for (;;) {
+		asm volatile (
+			"1:	ll	%[val], %[mem];"
+			"	bltz	%[val], 2f;"
+			"	or	%[tmp], %[val], %[writer];"
+			"	sc	%[tmp], %[mem];"
+			"	beqz	%[tmp], 1b;"
+			"2:"
+			: [val]"=&r"(val), [tmp]"=&r"(tmp), [mem]"+m"(*lock)
+			: [writer]"r"(RW_WRITER)
+		);
+		if (!(val & RW_WRITER))
+			break;
+		__backoff(1);
+	}
+	while ((tmp = *(volatile rwlock_t *)lock) & RW_READERS)
+		__backoff(tmp & RW_READERS);
+	smp_mb();
+}
+
+void write_unlock(rwlock_t *lock)
+{
+	/* no reader can get in while we are here */
+	smp_mb();
+	*(volatile rwlock_t *)lock = RW_UNLOCKED;
+}
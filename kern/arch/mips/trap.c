@@ -28,6 +28,10 @@
 #include <trap.h>
 #include <console.h>
 #include <arch-trap.h>
+#include <mm.h>
+#include <ipi.h>
+#include <smp.h>
+#include <tlb.h>
 
 void trap_init(void)
 {
@@ -35,6 +39,10 @@ void trap_init(void)
 	extern uint32_t tlb_entry;
 	memcpy((void *)GENERIC_EXCEPT_ENTRY, &generic_exception_entry, 0x80);
 	memcpy((void *)TLB_REFILL_ENTRY, &tlb_entry, 0x80);
+#ifdef __LP64__
+	/* 64-bit segments refill through the XTLB vector */
+	memcpy((void *)XTLB_REFILL_ENTRY, &tlb_entry, 0x80);
+#endif
 
 	uint32_t status = read_c0_status();
 	write_c0_status(status & ~ST_BEV);
@@ -80,8 +88,41 @@ static void dump_regs(struct regs *regs)
 	kprintf("BVA\t%016x\n", regs->badvaddr);
 }
 
+/*
+ * TLB exceptions not resolved by the refill handler: invalid or missing
+ * PTEs, writes to pages without PTE_DIRTY, and run time kernel mappings.
+ */
+static int handle_tlb_exception(struct regs *regs)
+{
+	void *addr = (void *)(unsigned long)regs->badvaddr;
+	uint32_t flags;
+
+	switch (EXCCODE(regs->cause)) {
+	case EC_tlbl:
+		flags = (regs->epc == regs->badvaddr) ? VMA_EXEC : VMA_READ;
+		break;
+	case EC_tlbs:
+	case EC_tlbm:
+		flags = VMA_WRITE;
+		break;
+	default:
+		return -1;
+	}
+	if ((size_t)addr >= KMMAP_BASE && (size_t)addr < RESERVED_BASE)
+		return tlb_refill_kern(addr);
+	return handle_page_fault(current_mm(), addr, flags);
+}
+
 void trap_handler(struct regs *regs)
 {
+	if (EXCCODE(regs->cause) == EC_int && mach_ipi_ack()) {
+		ipi_handler();
+		trap_return(regs);
+	}
+
+	if (handle_tlb_exception(regs) == 0)
+		trap_return(regs);
+
 	dump_regs(regs);
 	panic("Unexpected trap\n");
 	trap_return(regs);
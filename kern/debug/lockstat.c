@@ -0,0 +1,179 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <aim/sync.h>
+#include <atomic.h>
+#include <console.h>
+#include <libc/string.h>
+
+/*
+ * Lock statistics, see aim/sync.h.
+ *
+ * Entries live in a fixed open-addressed table keyed by lock address, and
+ * a lock claims its slot with a compare-and-swap the first time it is
+ * taken.  Everything else in an entry is only written by the holder of
+ * the lock it describes, so the lock itself keeps the numbers straight.
+ * Locks that do not fit are counted and left alone.  A lock that goes
+ * away, e.g. with the object it was in, keeps its slot; a new lock at the
+ * same address adds to it.
+ */
+
+#define LOCKSTAT_SLOTS	512	/* power of 2 */
+#define LOCKSTAT_SHIFT	10	/* totals are printed in 1024 cycles */
+
+struct lockstat {
+	lock_t		*lock;		/* NULL if the slot is free */
+	void		*site;		/* where it was first taken */
+	unsigned long	acquired;
+	unsigned long	contended;	/* found held when asked for */
+	unsigned long	wait_max, hold_max;
+	uint64_t	wait_total, hold_total;
+	unsigned long	hold_start;
+	bool		holding;
+};
+
+static struct lockstat __stats[LOCKSTAT_SLOTS];
+static atomic_t __dropped;
+
+#ifdef __LP64__
+#define __claim(slot, lock) \
+	((lock_t *)atomic64_cmpxchg((atomic64_t *)(slot), 0, \
+	    (uint64_t)(lock)))
+#else
+#define __claim(slot, lock) \
+	((lock_t *)atomic_cmpxchg((atomic_t *)(slot), 0, (uint32_t)(lock)))
+#endif
+
+static inline unsigned long __hash(lock_t *lock)
+{
+	/* Fibonacci hashing, locks are at least word aligned */
+	return (((unsigned long)lock >> 2) * 2654435761u) &
+	    (LOCKSTAT_SLOTS - 1);
+}
+
+/* Only claims a slot if @site is given, i.e. on the locking side */
+static struct lockstat *__lookup(lock_t *lock, void *site)
+{
+	struct lockstat *ls;
+	lock_t *key;
+	unsigned long i = __hash(lock);
+	int n;
+
+	for (n = 0; n < LOCKSTAT_SLOTS; ++n) {
+		ls = &__stats[i];
+		key = *(lock_t * volatile *)&ls->lock;
+		if (key == lock)
+			return ls;
+		if (key == NULL) {
+			if (site == NULL)
+				return NULL;
+			key = __claim(&ls->lock, lock);
+			if (key == NULL) {
+				ls->site = site;
+				return ls;
+			}
+			if (key == lock)
+				return ls;
+			/* another lock got it first */
+		}
+		i = (i + 1) & (LOCKSTAT_SLOTS - 1);
+	}
+	if (site != NULL)
+		atomic_inc(&__dropped);
+	return NULL;
+}
+
+void spin_lock(lock_t *lock)
+{
+	struct lockstat *ls;
+	unsigned long start, now, wait;
+	bool contended;
+
+	ls = __lookup(lock, __builtin_return_address(0));
+	contended = lock_held(*(volatile lock_t *)lock);
+	start = get_cycles();
+	arch_spin_lock(lock);
+	now = get_cycles();
+	if (ls == NULL)
+		return;
+
+	wait = now - start;
+	++ls->acquired;
+	if (contended)
+		++ls->contended;
+	ls->wait_total += wait;
+	if (wait > ls->wait_max)
+		ls->wait_max = wait;
+	ls->hold_start = now;
+	ls->holding = true;
+}
+
+void spin_unlock(lock_t *lock)
+{
+	struct lockstat *ls = __lookup(lock, NULL);
+	unsigned long hold;
+
+	/* not if we were reset while it was held */
+	if (ls != NULL && ls->holding) {
+		hold = get_cycles() - ls->hold_start;
+		ls->holding = false;
+		ls->hold_total += hold;
+		if (hold > ls->hold_max)
+			ls->hold_max = hold;
+	}
+	arch_spin_unlock(lock);
+}
+
+/*
+ * Numbers are read without the locks, so an entry may be caught halfway
+ * through an update.  Good enough to spot a hot lock.
+ */
+void lockstat_dump(void)
+{
+	struct lockstat *ls;
+	int i;
+
+	kprintf("lockstat: lock, site, acquired, contended, "
+		"wait max/total, hold max/total (total in %d cycles)\n",
+		1 << LOCKSTAT_SHIFT);
+	for (i = 0; i < LOCKSTAT_SLOTS; ++i) {
+		ls = &__stats[i];
+		if (ls->lock == NULL || ls->acquired == 0)
+			continue;
+		kprintf("lockstat: %p %p %lu %lu %lu/%lu %lu/%lu\n",
+			ls->lock, ls->site, ls->acquired, ls->contended,
+			ls->wait_max,
+			(unsigned long)(ls->wait_total >> LOCKSTAT_SHIFT),
+			ls->hold_max,
+			(unsigned long)(ls->hold_total >> LOCKSTAT_SHIFT));
+	}
+	kprintf("lockstat: %u locks not tracked\n", atomic_read(&__dropped));
+}
+
+/* Best run while things are quiet, as locks may be taken meanwhile */
+void lockstat_reset(void)
+{
+	memset(__stats, 0, sizeof(__stats));
+	atomic_set(&__dropped, 0);
+	SMP_DMB();
+}
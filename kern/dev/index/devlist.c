@@ -29,13 +29,20 @@
 
 #include <libc/string.h>
 #include <list.h>
+#include <rculist.h>
+#include <util.h>
 
 struct device_entry {
 	struct device *dev;
 	struct list_head node;
+	struct rcu_head rcu;
 };
 
 static struct list_head __head = EMPTY_LIST(__head);
+/*
+ * Lookups far outnumber changes, so they walk the list under RCU and
+ * take no lock at all. The lock only keeps writers apart.
+ */
 static lock_t __lock = UNLOCKED;
 
 /* comparition according to id */
@@ -68,7 +75,7 @@ static int __add(struct device *dev)
 	for_each_entry(tmp, &__head, node) {
 		if (__cmp(tmp, this) > 0) break;
 	}
-	list_add_before(&this->node, &tmp->node);
+	list_add_before_rcu(&this->node, &tmp->node);
 
 	/* unlock the list */
 	spin_unlock(&__lock);
@@ -76,6 +83,11 @@ static int __add(struct device *dev)
 	return 0;
 }
 
+static void __free_entry(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct device_entry, rcu));
+}
+
 static int __remove(struct device *dev)
 {
 	struct device_entry *tmp, *this = NULL;
@@ -94,8 +106,8 @@ static int __remove(struct device *dev)
 
 	/* remove */
 	if (this != NULL) {
-		list_del(&this->node);
-		kfree(this);
+		list_del_rcu(&this->node);
+		call_rcu(&this->rcu, __free_entry);
 		retval = 0; /* success */
 	}
 
@@ -110,11 +122,10 @@ static struct device *__from_id(devid_t major, devid_t minor)
 	struct device_entry *tmp;
 	struct device *retval;
 
-	/* lock up the list */
-	spin_lock(&__lock);
+	rcu_read_lock();
 
 	/* loop and check */
-	for_each_entry(tmp, &__head, node) {
+	for_each_entry_rcu(tmp, &__head, node) {
 		if (tmp->dev->id_major == major && tmp->dev->id_minor == minor)
 			break;
 	}
@@ -123,8 +134,7 @@ static struct device *__from_id(devid_t major, devid_t minor)
 	else
 		retval = NULL;
 
-	/* unlock the list */
-	spin_unlock(&__lock);
+	rcu_read_unlock();
 	return retval;
 }
 
@@ -133,11 +143,10 @@ static struct device *__from_name(char *name)
 	struct device_entry *tmp;
 	struct device *retval;
 
-	/* lock up the list */
-	spin_lock(&__lock);
+	rcu_read_lock();
 
 	/* loop and check */
-	for_each_entry(tmp, &__head, node) {
+	for_each_entry_rcu(tmp, &__head, node) {
 		if (strcmp(tmp->dev->name, name) == 0)
 			break;
 	}
@@ -146,8 +155,7 @@ static struct device *__from_name(char *name)
 	else
 		retval = NULL;
 
-	/* unlock the list */
-	spin_unlock(&__lock);
+	rcu_read_unlock();
 	return retval;
 }
 
@@ -66,9 +66,18 @@ void __noreturn master_early_init(void)
 	abs_jump((void *)postmap_addr(&master_upper_entry));
 }
 
+/*
+ * Slaves come here from slave_entry, on the stack smp_startup() gave them.
+ * The boot page index still has every early mapping the master came up
+ * with, the low ones included, so our stack stays valid across the switch.
+ */
 void __noreturn slave_early_init(void)
 {
-	panic("Unimplemented routine called.");
+	extern pgindex_t boot_page_index;
+	extern uint32_t slave_upper_entry;
+
+	mmu_init((pgindex_t *)kva2pa(postmap_addr((void *)&boot_page_index)));
+	abs_jump((void *)postmap_addr(&slave_upper_entry));
 }
 
 
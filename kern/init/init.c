@@ -29,7 +29,13 @@
 #include <trap.h>
 #include <panic.h>
 #include <init.h>
+#include <ipi.h>
+#include <percpu.h>
+#include <rcu.h>
+#include <smp.h>
+#include <swap.h>
 #include <aim/initcalls.h>
+#include <aim/sync.h>
 
 #define BOOTSTRAP_POOL_SIZE	1024
 
@@ -92,11 +98,16 @@ void __noreturn master_init(void)
 	mm_test();
 
 	/* allocate per-cpu context and kworker */
+	percpu_init();
+	kputs("KERN: Per-CPU data initialized.\n");
 //	proc_init();
 
 	/* do initcalls, one by one */
 	do_initcalls();
 
+	/* needs the storage drivers registered by initcalls */
+	swap_init();
+
 	/* temporary tests */
 	struct allocator_cache cache = {
 		.size = 1024,
@@ -126,6 +137,9 @@ void __noreturn master_init(void)
 	kprintf("DEBUG: a = 0x%08x\n", a);
 
 	/* startup smp */
+	arch_ipi_init();
+	smp_startup();
+	kputs("KERN: Secondary CPUs started.\n");
 
 	/*
 	 * do initcalls, one by one.
@@ -137,11 +151,42 @@ void __noreturn master_init(void)
 	/* initialize or cleanup namespace */
 
 
-	panic("Test done, all is well.\n");
+	/* compiled out unless configured with --enable-lockstat */
+	lockstat_dump();
+
+	kputs("KERN: Test done, all is well.\n");
+
+	/*
+	 * Nothing to schedule yet, so idle here and keep grace periods
+	 * moving, as the slaves do.  Cross-calls to us are polled for too,
+	 * or a slave waiting on one would spin forever.
+	 */
+	for (;;) {
+		ipi_handler();
+		rcu_qs();
+	}
 }
 
 void __noreturn slave_init(void)
 {
-	panic("Unimplemented routine called.");
+	int cpu = cpuid();
+
+	arch_init();
+	percpu_load();
+	trap_init();
+	arch_ipi_init();
+	rcu_cpu_online();
+	set_cpu_online(cpu);
+	kprintf("KERN: CPU %d is up.\n", cpu);
+
+	/*
+	 * There is no scheduler to join yet, so we idle here, passing
+	 * through quiescent states to keep grace periods moving.  Nothing
+	 * turns interrupts on yet either, so we look for cross-calls too.
+	 */
+	for (;;) {
+		ipi_handler();
+		rcu_qs();
+	}
 }
 
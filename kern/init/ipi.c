@@ -0,0 +1,186 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+/* from kernel */
+#include <sys/types.h>
+#include <aim/initcalls.h>
+#include <atomic.h>
+#include <errno.h>
+#include <init.h>
+#include <ipi.h>
+#include <ring.h>
+#include <smp.h>
+#include <util.h>
+
+/*
+ * A request is busy from the time it is queued until its function has
+ * returned.  Only its sender writes it while it is idle, and only the
+ * target while it is busy.
+ *
+ * @pending says an IPI is on its way to the CPU or being handled.  The
+ * handler clears it before emptying the queue, and a caller sets it after
+ * queueing, so whatever the handler misses comes with a new IPI.
+ */
+
+struct call_req {
+	struct mpsc_node node;
+	void (*func)(void *arg);
+	void *arg;
+	atomic_t busy;
+};
+
+struct call_cpu {
+	struct mpsc_queue queue;
+	atomic_t pending __cacheline_aligned;
+};
+
+static struct call_cpu __call_cpu[NR_CPUS];
+/* indexed by sender, then target */
+static struct call_req __call_req[NR_CPUS][NR_CPUS];
+
+void ipi_handler(void)
+{
+	struct call_cpu *self = &__call_cpu[cpuid()];
+	struct mpsc_node *node;
+	struct call_req *req;
+
+	/* cheap enough to poll */
+	if (atomic_read(&self->pending) == 0)
+		return;
+	atomic_set(&self->pending, 0);
+	SMP_DMB();
+
+	while ((node = mpsc_queue_pop(&self->queue)) != NULL) {
+		req = container_of(node, struct call_req, node);
+		req->func(req->arg);
+		SMP_DMB();
+		atomic_set(&req->busy, 0);
+	}
+}
+
+static void __wait_req(struct call_req *req)
+{
+	while (atomic_read(&req->busy) != 0)
+		ipi_handler();
+	SMP_DMB();
+}
+
+static void __queue_call(int cpu, void (*func)(void *arg), void *arg)
+{
+	struct call_req *req = &__call_req[cpuid()][cpu];
+	struct call_cpu *target = &__call_cpu[cpu];
+
+	__wait_req(req);
+	req->func = func;
+	req->arg = arg;
+	atomic_set(&req->busy, 1);
+	/* fully ordered, as are the swaps below */
+	mpsc_queue_push(&target->queue, &req->node);
+	if (atomic_xchg(&target->pending, 1) == 0)
+		arch_send_ipi(cpu);
+}
+
+int smp_call_function_single(int cpu, void (*func)(void *arg), void *arg,
+    bool wait)
+{
+	if (cpu < 0 || cpu >= NR_CPUS || !cpu_online(cpu))
+		return -ENODEV;
+	if (cpu == cpuid()) {
+		func(arg);
+		return 0;
+	}
+	__queue_call(cpu, func, arg);
+	if (wait)
+		__wait_req(&__call_req[cpuid()][cpu]);
+	return 0;
+}
+
+static inline bool __is_target(int cpu, int self, cpumask_t *mask)
+{
+	return cpu != self && cpumask_test_cpu(cpu, mask) && cpu_online(cpu);
+}
+
+static void __queue_many(cpumask_t *mask, void (*func)(void *arg),
+    void *arg)
+{
+	int self = cpuid(), cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; ++cpu)
+		if (__is_target(cpu, self, mask))
+			__queue_call(cpu, func, arg);
+}
+
+static void __wait_many(cpumask_t *mask)
+{
+	int self = cpuid(), cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; ++cpu)
+		if (__is_target(cpu, self, mask))
+			__wait_req(&__call_req[self][cpu]);
+}
+
+/* all of them are queued before we wait for any, so they run together */
+void smp_call_function_many(cpumask_t *mask, void (*func)(void *arg),
+    void *arg, bool wait)
+{
+	__queue_many(mask, func, arg);
+	if (wait)
+		__wait_many(mask);
+}
+
+static void __all_cpus(cpumask_t *mask)
+{
+	int i;
+
+	for (i = 0; i < (NR_CPUS + 31) / 32; ++i)
+		atomic_set(&mask->bits[i], ~0u);
+}
+
+void smp_call_function(void (*func)(void *arg), void *arg, bool wait)
+{
+	cpumask_t all;
+
+	__all_cpus(&all);
+	smp_call_function_many(&all, func, arg, wait);
+}
+
+void on_each_cpu(void (*func)(void *arg), void *arg, bool wait)
+{
+	cpumask_t all;
+
+	__all_cpus(&all);
+	__queue_many(&all, func, arg);
+	func(arg);
+	if (wait)
+		__wait_many(&all);
+}
+
+static int __init(void)
+{
+	int i;
+
+	for (i = 0; i < NR_CPUS; ++i)
+		mpsc_queue_init(&__call_cpu[i].queue);
+	return 0;
+}
+
+INITCALL_CORE(__init)
@@ -0,0 +1,112 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+/* from kernel */
+#include <sys/types.h>
+#include <atomic.h>
+#include <console.h>
+#include <errno.h>
+#include <init.h>
+#include <mm.h>
+#include <mmu.h>
+#include <pmm.h>
+#include <smp.h>
+
+/*
+ * Secondary CPUs are started one at a time.  For each of them the master
+ * allocates a kernel stack and kicks the CPU with arch_start_cpu().  The
+ * slave comes in at slave_entry with its MMU off and runs on
+ * slave_early_stack, turns its MMU on with the boot page index, switches
+ * to slave_stack at slave_upper_entry and goes on to slave_init(), which
+ * marks it online.  Only then does the master move on, so the two stack
+ * pointers need no more than one copy.
+ */
+
+/* read by slave_entry and slave_upper_entry */
+void *slave_early_stack;
+void *slave_stack;
+
+static atomic_t __cpu_online_mask[(NR_CPUS + 31) / 32];
+
+/* in spins of the master, generous enough for simulators */
+#define SLAVE_TIMEOUT	(1 << 26)
+
+void set_cpu_online(int cpu)
+{
+	atomic_set_bit(cpu, __cpu_online_mask);
+	SMP_DMB();
+}
+
+bool cpu_online(int cpu)
+{
+	return atomic_test_bit(cpu, __cpu_online_mask);
+}
+
+static int __start_cpu(int cpu)
+{
+	struct pages p;
+	unsigned long top;
+	int i, ret;
+
+	p.size = KSTACKSIZE;
+	p.flags = 0;
+	if (alloc_pages(&p) != 0)
+		return -ENOMEM;
+	top = (unsigned long)pa2kva((size_t)p.paddr) + KSTACKSIZE;
+
+	slave_stack = (void *)top;
+	slave_early_stack = (void *)premap_addr(top);
+	/* the slave reads these with its caches off */
+	dcache_clean_range(&slave_stack, sizeof(slave_stack));
+	dcache_clean_range(&slave_early_stack, sizeof(slave_early_stack));
+
+	ret = arch_start_cpu(cpu);
+	if (ret != 0) {
+		free_pages(&p);
+		return ret;
+	}
+	for (i = 0; i < SLAVE_TIMEOUT; ++i)
+		if (cpu_online(cpu))
+			return 0;
+	/* the stack is left to the CPU, in case it shows up late after all */
+	return -ETIMEDOUT;
+}
+
+void smp_startup(void)
+{
+	int cpu, ret;
+
+	set_cpu_online(cpuid());
+	for (cpu = 0; cpu < NR_CPUS; ++cpu) {
+		if (cpu_online(cpu))
+			continue;
+		ret = __start_cpu(cpu);
+		if (ret == -ENODEV)
+			continue;
+		if (ret != 0) {
+			/* a late slave would share our stack pointers */
+			kprintf("KERN: CPU %d failed to start (%d), "
+				"not trying further CPUs.\n", cpu, ret);
+			return;
+		}
+	}
+}
@@ -0,0 +1,158 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <aim/sync.h>
+#include <mm.h>
+#include <mmu.h>
+#include <util.h>
+#include <libc/string.h>
+
+/*
+ * ASID allocator with generation-based rollover.
+ *
+ * mm->asid keeps the hardware ASID in its low bits and the generation it
+ * was allocated in above them.  An mm from the current generation keeps
+ * its ASID across switches, so its TLB entries stay valid.
+ *
+ * When all ASIDs of a generation are used up, we start a new generation:
+ * the ASID map is cleared except for the ASIDs running on some CPU at the
+ * moment, and every CPU must flush its TLB before running a newly
+ * allocated ASID.  This is the only time a full TLB flush happens.
+ *
+ * ASID 0 is never handed out, so architectures can use it as a reserved
+ * ASID while switching page tables.
+ */
+#ifdef NR_ASIDS
+
+#include <percpu.h>
+
+#define ASID_MASK	(NR_ASIDS - 1)
+#define ASID_FIRST_GEN	NR_ASIDS
+#define asid_gen(asid)	((asid) & ~ASID_MASK)
+
+static lock_t __asid_lock = UNLOCKED;
+static unsigned long __asid_generation = ASID_FIRST_GEN;
+static unsigned long __asid_next = 1;
+static unsigned long __asid_map[NR_ASIDS / BITS_PER_LONG];
+
+/* ASID and mm running on each CPU, preserved across rollovers */
+static DEFINE_PER_CPU(unsigned long, __active_asid);
+static DEFINE_PER_CPU(struct mm *, __active_mm);
+static DEFINE_PER_CPU(bool, __flush_pending);
+
+static inline bool __asid_test_and_set(unsigned long asid)
+{
+	unsigned long bit = 1UL << (asid % BITS_PER_LONG);
+	unsigned long *word = &__asid_map[asid / BITS_PER_LONG];
+
+	if (*word & bit)
+		return true;
+	*word |= bit;
+	return false;
+}
+
+static void __asid_rollover(void)
+{
+	struct mm *mm;
+	unsigned long asid;
+	int i;
+
+	__asid_generation += ASID_FIRST_GEN;
+	/* wraparound of the generation counter itself */
+	if (__asid_generation == 0)
+		__asid_generation = ASID_FIRST_GEN;
+
+	memset(__asid_map, 0, sizeof(__asid_map));
+	__asid_test_and_set(0);
+	__asid_next = 1;
+
+	/*
+	 * Running address spaces keep their ASIDs, moved to the new
+	 * generation.  Their TLB entries are still good on the CPUs running
+	 * them, while stale entries of everyone else are flushed before
+	 * any CPU switches to a new ASID.
+	 */
+	for (i = 0; i < NR_CPUS; ++i) {
+		mm = per_cpu(__active_mm, i);
+		if (mm != NULL) {
+			asid = per_cpu(__active_asid, i) & ASID_MASK;
+			__asid_test_and_set(asid);
+			mm->asid = __asid_generation | asid;
+			per_cpu(__active_asid, i) = mm->asid;
+		}
+		per_cpu(__flush_pending, i) = true;
+	}
+}
+
+static unsigned long __asid_new(void)
+{
+	for (;;) {
+		for (; __asid_next < NR_ASIDS; ++__asid_next) {
+			if (!__asid_test_and_set(__asid_next))
+				return __asid_generation | __asid_next++;
+		}
+		__asid_rollover();
+	}
+}
+
+unsigned long asid_switch(struct mm *mm, bool *flush)
+{
+	unsigned long asid;
+
+	spin_lock(&__asid_lock);
+
+	if (mm->asid == 0 || asid_gen(mm->asid) != __asid_generation)
+		mm->asid = __asid_new();
+	asid = mm->asid;
+
+	this_cpu_write(__active_asid, asid);
+	this_cpu_write(__active_mm, mm);
+	*flush = this_cpu_read(__flush_pending);
+	this_cpu_write(__flush_pending, false);
+
+	spin_unlock(&__asid_lock);
+
+	return asid & ASID_MASK;
+}
+
+void asid_release(struct mm *mm)
+{
+	int i;
+
+	/* the ASID itself is reclaimed at the next rollover */
+	spin_lock(&__asid_lock);
+	for (i = 0; i < NR_CPUS; ++i)
+		if (per_cpu(__active_mm, i) == mm)
+			per_cpu(__active_mm, i) = NULL;
+	spin_unlock(&__asid_lock);
+}
+
+void asid_retire(struct mm *mm)
+{
+	/* the old one is reclaimed at the next rollover, as above */
+	spin_lock(&__asid_lock);
+	mm->asid = 0;
+	spin_unlock(&__asid_lock);
+}
+
+#endif /* NR_ASIDS */
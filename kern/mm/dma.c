@@ -0,0 +1,151 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <dma.h>
+#include <errno.h>
+#include <mm.h>
+#include <mmu.h>
+#include <pmm.h>
+#include <util.h>
+#include <libc/string.h>
+
+/*
+ * Bus addresses equal physical addresses on every machine we support, so
+ * the only question is whether the device can reach the buffer in place.
+ */
+
+static inline addr_t __kva2pa(void *vaddr)
+{
+	return (addr_t)(size_t)kva2pa(vaddr);
+}
+
+static bool __reachable(struct dma_buf *buf, addr_t limit)
+{
+	addr_t paddr;
+
+	if (!kva_is_linear(buf->vaddr) ||
+	    !kva_is_linear(buf->vaddr + buf->size - 1))
+		return false;
+	paddr = __kva2pa(buf->vaddr);
+	return paddr + buf->size - 1 <= limit;
+}
+
+static int __bounce_alloc(struct dma_buf *buf, addr_t limit)
+{
+	struct pages p = {
+		.size = ALIGN_ABOVE(buf->size, PAGE_SIZE),
+		.flags = 0
+	};
+
+	if (alloc_pages(&p) != 0)
+		return -ENOMEM;
+	/* the page allocator knows nothing about zones, just check */
+	if (p.paddr + p.size - 1 > limit) {
+		free_pages(&p);
+		return -ENOMEM;
+	}
+	buf->bounce = (void *)(size_t)pa2kva((size_t)p.paddr);
+	buf->bounce_paddr = p.paddr;
+	return 0;
+}
+
+static void __bounce_free(struct dma_buf *buf)
+{
+	struct pages p = {
+		.paddr = buf->bounce_paddr,
+		.size = ALIGN_ABOVE(buf->size, PAGE_SIZE),
+		.flags = 0
+	};
+
+	free_pages(&p);
+	buf->bounce = NULL;
+}
+
+int dma_map(struct dma_buf *buf, addr_t limit, int dir)
+{
+	void *vaddr;
+	int ret;
+
+	buf->bounce = NULL;
+	if (__reachable(buf, limit)) {
+		vaddr = buf->vaddr;
+		buf->busaddr = __kva2pa(vaddr);
+	} else {
+		ret = __bounce_alloc(buf, limit);
+		if (ret != 0)
+			return ret;
+		if (dir & DMA_TO_DEVICE)
+			memcpy(buf->bounce, buf->vaddr, buf->size);
+		vaddr = buf->bounce;
+		buf->busaddr = buf->bounce_paddr;
+	}
+
+	/*
+	 * Dirty lines must not be evicted on top of what the device writes,
+	 * so buffers the device writes to are flushed rather than just
+	 * invalidated.  This also keeps neighbors sharing a partial line.
+	 */
+	if (dir & DMA_FROM_DEVICE)
+		dcache_flush_range(vaddr, buf->size);
+	else
+		dcache_clean_range(vaddr, buf->size);
+	return 0;
+}
+
+void dma_unmap(struct dma_buf *buf, int dir)
+{
+	void *vaddr = (buf->bounce != NULL) ? buf->bounce : buf->vaddr;
+
+	/* drop lines speculatively fetched during the transfer */
+	if (dir & DMA_FROM_DEVICE)
+		dcache_inval_range(vaddr, buf->size);
+
+	if (buf->bounce != NULL) {
+		if (dir & DMA_FROM_DEVICE)
+			memcpy(buf->vaddr, buf->bounce, buf->size);
+		__bounce_free(buf);
+	}
+}
+
+int dma_map_sg(struct dma_buf *sg, int nents, addr_t limit, int dir)
+{
+	int i, ret;
+
+	for (i = 0; i < nents; ++i) {
+		ret = dma_map(&sg[i], limit, dir);
+		if (ret != 0) {
+			while (--i >= 0)
+				dma_unmap(&sg[i], 0);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+void dma_unmap_sg(struct dma_buf *sg, int nents, int dir)
+{
+	int i;
+
+	for (i = 0; i < nents; ++i)
+		dma_unmap(&sg[i], dir);
+}
@@ -0,0 +1,232 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <errno.h>
+#include <list.h>
+#include <mm.h>
+#include <mmu.h>
+#include <panic.h>
+#include <pmm.h>
+#include <util.h>
+#include <libc/string.h>
+
+/*
+ * Transparent huge pages.
+ *
+ * User memory is still made of one-page VMAs with a struct pages each.
+ * Collapsing a block only moves the contents of its pages into one
+ * HPAGE_SIZE-aligned frame, points each struct pages at its own slice of
+ * that frame, and maps the block again in one go; the page table code
+ * picks a section (ARM) or a PSE page (i386) for an aligned mapping of
+ * this size.  Since the page allocator does not care how a range was
+ * allocated, slices can later be freed one by one.
+ *
+ * Splitting a block only gives its pages back to reclaim.  unmap_pages()
+ * and protect_pages() break the large mapping up themselves when asked to
+ * change part of it.
+ *
+ * Collapsing is tried when the last page of a block gets populated, which
+ * catches heaps and stacks filled in order, and on request for ranges
+ * known to be hot.
+ */
+#ifdef HPAGE_SIZE
+
+#define HPAGE_NR_PAGES	(HPAGE_SIZE / PAGE_SIZE)
+
+static inline void *__kva(addr_t paddr)
+{
+	return (void *)pa2kva((size_t)paddr);
+}
+
+/*
+ * The page allocator has no notion of alignment, so take twice the size
+ * and give back what is around the aligned block.  No reclaim here, huge
+ * pages are not worth swapping for.
+ */
+static int __alloc_block(struct pages *block)
+{
+	struct pages p = { .size = HPAGE_SIZE * 2 - PAGE_SIZE, .flags = 0 };
+	struct pages slack = { .flags = 0 };
+	addr_t end;
+
+	if (alloc_pages(&p) != 0)
+		return -ENOMEM;
+	end = p.paddr + p.size;
+
+	block->paddr = ALIGN_ABOVE(p.paddr, HPAGE_SIZE);
+	block->size = HPAGE_SIZE;
+	if (block->paddr != p.paddr) {
+		slack.paddr = p.paddr;
+		slack.size = block->paddr - p.paddr;
+		free_pages(&slack);
+	}
+	if (block->paddr + HPAGE_SIZE != end) {
+		slack.paddr = block->paddr + HPAGE_SIZE;
+		slack.size = end - slack.paddr;
+		free_pages(&slack);
+	}
+	return 0;
+}
+
+static struct vma *__vma_at(struct mm *mm, void *addr)
+{
+	struct vma *vma;
+
+	for_each_entry (vma, &(mm->vma_head), node) {
+		if (vma->start == addr)
+			return vma;
+		if (vma->start > addr)
+			break;
+	}
+	return NULL;
+}
+
+/* The VMA starting the block of @vma, if it is there */
+static struct vma *__block_first(struct mm *mm, struct vma *vma)
+{
+	void *base = PTR_ALIGN_BELOW(vma->start, HPAGE_SIZE);
+
+	while (vma->start != base) {
+		if (vma->node.prev == &(mm->vma_head))
+			return NULL;
+		vma = prev_entry(vma, node);
+		if (vma->start < base)
+			return NULL;
+	}
+	return vma;
+}
+
+/* Put isolated @vma back the way reclaim had it, as an active page */
+static void __untake(struct vma *vma, unsigned int state)
+{
+	if (state == VMA_LRU_INACTIVE)
+		assert(map_pages(vma->mm->pgindex, vma->start,
+		    vma->pages->paddr, vma->size, vma->flags) == 0);
+	reclaim_track(vma);
+}
+
+static int __collapse(struct mm *mm, struct vma *first)
+{
+	struct vma *vma, *stop;
+	struct pages block;
+	unsigned int state = VMA_LRU_NONE;
+	addr_t pcur;
+	size_t i;
+
+	/* private anonymous pages, all resident, with the same protection */
+	vma = first;
+	for (i = 0; i < HPAGE_NR_PAGES; ++i, vma = next_entry(vma, node)) {
+		if (&(vma->node) == &(mm->vma_head) ||
+		    vma->start != first->start + i * PAGE_SIZE ||
+		    vma->flags != first->flags ||
+		    (vma->flags & (VMA_FILE | VMA_MERGEABLE)) ||
+		    vma->lru != VMA_LRU_ACTIVE ||
+		    vma->pages->refs != 1)
+			return -EINVAL;
+	}
+
+	if (__alloc_block(&block) != 0)
+		return -ENOMEM;
+
+	/* reclaim may have moved some pages since we looked */
+	vma = first;
+	for (i = 0; i < HPAGE_NR_PAGES; ++i, vma = next_entry(vma, node)) {
+		state = reclaim_isolate(vma);
+		if (state != VMA_LRU_ACTIVE)
+			goto rollback;
+	}
+
+	/*
+	 * Nobody may write to the old frames through a stale TLB entry once
+	 * we copy them, or reuse them while such entries are around.
+	 */
+	unmap_pages(mm->pgindex, first->start, HPAGE_SIZE, NULL);
+	mm_forget_tlb(mm);
+
+	vma = first;
+	pcur = block.paddr;
+	for (i = 0; i < HPAGE_NR_PAGES; ++i, vma = next_entry(vma, node)) {
+		memcpy(__kva(pcur), __kva(vma->pages->paddr), PAGE_SIZE);
+		free_pages(vma->pages);
+		vma->pages->paddr = pcur;
+		vma->lru = VMA_LRU_HUGE;
+		pcur += PAGE_SIZE;
+	}
+	assert(map_pages(mm->pgindex, first->start, block.paddr, HPAGE_SIZE,
+	    first->flags | MAP_LARGE) == 0);
+	/* MIPS may have cached the invalid entries since */
+	mm_forget_tlb(mm);
+	return 0;
+
+rollback:
+	stop = vma;
+	if (state != VMA_LRU_NONE)
+		__untake(stop, state);
+	for (vma = first; vma != stop; vma = next_entry(vma, node))
+		reclaim_track(vma);
+	free_pages(&block);
+	return -EBUSY;
+}
+
+void hugepage_fault(struct mm *mm, struct vma *vma)
+{
+	struct vma *first;
+
+	if (vma->lru != VMA_LRU_ACTIVE ||
+	    !PTR_IS_ALIGNED(vma->start + PAGE_SIZE, HPAGE_SIZE))
+		return;
+	if ((first = __block_first(mm, vma)) != NULL)
+		__collapse(mm, first);
+}
+
+int hugepage_collapse(struct mm *mm, void *addr, size_t len)
+{
+	struct vma *first;
+	void *base, *end = addr + len;
+	int nr = 0;
+
+	for (base = PTR_ALIGN_ABOVE(addr, HPAGE_SIZE);
+	    base + HPAGE_SIZE <= end; base += HPAGE_SIZE) {
+		first = __vma_at(mm, base);
+		if (first != NULL && __collapse(mm, first) == 0)
+			++nr;
+	}
+	return nr;
+}
+
+void hugepage_split_at(struct mm *mm, void *addr)
+{
+	struct vma *vma;
+	size_t i;
+
+	if (PTR_IS_ALIGNED(addr, HPAGE_SIZE))
+		return;
+	vma = __vma_at(mm, PTR_ALIGN_BELOW(addr, HPAGE_SIZE));
+	if (vma == NULL || vma->lru != VMA_LRU_HUGE)
+		return;
+
+	for (i = 0; i < HPAGE_NR_PAGES; ++i, vma = next_entry(vma, node))
+		reclaim_track(vma);
+}
+
+#endif /* HPAGE_SIZE */
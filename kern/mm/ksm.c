@@ -0,0 +1,378 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <aim/initcalls.h>
+#include <aim/sync.h>
+#include <atomic.h>
+#include <ipi.h>
+#include <ksm.h>
+#include <list.h>
+#include <mm.h>
+#include <mmu.h>
+#include <panic.h>
+#include <pmm.h>
+#include <vmm.h>
+#include <libc/string.h>
+
+/*
+ * Same-page merging.
+ *
+ * Candidates are scanned round robin, a budget at a time.  A page is only
+ * considered once its checksum held still for a whole pass, as pages
+ * being written to would be unshared right away anyway.
+ *
+ * Shared frames live in the stable table.  The table holds a reference to
+ * each, so struct pages stays around while VMAs come and go, and frames
+ * nobody maps any more are dropped at the end of a pass.
+ *
+ * Pages seen during the current pass wait in the unstable table, which is
+ * thrown away at the end of each pass.  When a second page with the same
+ * contents shows up, the first one becomes a stable frame.
+ *
+ * Merged pages are mapped read-only and are not reclaimable.  A write
+ * fault gives the writer a private copy again, see __cow_fault() in uvm.c.
+ *
+ * TLB shootdowns wait for the other CPUs, which would never answer while
+ * spinning on __ksm_lock, so the scanner drops the lock for them.  Only
+ * one scan runs at a time, and the VMAs it works on are marked busy
+ * meanwhile: ksm_forget() waits for them, answering cross-calls.
+ */
+
+#define KSM_HASH_BITS	8
+#define KSM_HASH_SIZE	(1 << KSM_HASH_BITS)
+#define ksm_bucket(hash)	((hash) & (KSM_HASH_SIZE - 1))
+
+struct ksm_stable {
+	uint32_t	hash;
+	struct pages	*pages;
+	struct list_head node;
+};
+
+static lock_t __ksm_lock = UNLOCKED;
+static bool __ksm_enabled;
+static struct list_head __scan_list = EMPTY_LIST(__scan_list);
+static size_t __nr_candidates;
+static size_t __pass_left;	/* candidates not yet seen in this pass */
+static bool __in_pass;
+static struct list_head __stable[KSM_HASH_SIZE];
+static struct list_head __unstable[KSM_HASH_SIZE];
+static struct ksm_stats __stats;
+static bool __scanning;
+static struct vma *__busy[2];	/* the page scanned, and its peer */
+
+static inline void *__kva(struct pages *pages)
+{
+	return (void *)pa2kva((size_t)pages->paddr);
+}
+
+/* FNV-1a over words */
+static uint32_t __page_hash(void *kva)
+{
+	uint32_t *word = kva, hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); ++i) {
+		hash ^= word[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+void ksm_track(struct vma *vma)
+{
+	spin_lock(&__ksm_lock);
+	list_add_tail(&vma->ksm_node, &__scan_list);
+	list_init(&vma->ksm_hash_node);
+	vma->ksm_hash = 0;
+	++__nr_candidates;
+	spin_unlock(&__ksm_lock);
+}
+
+void ksm_forget(struct vma *vma)
+{
+	spin_lock(&__ksm_lock);
+	while (vma == __busy[0] || vma == __busy[1]) {
+		spin_unlock(&__ksm_lock);
+		ipi_handler();
+		spin_lock(&__ksm_lock);
+	}
+	list_del(&vma->ksm_node);
+	if (!list_empty(&vma->ksm_hash_node))
+		list_del(&vma->ksm_hash_node);
+	--__nr_candidates;
+	spin_unlock(&__ksm_lock);
+}
+
+/* Called and returns with __ksm_lock held, see above */
+static void __forget_tlb(struct mm *mm)
+{
+	spin_unlock(&__ksm_lock);
+	mm_forget_tlb(mm);
+	spin_lock(&__ksm_lock);
+}
+
+/*
+ * Take @vma off reclaim and make it read-only, so that its contents stay
+ * put while we look at them.  Returns false if it has no frame any more.
+ */
+static bool __freeze(struct vma *vma, unsigned int *state)
+{
+	*state = reclaim_isolate(vma);
+	switch (*state) {
+	case VMA_LRU_ACTIVE:
+		protect_pages(vma->mm->pgindex, vma->start, vma->size,
+		    vma->flags & ~VMA_WRITE);
+		__forget_tlb(vma->mm);
+		return true;
+	case VMA_LRU_INACTIVE:
+		/* not mapped, nobody can write */
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Undo __freeze() */
+static void __thaw(struct vma *vma, unsigned int state)
+{
+	if (state == VMA_LRU_ACTIVE)
+		protect_pages(vma->mm->pgindex, vma->start, vma->size,
+		    vma->flags);
+	else
+		assert(map_pages(vma->mm->pgindex, vma->start,
+		    vma->pages->paddr, vma->size, vma->flags) == 0);
+	reclaim_track(vma);
+}
+
+/* Replace the private frame of frozen @vma with @stable, read-only */
+static void __replace(struct vma *vma, unsigned int state,
+    struct pages *stable)
+{
+	struct pages *old = vma->pages;
+
+	if (state == VMA_LRU_ACTIVE)
+		unmap_pages(vma->mm->pgindex, vma->start, vma->size, NULL);
+	assert(map_pages(vma->mm->pgindex, vma->start, stable->paddr,
+	    vma->size, vma->flags & ~VMA_WRITE) == 0);
+	__forget_tlb(vma->mm);
+
+	atomic_inc(&stable->refs);
+	vma->pages = stable;
+	free_pages(old);
+	kfree(old);
+	++__stats.pages_merged;
+}
+
+static bool __merge(struct vma *vma, struct pages *stable)
+{
+	unsigned int state;
+
+	if (!__freeze(vma, &state))
+		return false;
+	if (memcmp(__kva(vma->pages), __kva(stable), PAGE_SIZE) != 0) {
+		__thaw(vma, state);
+		return false;
+	}
+	__replace(vma, state, stable);
+	return true;
+}
+
+/* Turn the frame of @peer into a stable frame, shared with @vma */
+static bool __promote(struct vma *peer, struct vma *vma, uint32_t hash)
+{
+	struct ksm_stable *st;
+	unsigned int state, peer_state;
+
+	st = kmalloc(sizeof(*st), 0);
+	if (st == NULL)
+		return false;
+	__busy[1] = peer;
+	if (!__freeze(peer, &peer_state))
+		goto free_st;
+	if (!__freeze(vma, &state))
+		goto thaw_peer;
+	if (memcmp(__kva(peer->pages), __kva(vma->pages), PAGE_SIZE) != 0)
+		goto thaw_vma;
+
+	/* @peer keeps its frame, read-only from now on */
+	if (peer_state == VMA_LRU_INACTIVE)
+		assert(map_pages(peer->mm->pgindex, peer->start,
+		    peer->pages->paddr, peer->size,
+		    peer->flags & ~VMA_WRITE) == 0);
+	st->hash = hash;
+	st->pages = peer->pages;
+	atomic_inc(&st->pages->refs);
+	list_add(&st->node, &__stable[ksm_bucket(hash)]);
+
+	__replace(vma, state, st->pages);
+	__busy[1] = NULL;
+	return true;
+
+thaw_vma:
+	__thaw(vma, state);
+thaw_peer:
+	__thaw(peer, peer_state);
+free_st:
+	__busy[1] = NULL;
+	kfree(st);
+	return false;
+}
+
+static bool __scan_one(struct vma *vma)
+{
+	struct ksm_stable *st;
+	struct vma *peer;
+	uint32_t hash;
+
+	/* private frames only, merged pages are shared already */
+	if ((vma->lru != VMA_LRU_ACTIVE && vma->lru != VMA_LRU_INACTIVE) ||
+	    vma->pages->refs != 1)
+		return false;
+	++__stats.pages_scanned;
+
+	hash = __page_hash(__kva(vma->pages));
+	if (hash != vma->ksm_hash) {
+		vma->ksm_hash = hash;
+		return false;
+	}
+
+	for_each_entry (st, &__stable[ksm_bucket(hash)], node) {
+		if (st->hash == hash && __merge(vma, st->pages))
+			goto merged;
+	}
+	for_each_entry (peer, &__unstable[ksm_bucket(hash)], ksm_hash_node) {
+		if (peer->ksm_hash != hash || peer == vma ||
+		    peer->pages->refs != 1)
+			continue;
+		if (__promote(peer, vma, hash)) {
+			list_del_init(&peer->ksm_hash_node);
+			goto merged;
+		}
+	}
+
+	if (list_empty(&vma->ksm_hash_node))
+		list_add(&vma->ksm_hash_node, &__unstable[ksm_bucket(hash)]);
+	return false;
+
+merged:
+	if (!list_empty(&vma->ksm_hash_node))
+		list_del_init(&vma->ksm_hash_node);
+	return true;
+}
+
+static void __new_pass(void)
+{
+	struct ksm_stable *st, *st_next;
+	struct vma *vma, *vma_next;
+	int i;
+
+	for (i = 0; i < KSM_HASH_SIZE; ++i) {
+		for_each_entry_safe (vma, vma_next, &__unstable[i],
+		    ksm_hash_node)
+			list_del_init(&vma->ksm_hash_node);
+		/* frames only the table refers to */
+		for_each_entry_safe (st, st_next, &__stable[i], node) {
+			if (st->pages->refs != 1)
+				continue;
+			list_del(&st->node);
+			free_pages(st->pages);
+			kfree(st->pages);
+			kfree(st);
+		}
+	}
+
+	if (__in_pass)
+		++__stats.full_scans;
+	__in_pass = true;
+	__pass_left = __nr_candidates;
+}
+
+size_t ksm_scan(size_t budget)
+{
+	struct vma *vma;
+	size_t merged = 0;
+
+	spin_lock(&__ksm_lock);
+	if (!__ksm_enabled || __scanning)
+		goto out;
+	__scanning = true;
+
+	for (; budget > 0 && !list_empty(&__scan_list); --budget) {
+		if (__pass_left == 0)
+			__new_pass();
+		vma = list_first_entry(&__scan_list, struct vma, ksm_node);
+		list_del(&vma->ksm_node);
+		list_add_tail(&vma->ksm_node, &__scan_list);
+		--__pass_left;
+		__busy[0] = vma;
+		if (__scan_one(vma))
+			++merged;
+		__busy[0] = NULL;
+	}
+	__scanning = false;
+
+out:
+	spin_unlock(&__ksm_lock);
+	return merged;
+}
+
+void ksm_set_enabled(bool enabled)
+{
+	spin_lock(&__ksm_lock);
+	__ksm_enabled = enabled;
+	spin_unlock(&__ksm_lock);
+}
+
+void ksm_get_stats(struct ksm_stats *stats)
+{
+	struct ksm_stable *st;
+	int i;
+
+	spin_lock(&__ksm_lock);
+	*stats = __stats;
+	stats->pages_shared = 0;
+	stats->pages_sharing = 0;
+	for (i = 0; i < KSM_HASH_SIZE; ++i) {
+		for_each_entry (st, &__stable[i], node) {
+			/* the table holds one reference */
+			if (st->pages->refs <= 1)
+				continue;
+			++stats->pages_shared;
+			stats->pages_sharing += st->pages->refs - 1;
+		}
+	}
+	spin_unlock(&__ksm_lock);
+}
+
+static int __init(void)
+{
+	int i;
+
+	for (i = 0; i < KSM_HASH_SIZE; ++i) {
+		list_init(&__stable[i]);
+		list_init(&__unstable[i]);
+	}
+	return 0;
+}
+
+INITCALL_CORE(__init)
@@ -117,6 +117,12 @@ size_t early_mapping_add_kmmap(addr_t base, size_t size)
 	return __kmmap_top - size;
 }
 
+/* first address above all kmmap mappings registered so far */
+size_t early_mapping_kmmap_top(void)
+{
+	return __kmmap_top;
+}
+
 /*
  * basic iterator. Caller should not work with internal data structure.
  * If given a pointer to some early mapping entry, return the next one.
@@ -142,6 +148,12 @@ struct early_mapping *early_mapping_next(struct early_mapping *base)
 	}
 }
 
+pgindex_t *kern_pgindex(void)
+{
+	extern pgindex_t boot_page_index;
+	return (pgindex_t *)postmap_addr(&boot_page_index);
+}
+
 int page_index_init(pgindex_t *boot_page_index)
 {
 	struct early_mapping *mapping = early_mapping_next(NULL);
@@ -0,0 +1,273 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <aim/initcalls.h>
+#include <aim/sync.h>
+#include <atomic.h>
+#include <errno.h>
+#include <file.h>
+#include <list.h>
+#include <mm.h>
+#include <pagecache.h>
+#include <pmm.h>
+#include <util.h>
+#include <vmm.h>
+#include <libc/string.h>
+
+/*
+ * Cached pages are hashed by the file they belong to and their offset.
+ * Files are identified by their inode, which each cached page pins with a
+ * reference so that it cannot be reused for another file meanwhile.
+ * Device files have no inode yet, but their file_ops are per device, so
+ * those are used instead.
+ *
+ * I/O is done without __cache_lock held, so that reading a page may
+ * reclaim memory, and that reclaim may shrink the cache.  Two users
+ * faulting the same page at once may both read it; the second copy is
+ * thrown away.
+ */
+
+#define PAGECACHE_HASH_SIZE	256
+
+struct cached_page {
+	struct pages	pages;
+	void		*mapping;
+	struct inode	*inode;		/* referenced, NULL for devices */
+	loff_t		offset;
+	size_t		size;		/* bytes before the end of file */
+	bool		dirty;
+	struct list_head node;
+};
+
+static lock_t __cache_lock = UNLOCKED;
+static struct list_head __hash[PAGECACHE_HASH_SIZE];
+
+static inline void *__mapping(struct file *file)
+{
+	return (file->inode != NULL) ?
+	    (void *)file->inode : (void *)file->file_ops;
+}
+
+static inline struct list_head *__bucket(void *mapping, loff_t offset)
+{
+	size_t hash = (size_t)mapping / sizeof(void *) +
+	    (size_t)(offset / PAGE_SIZE);
+
+	return &__hash[hash % PAGECACHE_HASH_SIZE];
+}
+
+static inline struct cached_page *__cached(struct pages *pages)
+{
+	return container_of(pages, struct cached_page, pages);
+}
+
+static inline void *__kva(struct cached_page *cp)
+{
+	return (void *)pa2kva((size_t)cp->pages.paddr);
+}
+
+static struct cached_page *__lookup(void *mapping, loff_t offset)
+{
+	struct cached_page *cp;
+
+	for_each_entry (cp, __bucket(mapping, offset), node) {
+		if (cp->mapping == mapping && cp->offset == offset)
+			return cp;
+	}
+	return NULL;
+}
+
+static void __free(struct cached_page *cp)
+{
+	if (cp->inode != NULL)
+		atomic_dec(&cp->inode->refs);
+	free_pages(&cp->pages);
+	kfree(cp);
+}
+
+/*
+ * Read a new page in, outside the cache.  Whatever lies past the end of
+ * the file reads as zeros.  Returns the number of bytes that came from
+ * the file, or negative.
+ */
+static ssize_t __read(struct file *file, loff_t offset,
+    struct cached_page **cpp)
+{
+	struct cached_page *cp;
+	loff_t pos = offset;
+	ssize_t ret;
+
+	cp = kmalloc(sizeof(*cp), 0);
+	if (cp == NULL)
+		return -ENOMEM;
+	cp->pages.size = PAGE_SIZE;
+	cp->pages.flags = 0;
+	cp->pages.refs = 1;
+	if (alloc_pages_reclaim(&cp->pages) < 0) {
+		kfree(cp);
+		return -ENOMEM;
+	}
+	cp->mapping = __mapping(file);
+	cp->inode = NULL;
+	cp->offset = offset;
+	cp->dirty = false;
+
+	ret = file->file_ops->read(file, __kva(cp), PAGE_SIZE, &pos);
+	if (ret < 0) {
+		__free(cp);
+		return -EIO;
+	}
+	memset(__kva(cp) + ret, 0, PAGE_SIZE - ret);
+	cp->size = ret;
+	*cpp = cp;
+	return ret;
+}
+
+/*
+ * Look @offset up, reading it in if needed, and take a reference to it.
+ * Returns the bytes before the end of file in the page, or negative.
+ * If @cpp is NULL, no reference is taken: the page is only brought into
+ * the cache, and nothing is cached at or past the end of file.
+ */
+static ssize_t __get(struct file *file, loff_t offset,
+    struct cached_page **cpp)
+{
+	struct cached_page *cp, *fresh;
+	void *mapping = __mapping(file);
+	ssize_t ret;
+
+	spin_lock(&__cache_lock);
+	cp = __lookup(mapping, offset);
+	if (cp != NULL) {
+		if (cpp != NULL) {
+			atomic_inc(&cp->pages.refs);
+			*cpp = cp;
+		}
+		spin_unlock(&__cache_lock);
+		return cp->size;
+	}
+	spin_unlock(&__cache_lock);
+
+	if ((ret = __read(file, offset, &fresh)) < 0)
+		return ret;
+	if (ret == 0 && cpp == NULL) {
+		__free(fresh);
+		return 0;
+	}
+
+	spin_lock(&__cache_lock);
+	cp = __lookup(mapping, offset);
+	if (cp == NULL) {
+		cp = fresh;
+		cp->inode = file->inode;
+		if (cp->inode != NULL)
+			atomic_inc(&cp->inode->refs);
+		list_add(&cp->node, __bucket(mapping, offset));
+		fresh = NULL;
+	}
+	ret = cp->size;
+	if (cpp != NULL) {
+		atomic_inc(&cp->pages.refs);
+		*cpp = cp;
+	}
+	spin_unlock(&__cache_lock);
+
+	if (fresh != NULL)
+		__free(fresh);
+	return ret;
+}
+
+struct pages *pagecache_get(struct file *file, loff_t offset)
+{
+	struct cached_page *cp;
+
+	if (__get(file, offset, &cp) < 0)
+		return NULL;
+	return &cp->pages;
+}
+
+void pagecache_readahead(struct file *file, loff_t offset, size_t nr)
+{
+	ssize_t ret;
+
+	for (; nr > 0; --nr, offset += PAGE_SIZE) {
+		ret = __get(file, offset, NULL);
+		/* nothing to read ahead past the end of file */
+		if (ret < PAGE_SIZE)
+			break;
+	}
+}
+
+void pagecache_dirty(struct pages *pages)
+{
+	__cached(pages)->dirty = true;
+}
+
+int pagecache_writeback(struct file *file, struct pages *pages)
+{
+	struct cached_page *cp = __cached(pages);
+	loff_t pos = cp->offset;
+
+	if (!cp->dirty)
+		return 0;
+	/* stores past the end of file are dropped, as they would be anyway */
+	if (cp->size > 0 &&
+	    file->file_ops->write(file, __kva(cp), cp->size, &pos) < 0)
+		return -EIO;
+	/* others may still be writing through their mappings */
+	if (pages->refs <= 2)
+		cp->dirty = false;
+	return 0;
+}
+
+size_t pagecache_shrink(size_t nr)
+{
+	struct cached_page *cp, *cp_next;
+	size_t freed = 0;
+	int i;
+
+	spin_lock(&__cache_lock);
+	for (i = 0; i < PAGECACHE_HASH_SIZE && freed < nr; ++i) {
+		for_each_entry_safe (cp, cp_next, &__hash[i], node) {
+			if (cp->pages.refs != 1 || cp->dirty)
+				continue;
+			list_del(&cp->node);
+			__free(cp);
+			if (++freed == nr)
+				break;
+		}
+	}
+	spin_unlock(&__cache_lock);
+	return freed;
+}
+
+static int __init(void)
+{
+	int i;
+
+	for (i = 0; i < PAGECACHE_HASH_SIZE; ++i)
+		list_init(&__hash[i]);
+	return 0;
+}
+
+INITCALL_CORE(__init)
@@ -0,0 +1,71 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <mm.h>
+#include <mmu.h>
+#include <panic.h>
+#include <percpu.h>
+#include <pmm.h>
+#include <smp.h>
+#include <util.h>
+#include <libc/string.h>
+
+/* not DEFINE_PER_CPU(), as it goes first */
+__attribute__((__section__(".data.percpu.first")))
+struct percpu cpu_data;
+
+/* The boot CPU keeps offset 0, so this is right before percpu_init() */
+unsigned long __percpu_offset[NR_CPUS];
+
+void percpu_init(void)
+{
+	size_t size = __percpu_end - __percpu_start;
+	struct pages p;
+	unsigned int boot = cpuid();
+	char *copy;
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; ++cpu) {
+		if (cpu == boot)
+			continue;
+		/* pages, so that cache line alignment carries over */
+		p.size = ALIGN_ABOVE(size, PAGE_SIZE);
+		p.flags = 0;
+		if (alloc_pages(&p) != 0)
+			panic("percpu: no memory for CPU %d\n", cpu);
+		copy = (char *)pa2kva((size_t)p.paddr);
+		memcpy(copy, __percpu_start, size);
+		__percpu_offset[cpu] = copy - __percpu_start;
+	}
+
+	for (cpu = 0; cpu < NR_CPUS; ++cpu) {
+		per_cpu(cpu_data, cpu).offset = __percpu_offset[cpu];
+		per_cpu(cpu_data, cpu).cpu = cpu;
+	}
+	percpu_load();
+}
+
+void percpu_load(void)
+{
+	arch_percpu_load(__percpu_offset[cpuid()]);
+}
@@ -0,0 +1,347 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <aim/sync.h>
+#include <errno.h>
+#include <ipi.h>
+#include <list.h>
+#include <mm.h>
+#include <mmu.h>
+#include <pagecache.h>
+#include <pmm.h>
+#include <swap.h>
+#include <util.h>
+
+/*
+ * Anonymous page reclaim, a two-list second chance scheme.
+ *
+ * Neither MIPS nor our ARM page tables have an accessed bit, so references
+ * are detected in software everywhere: pages moving from the active to the
+ * inactive list are unmapped while keeping their frames.  Touching
+ * such a page faults it right back onto the active list, which is its
+ * second chance.  Pages reaching the tail of the inactive list untouched
+ * are written to swap and lose their frames.
+ *
+ * Each tracked VMA is exactly one page, see create_uvm().
+ *
+ * __lru_lock is dropped for swap I/O and for TLB shootdowns, which wait
+ * for the other CPUs and would never finish if one of them were spinning
+ * on the lock.  Pages in flight are off the lists in state VMA_LRU_IO,
+ * and whoever else wants them waits, answering cross-calls meanwhile.
+ */
+
+/* pages moved to the inactive list at a time */
+#define RECLAIM_BATCH	32
+
+static lock_t __lru_lock = UNLOCKED;
+static struct list_head __active = EMPTY_LIST(__active);
+static struct list_head __inactive = EMPTY_LIST(__inactive);
+static size_t __nr_active;
+static size_t __nr_inactive;
+
+static inline void *__frame_kva(struct vma *vma)
+{
+	return (void *)pa2kva((size_t)vma->pages->paddr);
+}
+
+static inline struct vma *__lru_tail(struct list_head *list)
+{
+	return list_entry(list->prev, struct vma, lru_node);
+}
+
+/*
+ * Wait until swap I/O on @vma is over.  Called and returns with __lru_lock
+ * held, which is dropped meanwhile.
+ */
+static void __wait_io(struct vma *vma)
+{
+	while (vma->lru == VMA_LRU_IO) {
+		spin_unlock(&__lru_lock);
+		/* whoever has it may be shooting down our TLB */
+		ipi_handler();
+		spin_lock(&__lru_lock);
+	}
+}
+
+void reclaim_track(struct vma *vma)
+{
+	spin_lock(&__lru_lock);
+	vma->lru = VMA_LRU_ACTIVE;
+	vma->swap = 0;
+	list_add(&vma->lru_node, &__active);
+	++__nr_active;
+	spin_unlock(&__lru_lock);
+}
+
+unsigned int reclaim_forget(struct vma *vma)
+{
+	unsigned int state;
+
+	spin_lock(&__lru_lock);
+	__wait_io(vma);
+	state = vma->lru;
+	switch (state) {
+	case VMA_LRU_ACTIVE:
+		list_del(&vma->lru_node);
+		--__nr_active;
+		break;
+	case VMA_LRU_INACTIVE:
+		list_del(&vma->lru_node);
+		--__nr_inactive;
+		break;
+	case VMA_LRU_SWAPPED:
+		swap_free(vma->swap);
+		vma->swap = 0;
+		break;
+	}
+	vma->lru = VMA_LRU_NONE;
+	spin_unlock(&__lru_lock);
+	return state;
+}
+
+unsigned int reclaim_isolate(struct vma *vma)
+{
+	unsigned int state;
+
+	spin_lock(&__lru_lock);
+	state = vma->lru;
+	switch (state) {
+	case VMA_LRU_ACTIVE:
+		--__nr_active;
+		break;
+	case VMA_LRU_INACTIVE:
+		--__nr_inactive;
+		break;
+	default:
+		spin_unlock(&__lru_lock);
+		return VMA_LRU_NONE;
+	}
+	list_del(&vma->lru_node);
+	vma->lru = VMA_LRU_NONE;
+	spin_unlock(&__lru_lock);
+	return state;
+}
+
+/*
+ * Move up to RECLAIM_BATCH of the oldest active pages to the inactive
+ * list.  The pages are unmapped first, and each mm they belong to has its
+ * TLBs shot down once, with __lru_lock dropped.
+ */
+static void __deactivate(void)
+{
+	struct list_head batch = EMPTY_LIST(batch);
+	struct mm *mms[RECLAIM_BATCH];
+	struct vma *vma, *next;
+	int nr, nr_mms = 0, i;
+
+	for (nr = 0; nr < RECLAIM_BATCH && !list_empty(&__active); ++nr) {
+		vma = __lru_tail(&__active);
+		list_del(&vma->lru_node);
+		--__nr_active;
+
+		unmap_pages(vma->mm->pgindex, vma->start, vma->size, NULL);
+		vma->lru = VMA_LRU_IO;
+		list_add_tail(&vma->lru_node, &batch);
+
+		for (i = 0; i < nr_mms && mms[i] != vma->mm; ++i)
+			/* nothing */;
+		if (i == nr_mms)
+			mms[nr_mms++] = vma->mm;
+	}
+	if (nr == 0)
+		return;
+
+	spin_unlock(&__lru_lock);
+	for (i = 0; i < nr_mms; ++i)
+		mm_forget_tlb(mms[i]);
+	spin_lock(&__lru_lock);
+
+	for_each_entry_safe (vma, next, &batch, lru_node) {
+		list_del(&vma->lru_node);
+		vma->lru = VMA_LRU_INACTIVE;
+		list_add(&vma->lru_node, &__inactive);
+		++__nr_inactive;
+	}
+}
+
+/*
+ * Write inactive @vma to swap and free its frame.  Called with __lru_lock
+ * held, which is dropped during the write.
+ */
+static int __evict(struct vma *vma)
+{
+	unsigned long slot;
+	int ret;
+
+	slot = swap_alloc();
+	if (slot == 0)
+		return -ENOMEM;
+
+	list_del(&vma->lru_node);
+	--__nr_inactive;
+	vma->lru = VMA_LRU_IO;
+	spin_unlock(&__lru_lock);
+	ret = swap_write(slot, __frame_kva(vma));
+	spin_lock(&__lru_lock);
+
+	/* the frame may have been shared meanwhile, keep it then */
+	if (ret != 0 || vma->pages->refs != 1) {
+		swap_free(slot);
+		vma->lru = VMA_LRU_INACTIVE;
+		list_add_tail(&vma->lru_node, &__inactive);
+		++__nr_inactive;
+		return (ret != 0) ? -EIO : -EBUSY;
+	}
+
+	free_pages(vma->pages);
+	vma->pages->paddr = 0;
+	vma->swap = slot;
+	vma->lru = VMA_LRU_SWAPPED;
+	return 0;
+}
+
+size_t reclaim_pages(size_t nr)
+{
+	struct vma *vma;
+	size_t freed = 0, scan;
+	int ret;
+
+	spin_lock(&__lru_lock);
+	/* every page gets looked at twice at most */
+	scan = (__nr_active + __nr_inactive) * 2;
+	for (; freed < nr && scan > 0; --scan) {
+		/*
+		 * Keep a third of the pages inactive, so that they have some
+		 * time to prove themselves before reaching the tail.
+		 */
+		if (__nr_inactive * 2 < __nr_active || list_empty(&__inactive))
+			__deactivate();
+		if (list_empty(&__inactive))
+			break;
+
+		vma = __lru_tail(&__inactive);
+		if (vma->pages->refs != 1) {
+			/* shared frames stay, rotate */
+			list_del(&vma->lru_node);
+			list_add(&vma->lru_node, &__inactive);
+			continue;
+		}
+		ret = __evict(vma);
+		if (ret == -EBUSY)
+			continue;
+		if (ret != 0)
+			/* swap is full, off or broken */
+			break;
+		++freed;
+	}
+	spin_unlock(&__lru_lock);
+
+	return freed;
+}
+
+int alloc_pages_reclaim(struct pages *pages)
+{
+	size_t nr = max2(pages->size / PAGE_SIZE, RECLAIM_BATCH);
+
+	if (alloc_pages(pages) == 0)
+		return 0;
+	/* clean file pages can be read again, drop those first */
+	if (pagecache_shrink(nr) == 0 && reclaim_pages(nr) == 0)
+		return EOF;
+	return alloc_pages(pages);
+}
+
+static int __swap_in(struct vma *vma)
+{
+	struct pages p = { .size = PAGE_SIZE, .flags = 0 };
+	int ret;
+
+	/* reclaim takes __lru_lock, so get the frame first */
+	spin_unlock(&__lru_lock);
+	ret = alloc_pages_reclaim(&p);
+	spin_lock(&__lru_lock);
+	if (ret != 0)
+		return -ENOMEM;
+
+	/* someone else may have brought it back meanwhile */
+	__wait_io(vma);
+	if (vma->lru != VMA_LRU_SWAPPED) {
+		free_pages(&p);
+		return 0;
+	}
+
+	vma->pages->paddr = p.paddr;
+	vma->lru = VMA_LRU_IO;
+	spin_unlock(&__lru_lock);
+	ret = swap_read(vma->swap, __frame_kva(vma));
+	spin_lock(&__lru_lock);
+	if (ret != 0) {
+		ret = -EIO;
+		goto rollback;
+	}
+	ret = map_pages(vma->mm->pgindex, vma->start, p.paddr, vma->size,
+	    vma->flags);
+	if (ret < 0)
+		goto rollback;
+
+	swap_free(vma->swap);
+	vma->swap = 0;
+	vma->lru = VMA_LRU_ACTIVE;
+	list_add(&vma->lru_node, &__active);
+	++__nr_active;
+	return 0;
+
+rollback:
+	vma->lru = VMA_LRU_SWAPPED;
+	vma->pages->paddr = 0;
+	free_pages(&p);
+	return ret;
+}
+
+int reclaim_fault(struct vma *vma)
+{
+	int ret = 0;
+
+	spin_lock(&__lru_lock);
+	__wait_io(vma);
+	switch (vma->lru) {
+	case VMA_LRU_INACTIVE:
+		/* referenced again, the frame is still there */
+		ret = map_pages(vma->mm->pgindex, vma->start,
+		    vma->pages->paddr, vma->size, vma->flags);
+		if (ret < 0)
+			break;
+		list_del(&vma->lru_node);
+		--__nr_inactive;
+		vma->lru = VMA_LRU_ACTIVE;
+		list_add(&vma->lru_node, &__active);
+		++__nr_active;
+		break;
+	case VMA_LRU_SWAPPED:
+		ret = __swap_in(vma);
+		break;
+	}
+	spin_unlock(&__lru_lock);
+
+	return ret;
+}
@@ -0,0 +1,180 @@
+/* Copyright (C) 2016 Gan Quan <coin2028@hotmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <aim/device.h>
+#include <aim/sync.h>
+#include <bootsect.h>
+#include <console.h>
+#include <errno.h>
+#include <file.h>
+#include <mm.h>
+#include <pmm.h>
+#include <swap.h>
+#include <util.h>
+#include <vmm.h>
+#include <libc/string.h>
+
+static struct {
+	struct blk_device *dev;
+	struct file	file;		/* handle for blk_ops */
+	loff_t		offset;		/* of slot 1 on the device */
+	size_t		nr_slots;
+	unsigned long	*map;		/* bit set for slots in use */
+	unsigned long	next;		/* where to start looking */
+	lock_t		lock;
+} __swap = {
+	.lock = UNLOCKED
+};
+
+int swap_on(struct blk_device *dev, loff_t offset, size_t size)
+{
+	size_t nr_slots = size / PAGE_SIZE;
+	size_t words = ALIGN_ABOVE(nr_slots, BITS_PER_LONG) / BITS_PER_LONG;
+	unsigned long *map;
+
+	if (dev == NULL || nr_slots == 0 ||
+	    dev->blk_ops.readblk == NULL || dev->blk_ops.writeblk == NULL)
+		return -EINVAL;
+
+	map = kmalloc(words * sizeof(unsigned long), 0);
+	if (map == NULL)
+		return -ENOMEM;
+	memset(map, 0, words * sizeof(unsigned long));
+
+	spin_lock(&__swap.lock);
+	if (__swap.dev != NULL) {
+		spin_unlock(&__swap.lock);
+		kfree(map);
+		return -EEXIST;
+	}
+	__swap.file.pos = 0;
+	__swap.file.inode = NULL;
+	__swap.file.file_ops = &dev->file_ops;
+	__swap.offset = offset;
+	__swap.nr_slots = nr_slots;
+	__swap.map = map;
+	__swap.next = 0;
+	__swap.dev = dev;
+	spin_unlock(&__swap.lock);
+	return 0;
+}
+
+unsigned long swap_alloc(void)
+{
+	unsigned long i, bit, *word;
+
+	spin_lock(&__swap.lock);
+	for (i = 0; i < __swap.nr_slots; ++i) {
+		if (++__swap.next >= __swap.nr_slots)
+			__swap.next = 0;
+		word = &__swap.map[__swap.next / BITS_PER_LONG];
+		bit = 1UL << (__swap.next % BITS_PER_LONG);
+		if (!(*word & bit)) {
+			*word |= bit;
+			spin_unlock(&__swap.lock);
+			return __swap.next + 1;
+		}
+	}
+	spin_unlock(&__swap.lock);
+	return 0;
+}
+
+void swap_free(unsigned long slot)
+{
+	--slot;
+	spin_lock(&__swap.lock);
+	__swap.map[slot / BITS_PER_LONG] &= ~(1UL << (slot % BITS_PER_LONG));
+	spin_unlock(&__swap.lock);
+}
+
+/*
+ * The block layer takes the file position by pointer, so every transfer
+ * gets its own.
+ */
+int swap_write(unsigned long slot, void *kva)
+{
+	loff_t pos = __swap.offset + (loff_t)(slot - 1) * PAGE_SIZE;
+
+	if (__swap.dev->blk_ops.writeblk(&__swap.file, kva, PAGE_SIZE,
+	    &pos) != PAGE_SIZE)
+		return -EIO;
+	return 0;
+}
+
+int swap_read(unsigned long slot, void *kva)
+{
+	loff_t pos = __swap.offset + (loff_t)(slot - 1) * PAGE_SIZE;
+
+	if (__swap.dev->blk_ops.readblk(&__swap.file, kva, PAGE_SIZE,
+	    &pos) != PAGE_SIZE)
+		return -EIO;
+	return 0;
+}
+
+/* MBR partition type of swap areas, as on Linux */
+#define MBR_TYPE_SWAP	0x82
+#define MBR_SECTOR_SIZE	512
+
+#define __STR(x)	#x
+#define __XSTR(x)	__STR(x)
+
+/*
+ * Swap on the first swap partition of the primary storage, if there is
+ * one.  The disk we booted from is never touched otherwise.
+ */
+void swap_init(void)
+{
+	struct pages p = { .size = PAGE_SIZE, .flags = 0 };
+	struct blk_device *dev;
+	struct mbr *mbr;
+	struct mbr_part_entry *part;
+	loff_t pos = 0;
+	int i, ret;
+
+	dev = (struct blk_device *)dev_from_name(__XSTR(PRIMARY_STORAGE));
+	if (dev == NULL || dev->blk_ops.readblk == NULL)
+		return;
+
+	/* a whole page keeps the buffer aligned for any DMA engine */
+	if (alloc_pages(&p) != 0)
+		return;
+	mbr = (struct mbr *)pa2kva((size_t)p.paddr);
+	if (dev->blk_ops.readblk(&__swap.file, (char *)mbr, sizeof(*mbr),
+	    &pos) != sizeof(*mbr) ||
+	    mbr->signature[0] != 0x55 || mbr->signature[1] != 0xaa)
+		goto out;
+
+	for (i = 0; i < MAX_PRIMARY_PARTITIONS; ++i) {
+		part = &mbr->part_entry[i];
+		if (part->type != MBR_TYPE_SWAP)
+			continue;
+		ret = swap_on(dev, (loff_t)part->first_sector_lba *
+		    MBR_SECTOR_SIZE, (size_t)part->sector_count * MBR_SECTOR_SIZE);
+		if (ret == 0)
+			kprintf("KERN: Swap on %s partition %d, %u KB.\n",
+			    dev->name, i + 1, part->sector_count / 2);
+		break;
+	}
+out:
+	free_pages(&p);
+}
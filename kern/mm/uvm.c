@@ -20,12 +20,28 @@
 #include <config.h>
 #endif /* HAVE_CONFIG_H */
 
+#include <aim/initcalls.h>
 #include <console.h>	/* to be removed */
 #include <mm.h>
 #include <mmu.h>
 #include <atomic.h>
 #include <errno.h>
+#include <ipi.h>
+#include <ksm.h>
+#include <pagecache.h>
 #include <panic.h>
+#include <smp.h>
+#include <percpu.h>
+#include <libc/string.h>
+
+/* address space loaded on each CPU */
+static DEFINE_PER_CPU(struct mm *, __current_mm);
+
+/*
+ * Anonymous pages start out without frames.  Reads map this single
+ * zero-filled frame read-only, and the first write gets a private copy.
+ */
+static addr_t __zero_page;
 
 struct mm *
 mm_new(void)
@@ -35,6 +51,8 @@ mm_new(void)
 	if (mm != NULL) {
 		list_init(&(mm->vma_head));
 		mm->vma_count = 0;
+		mm->asid = 0;
+		cpumask_clear(&(mm->cpus));
 		if ((mm->pgindex = init_pgindex()) == NULL) {
 			kfree(mm);
 			return NULL;
@@ -44,22 +62,6 @@ mm_new(void)
 	return mm;
 }
 
-/* Unmap the virtual memory area */
-static void
-__clean_vma(struct mm *mm, struct vma *vma)
-{
-	/* all assertations here are temporary */
-	ssize_t unmapped;
-	addr_t pa;
-
-	assert(vma->size == vma->pages->size);
-
-	unmapped = unmap_pages(mm->pgindex, vma->start, vma->size, &pa);
-
-	assert(pa == vma->pages->paddr);
-	assert(unmapped == vma->size);
-}
-
 static void
 __ref_pages(struct pages *p)
 {
@@ -68,15 +70,74 @@ __ref_pages(struct pages *p)
 
 #define __PAGES_FREED	1
 static int
-__unref_and_free_pages(struct pages *p)
+__unref_and_free_pages(struct pages *p, bool has_frame)
 {
-	atomic_dec(&(p->refs));
-	if (p->refs == 0) {
-		free_pages(p);
+	if (atomic_dec_and_test(&(p->refs))) {
+		if (has_frame)
+			free_pages(p);
 		return __PAGES_FREED;
 	}
 	return 0;
-	
+}
+
+/*
+ * Unmap the virtual memory area and take it off reclaim, dropping its swap
+ * slot.  Returns whether it still has a frame, shared or not.
+ * Inactive, swapped out and untouched pages are not mapped in the first
+ * place, while zero pages are mapped but own no frame.  Pages of a huge
+ * page only go away together, see destroy_uvm(), and the first one
+ * unmaps the whole block.
+ */
+static bool
+__release_vma(struct mm *mm, struct vma *vma)
+{
+	/* all assertations here are temporary */
+	ssize_t unmapped;
+	addr_t pa;
+	unsigned int lru;
+	bool has_frame;
+
+	/* shared file pages that were written to go back to the file */
+	if ((vma->flags & (VMA_FILE | VMA_SHARED)) == (VMA_FILE | VMA_SHARED)
+	    && vma->lru == VMA_LRU_NONE)
+		pagecache_writeback(vma->file, vma->pages);
+
+	lru = reclaim_forget(vma);
+	has_frame = (lru != VMA_LRU_SWAPPED && lru != VMA_LRU_UNTOUCHED &&
+	    lru != VMA_LRU_ZERO);
+#ifdef HPAGE_SIZE
+	if (lru == VMA_LRU_HUGE) {
+		if (PTR_IS_ALIGNED(vma->start, HPAGE_SIZE)) {
+			unmapped = unmap_pages(mm->pgindex, vma->start,
+			    HPAGE_SIZE, &pa);
+			assert(pa == vma->pages->paddr);
+			assert(unmapped == HPAGE_SIZE);
+		}
+	} else
+#endif /* HPAGE_SIZE */
+	if (lru != VMA_LRU_INACTIVE && lru != VMA_LRU_SWAPPED &&
+	    lru != VMA_LRU_UNTOUCHED) {
+		unmapped = unmap_pages(mm->pgindex, vma->start, vma->size,
+		    &pa);
+		assert(pa == (has_frame ? vma->pages->paddr : __zero_page));
+		assert(unmapped == vma->size);
+	}
+	return has_frame;
+}
+
+/* Unmap the virtual memory area, and drop its frame or swap slot */
+static void
+__clean_vma(struct mm *mm, struct vma *vma)
+{
+	bool has_frame;
+
+	assert(vma->size == vma->pages->size);
+
+	if ((vma->flags & (VMA_MERGEABLE | VMA_FILE)) == VMA_MERGEABLE)
+		ksm_forget(vma);
+	has_frame = __release_vma(mm, vma);
+	if (__unref_and_free_pages(vma->pages, has_frame) == __PAGES_FREED)
+		kfree(vma->pages);
 }
 
 void
@@ -89,12 +150,13 @@ mm_destroy(struct mm *mm)
 
 	for_each_entry_safe (vma, vma_next, &(mm->vma_head), node) {
 		__clean_vma(mm, vma);
-		if (__unref_and_free_pages(vma->pages) == __PAGES_FREED)
-			kfree(vma->pages);
 		kfree(vma);
 	}
 
 	destroy_pgindex(mm->pgindex);
+#ifdef NR_ASIDS
+	asid_release(mm);
+#endif /* NR_ASIDS */
 
 	kfree(mm);
 }
@@ -130,17 +192,14 @@ __unmap_and_free_vma(struct mm *mm, struct vma *vma_start, size_t size)
 		vma_cur = next_entry(vma_cur, node);
 
 		list_del(&(vma->node));
-		/* temporary in case of typo - assertation will be removed */
-		assert(unmap_pages(mm->pgindex, vma->start, vma->size,
-		    NULL) == PAGE_SIZE);
-		if (__unref_and_free_pages(vma->pages) == __PAGES_FREED)
-			kfree(vma->pages);
+		__clean_vma(mm, vma);
 		kfree(vma);
 	}
 }
 
-int
-create_uvm(struct mm *mm, void *addr, size_t len, uint32_t flags)
+static int
+__create_uvm(struct mm *mm, void *addr, size_t len, uint32_t flags,
+    struct file *file, loff_t offset)
 {
 	int retcode = 0;
 	struct vma *vma_start, *vma, *vma_cur;
@@ -166,6 +225,11 @@ create_uvm(struct mm *mm, void *addr, size_t len, uint32_t flags)
 		vma->start = vcur;
 		vma->size = PAGE_SIZE;
 		vma->flags = flags;
+		vma->advice = MADV_NORMAL;
+		vma->mm = mm;
+		vma->swap = 0;
+		vma->file = file;
+		vma->offset = offset + mapped;
 
 		p = (struct pages *)kmalloc(sizeof(*p), 0);
 		if (p == NULL) {
@@ -176,15 +240,11 @@ create_uvm(struct mm *mm, void *addr, size_t len, uint32_t flags)
 		p->flags = 0;
 		p->size = PAGE_SIZE;
 		p->refs = 0;
-		if (alloc_pages(p) < 0) {
-			retcode = -ENOMEM;
-			goto rollback_pages;
-		}
 
-		if ((retcode = map_pages(mm->pgindex, vcur, p->paddr,
-		    PAGE_SIZE, flags)) < 0) {
-			goto rollback_pgalloc;
-		}
+		/* both anonymous and file pages are filled in on demand */
+		vma->lru = VMA_LRU_UNTOUCHED;
+		if ((flags & (VMA_MERGEABLE | VMA_FILE)) == VMA_MERGEABLE)
+			ksm_track(vma);
 
 		vma->pages = p;
 		__ref_pages(p);
@@ -192,10 +252,6 @@ create_uvm(struct mm *mm, void *addr, size_t len, uint32_t flags)
 		vma_cur = vma;
 		continue;
 
-rollback_pgalloc:
-		free_pages(p);
-rollback_pages:
-		kfree(p);
 rollback_vma:
 		kfree(vma);
 		goto rollback;
@@ -208,6 +264,36 @@ rollback:
 	return retcode;
 }
 
+int
+create_uvm(struct mm *mm, void *addr, size_t len, uint32_t flags)
+{
+	/* file mappings go through mmap_uvm() */
+	if (flags & (VMA_FILE | VMA_SHARED))
+		return -EINVAL;
+	return __create_uvm(mm, addr, len, flags, NULL, 0);
+}
+
+int
+mmap_uvm(struct mm *mm, void *addr, size_t len, uint32_t flags,
+    struct file *file, loff_t offset)
+{
+	int ret;
+
+	if (file == NULL || file->file_ops == NULL ||
+	    file->file_ops->read == NULL ||
+	    !IS_ALIGNED(offset, PAGE_SIZE) ||
+	    (flags & VMA_MERGEABLE))
+		return -EINVAL;
+	/* writes to shared mappings end up in the file */
+	if ((flags & (VMA_SHARED | VMA_WRITE)) == (VMA_SHARED | VMA_WRITE) &&
+	    file->file_ops->write == NULL)
+		return -EACCES;
+	if (file->file_ops->mmap != NULL &&
+	    (ret = file->file_ops->mmap(file, flags)) < 0)
+		return ret;
+	return __create_uvm(mm, addr, len, flags | VMA_FILE, file, offset);
+}
+
 int
 destroy_uvm(struct mm *mm, void *addr, size_t len)
 {
@@ -236,10 +322,449 @@ destroy_uvm(struct mm *mm, void *addr, size_t len)
 			return -EFAULT;
 	}
 
+	/* huge pages sticking out of the range go back to small pages */
+	hugepage_split_at(mm, addr);
+	hugepage_split_at(mm, addr + len);
 	__unmap_and_free_vma(mm, vma_start, len);
+	mm_forget_tlb(mm);
+	return 0;
+}
+
+void
+switch_mm(struct mm *mm)
+{
+	/*
+	 * Show up in the mask before picking an ASID, so mm_forget_tlb()
+	 * either reaches us or retires the ASID before we get it.
+	 */
+	cpumask_set_cpu(cpuid(), &(mm->cpus));
+	arch_switch_mm(mm);
+	this_cpu_write(__current_mm, mm);
+}
+
+struct mm *
+current_mm(void)
+{
+	return this_cpu_read(__current_mm);
+}
+
+/* Reloading gives a fresh ASID, or flushes the TLB without ASIDs */
+static void
+__reload_mm(void *arg)
+{
+	struct mm *mm = arg;
+
+	if (current_mm() == mm)
+		switch_mm(mm);
+}
+
+void
+mm_forget_tlb(struct mm *mm)
+{
+	cpumask_t cpus;
+	int cpu;
+
+#ifdef NR_ASIDS
+	asid_retire(mm);
+#endif /* NR_ASIDS */
+	/*
+	 * CPUs not running @mm any more are done with it: the old ASID
+	 * is not handed out again before all TLBs are flushed.  Those
+	 * running it come back into the mask on reload.
+	 */
+	cpumask_clear(&cpus);
+	for (cpu = 0; cpu < NR_CPUS; ++cpu) {
+		if (cpumask_test_cpu(cpu, &(mm->cpus))) {
+			cpumask_clear_cpu(cpu, &(mm->cpus));
+			cpumask_set_cpu(cpu, &cpus);
+		}
+	}
+	smp_call_function_many(&cpus, __reload_mm, mm, true);
+	if (cpumask_test_cpu(cpuid(), &cpus))
+		__reload_mm(mm);
+}
+
+static struct vma *
+__find_vma(struct mm *mm, void *addr)
+{
+	struct vma *vma;
+
+	for_each_entry (vma, &(mm->vma_head), node) {
+		if (addr < vma->start)
+			break;
+		if (addr < vma->start + vma->size)
+			return vma;
+	}
+	return NULL;
+}
+
+static int
+__zero_fault(struct mm *mm, struct vma *vma, uint32_t flags)
+{
+	struct pages *p = vma->pages;
+	int ret;
+
+	if (!(flags & VMA_WRITE)) {
+		if (vma->lru == VMA_LRU_ZERO)
+			return 0;
+		ret = map_pages(mm->pgindex, vma->start, __zero_page,
+		    PAGE_SIZE, vma->flags & ~VMA_WRITE);
+		if (ret < 0)
+			return ret;
+		vma->lru = VMA_LRU_ZERO;
+		return 0;
+	}
+
+	/* First write, copy-on-write from the zero page */
+	if (alloc_pages_reclaim(p) < 0)
+		return -ENOMEM;
+	memset((void *)pa2kva((size_t)p->paddr), 0, PAGE_SIZE);
+
+	if (vma->lru == VMA_LRU_ZERO) {
+		unmap_pages(mm->pgindex, vma->start, PAGE_SIZE, NULL);
+		/* or other threads keep reading zeroes from the old entry */
+		mm_forget_tlb(mm);
+		vma->lru = VMA_LRU_UNTOUCHED;
+	}
+	ret = map_pages(mm->pgindex, vma->start, p->paddr, PAGE_SIZE,
+	    vma->flags);
+	if (ret < 0) {
+		free_pages(p);
+		p->paddr = 0;
+		return ret;
+	}
+	reclaim_track(vma);
+	return 0;
+}
+
+/* Write to a merged or cached file page, get a private copy */
+static int
+__cow_fault(struct mm *mm, struct vma *vma)
+{
+	struct pages *shared = vma->pages, *p;
+	int ret;
+
+	p = (struct pages *)kmalloc(sizeof(*p), 0);
+	if (p == NULL)
+		return -ENOMEM;
+	p->flags = 0;
+	p->size = PAGE_SIZE;
+	p->refs = 1;
+	if (alloc_pages_reclaim(p) < 0) {
+		kfree(p);
+		return -ENOMEM;
+	}
+	memcpy((void *)pa2kva((size_t)p->paddr),
+	    (void *)pa2kva((size_t)shared->paddr), PAGE_SIZE);
+
+	unmap_pages(mm->pgindex, vma->start, PAGE_SIZE, NULL);
+	/* nobody may read @shared through us once our reference is gone */
+	mm_forget_tlb(mm);
+	ret = map_pages(mm->pgindex, vma->start, p->paddr, PAGE_SIZE,
+	    vma->flags);
+	if (ret < 0) {
+		assert(map_pages(mm->pgindex, vma->start, shared->paddr,
+		    PAGE_SIZE, vma->flags & ~VMA_WRITE) == 0);
+		free_pages(p);
+		kfree(p);
+		return ret;
+	}
+
+	vma->pages = p;
+	if (__unref_and_free_pages(shared, true) == __PAGES_FREED)
+		kfree(shared);
+	reclaim_track(vma);
 	return 0;
 }
 
+/*
+ * Map the cached page behind file @vma, read-only so that the first write
+ * is noticed: it dirties the page for shared mappings, and gives private
+ * ones a copy of their own.
+ */
+static int
+__file_fault(struct mm *mm, struct vma *vma, uint32_t flags)
+{
+	struct pages *p;
+	int ret;
+
+	if (vma->lru == VMA_LRU_UNTOUCHED) {
+		p = pagecache_get(vma->file, vma->offset);
+		if (p == NULL)
+			return -EIO;
+		ret = map_pages(mm->pgindex, vma->start, p->paddr, PAGE_SIZE,
+		    vma->flags & ~VMA_WRITE);
+		if (ret < 0) {
+			atomic_dec(&(p->refs));
+			return ret;
+		}
+		/* the cache holds on to the frame */
+		__unref_and_free_pages(vma->pages, false);
+		kfree(vma->pages);
+		vma->pages = p;
+		vma->lru = VMA_LRU_NONE;
+		pagecache_readahead(vma->file, vma->offset + PAGE_SIZE,
+		    vma_readahead(vma));
+	}
+
+	if (!(flags & VMA_WRITE))
+		return 0;
+	if (vma->flags & VMA_SHARED) {
+		pagecache_dirty(vma->pages);
+		return protect_pages(mm->pgindex, vma->start, PAGE_SIZE,
+		    vma->flags);
+	}
+	return __cow_fault(mm, vma);
+}
+
+/* pages read ahead on a fault */
+#define READAHEAD_NORMAL	4
+#define READAHEAD_SEQUENTIAL	32
+
+size_t
+vma_readahead(struct vma *vma)
+{
+	switch (vma->advice) {
+	case MADV_RANDOM:
+		return 0;
+	case MADV_SEQUENTIAL:
+		return READAHEAD_SEQUENTIAL;
+	default:
+		return READAHEAD_NORMAL;
+	}
+}
+
+/* Swapped out pages right after @vma are likely to be wanted next */
+static void
+__swap_readahead(struct mm *mm, struct vma *vma)
+{
+	struct vma *next;
+	size_t nr;
+
+	for (nr = vma_readahead(vma); nr > 0; --nr, vma = next) {
+		if (list_is_last(&(vma->node), &(mm->vma_head)))
+			break;
+		next = next_entry(vma, node);
+		if (next->start != vma->start + vma->size ||
+		    next->lru != VMA_LRU_SWAPPED ||
+		    reclaim_fault(next) != 0)
+			break;
+	}
+}
+
+/* how far below the stack an access may be to grow it */
+#define STACK_GROW_MAX	(16 * PAGE_SIZE)
+
+/*
+ * Extend the stack right above unmapped @addr down to cover it, if @addr
+ * is close enough.  One unmapped guard page is kept between the stack and
+ * whatever is below.
+ */
+static int
+__grow_stack(struct mm *mm, void *addr)
+{
+	struct vma *vma, *below = NULL;
+	void *start = PTR_ALIGN_BELOW(addr, PAGE_SIZE);
+
+	for_each_entry (vma, &(mm->vma_head), node) {
+		if (vma->start > addr)
+			break;
+		below = vma;
+	}
+	if (&(vma->node) == &(mm->vma_head) ||
+	    !(vma->flags & VMA_GROWSDOWN) ||
+	    vma->start - start > STACK_GROW_MAX)
+		return -EFAULT;
+	if (below != NULL && start < below->start + below->size + PAGE_SIZE)
+		return -EFAULT;
+
+	/* new stack pages are demand-zero like the rest */
+	return create_uvm(mm, start, vma->start - start, vma->flags);
+}
+
+int
+handle_page_fault(struct mm *mm, void *addr, uint32_t flags)
+{
+	struct vma *vma;
+	int ret;
+
+	if (mm == NULL)
+		return -EFAULT;
+	if ((vma = __find_vma(mm, addr)) == NULL) {
+		if ((ret = __grow_stack(mm, addr)) < 0)
+			return ret;
+		vma = __find_vma(mm, addr);
+	}
+	if ((flags & (VMA_READ | VMA_WRITE | VMA_EXEC)) & ~vma->flags)
+		return -EACCES;
+	/* file pages not copied privately yet */
+	if ((vma->flags & VMA_FILE) &&
+	    (vma->lru == VMA_LRU_UNTOUCHED || vma->lru == VMA_LRU_NONE))
+		return __file_fault(mm, vma, flags);
+
+	switch (vma->lru) {
+	case VMA_LRU_INACTIVE:
+	case VMA_LRU_IO:
+		ret = reclaim_fault(vma);
+		goto populated;
+	case VMA_LRU_SWAPPED:
+		ret = reclaim_fault(vma);
+		if (ret == 0)
+			__swap_readahead(mm, vma);
+		goto populated;
+	case VMA_LRU_UNTOUCHED:
+	case VMA_LRU_ZERO:
+		ret = __zero_fault(mm, vma, flags);
+		goto populated;
+	case VMA_LRU_NONE:
+		if ((flags & VMA_WRITE) && (vma->flags & VMA_MERGEABLE) &&
+		    vma->pages->refs > 1)
+			return __cow_fault(mm, vma);
+		break;
+	}
+	/* Pages on the active list or untracked are mapped already */
+	return 0;
+
+populated:
+	if (ret == 0)
+		hugepage_fault(mm, vma);
+	return ret;
+}
+
+/* Bring @vma in ahead of use, as its first access would */
+static int
+__populate(struct mm *mm, struct vma *vma)
+{
+	int ret;
+
+	switch (vma->lru) {
+	case VMA_LRU_INACTIVE:
+	case VMA_LRU_SWAPPED:
+	case VMA_LRU_IO:
+		ret = reclaim_fault(vma);
+		break;
+	case VMA_LRU_UNTOUCHED:
+		if (vma->flags & VMA_FILE)
+			return __file_fault(mm, vma, VMA_READ);
+		ret = __zero_fault(mm, vma,
+		    (vma->flags & VMA_WRITE) ? VMA_WRITE : VMA_READ);
+		break;
+	default:
+		return 0;
+	}
+	if (ret == 0)
+		hugepage_fault(mm, vma);
+	return ret;
+}
+
+/*
+ * Drop the frame of @vma, leaving it untouched: anonymous pages read as
+ * zeros again, file pages as what is in the file.
+ */
+static int
+__dontneed(struct mm *mm, struct vma *vma)
+{
+	struct pages *p = vma->pages, *shared = NULL;
+	bool has_frame;
+
+	if (p->refs > 1) {
+		/* merged or cached page, keep the frame for others */
+		shared = p;
+		p = (struct pages *)kmalloc(sizeof(*p), 0);
+		if (p == NULL)
+			return -ENOMEM;
+		p->flags = 0;
+		p->size = PAGE_SIZE;
+		p->refs = 1;
+	}
+
+	has_frame = __release_vma(mm, vma);
+	if (shared != NULL) {
+		if (__unref_and_free_pages(shared, true) == __PAGES_FREED)
+			kfree(shared);
+		vma->pages = p;
+	} else if (has_frame) {
+		free_pages(p);
+	}
+	p->paddr = 0;
+	vma->lru = VMA_LRU_UNTOUCHED;
+	return 0;
+}
+
+int
+advise_uvm(struct mm *mm, void *addr, size_t len, int advice)
+{
+	struct vma *vma, *vma_start;
+	size_t i;
+	int ret = 0;
+
+	if (!IS_ALIGNED(len, PAGE_SIZE) ||
+	    mm == NULL ||
+	    !PTR_IS_ALIGNED(addr, PAGE_SIZE))
+		return -EINVAL;
+	if (len == 0)
+		return 0;
+
+	/* the whole range must be mapped */
+	if ((vma_start = __find_vma(mm, addr)) == NULL)
+		return -EFAULT;
+	vma = vma_start;
+	for (i = PAGE_SIZE; i < len; i += PAGE_SIZE) {
+		if (list_is_last(&(vma->node), &(mm->vma_head)))
+			return -EFAULT;
+		vma = next_entry(vma, node);
+		if (vma->start != addr + i)
+			return -EFAULT;
+	}
+
+	switch (advice) {
+	case MADV_NORMAL:
+	case MADV_RANDOM:
+	case MADV_SEQUENTIAL:
+		vma = vma_start;
+		for (i = 0; i < len; i += PAGE_SIZE) {
+			vma->advice = advice;
+			vma = next_entry(vma, node);
+		}
+		return 0;
+	case MADV_WILLNEED:
+		vma = vma_start;
+		for (i = 0; i < len && ret == 0; i += PAGE_SIZE) {
+			ret = __populate(mm, vma);
+			vma = next_entry(vma, node);
+		}
+		return ret;
+	case MADV_DONTNEED:
+		hugepage_split_at(mm, addr);
+		hugepage_split_at(mm, addr + len);
+		vma = vma_start;
+		for (i = 0; i < len && ret == 0; i += PAGE_SIZE) {
+			ret = __dontneed(mm, vma);
+			vma = next_entry(vma, node);
+		}
+		mm_forget_tlb(mm);
+		return ret;
+	case MADV_HUGEPAGE:
+		hugepage_collapse(mm, addr, len);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int
+__zero_page_init(void)
+{
+	struct pages p = { .size = PAGE_SIZE, .flags = 0 };
+
+	assert(alloc_pages(&p) == 0);
+	memset((void *)pa2kva((size_t)p.paddr), 0, PAGE_SIZE);
+	__zero_page = p.paddr;
+	return 0;
+}
+
+INITCALL_CORE(__zero_page_init)
+
 void
 mm_test(void)
 {
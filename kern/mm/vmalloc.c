@@ -0,0 +1,299 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <aim/initcalls.h>
+#include <aim/sync.h>
+#include <list.h>
+#include <util.h>
+#include <mm.h>
+#include <mmu.h>
+#include <pmm.h>
+#include <vmm.h>
+#include <panic.h>
+
+/*
+ * vmalloc() builds virtually contiguous kernel mappings out of single
+ * pages, inside the part of KMMAP_BASE..RESERVED_BASE not taken by early
+ * kmmap mappings.  Unlike kmalloc() it never needs physically contiguous
+ * memory.  The window is shared by every address space, see
+ * share_kern_pgtables().
+ *
+ * Areas released by vfree() are not unmapped right away. They wait on a
+ * lazy list, still mapped to frames nobody else owns, so stale TLB entries
+ * are harmless.  Once enough of them pile up, or the address space runs
+ * out, they are unmapped in one batch without touching the TLB, which is
+ * then flushed once on every CPU instead of page by page.  Only then are
+ * their frames and emptied page tables freed, and their addresses reused.
+ */
+
+/* pages waiting on the lazy list before a purge is forced */
+#define VMALLOC_LAZY_MAX	1024
+
+struct vm_area {
+	size_t		start;
+	size_t		size;
+	addr_t		*frames;	/* one per page, NULL for free ranges */
+	struct list_head node;
+};
+
+static lock_t __vm_lock = UNLOCKED;
+/* free address ranges, sorted and coalesced */
+static struct list_head __vm_free = EMPTY_LIST(__vm_free);
+static struct list_head __vm_busy = EMPTY_LIST(__vm_busy);
+static struct list_head __vm_lazy = EMPTY_LIST(__vm_lazy);
+static size_t __vm_lazy_pages;
+
+/* first fit from the free list */
+static size_t __range_get(size_t size)
+{
+	struct vm_area *free;
+	size_t start;
+
+	for_each_entry(free, &__vm_free, node) {
+		if (free->size < size)
+			continue;
+		start = free->start;
+		free->start += size;
+		free->size -= size;
+		if (free->size == 0) {
+			list_del(&free->node);
+			kfree(free);
+		}
+		return start;
+	}
+	return 0;
+}
+
+/* give the range of @area back, merging with neighbors */
+static void __range_put(struct vm_area *area)
+{
+	struct vm_area *free, *prev = NULL;
+
+	for_each_entry(free, &__vm_free, node) {
+		if (free->start > area->start)
+			break;
+		prev = free;
+	}
+	/* now @free is the first range above, or the list head */
+	if (prev != NULL && prev->start + prev->size == area->start) {
+		prev->size += area->size;
+		kfree(area);
+		area = prev;
+	} else {
+		area->frames = NULL;
+		list_add_before(&area->node, &free->node);
+	}
+	if (&free->node != &__vm_free &&
+	    area->start + area->size == free->start) {
+		area->size += free->size;
+		list_del(&free->node);
+		kfree(free);
+	}
+}
+
+static void __free_frames(addr_t *frames, size_t nr)
+{
+	struct pages p = { .size = PAGE_SIZE, .flags = 0 };
+	size_t i;
+
+	for (i = 0; i < nr; ++i) {
+		p.paddr = frames[i];
+		free_pages(&p);
+	}
+}
+
+/*
+ * unmap [start, start + size), which may be made of scattered frames,
+ * leaving the TLB to the caller unless @flush is set
+ */
+static void __unmap_area(size_t start, size_t size, bool flush)
+{
+	ssize_t ret;
+
+	while (size > 0) {
+		if (flush)
+			ret = unmap_pages(kern_pgindex(), (void *)start,
+			    size, NULL);
+		else
+			ret = unmap_pages_noflush(kern_pgindex(),
+			    (void *)start, size, NULL);
+		if (ret <= 0)
+			panic("vmalloc: area 0x%08x not mapped\n", start);
+		start += ret;
+		size -= ret;
+	}
+}
+
+/*
+ * Called with __vm_lock held.  The lock is dropped while other CPUs flush
+ * their TLBs, as they may be waiting for it.
+ */
+static void __purge_lazy(void)
+{
+	struct list_head purged = EMPTY_LIST(purged);
+	struct vm_area *area, *next;
+
+	for_each_entry_safe(area, next, &__vm_lazy, node) {
+		list_del(&area->node);
+		__unmap_area(area->start, area->size, false);
+		list_add_before(&area->node, &purged);
+	}
+	__vm_lazy_pages = 0;
+	spin_unlock(&__vm_lock);
+
+	tlb_flush_all();
+	for_each_entry(area, &purged, node) {
+		__free_frames(area->frames, area->size / PAGE_SIZE);
+		kfree(area->frames);
+	}
+
+	spin_lock(&__vm_lock);
+	for_each_entry_safe(area, next, &purged, node) {
+		free_empty_pgtables(kern_pgindex(), (void *)area->start,
+		    area->size);
+		list_del(&area->node);
+		__range_put(area);
+	}
+}
+
+/* map @frames at @start, one call per physically contiguous run */
+static int __map_area(size_t start, addr_t *frames, size_t nr)
+{
+	size_t i, j;
+
+	for (i = 0; i < nr; i = j) {
+		for (j = i + 1; j < nr; ++j)
+			if (frames[j] != frames[i] + (j - i) * PAGE_SIZE)
+				break;
+		if (map_pages(kern_pgindex(), (void *)(start + i * PAGE_SIZE),
+		    frames[i], (j - i) * PAGE_SIZE,
+		    MAP_KERN_MEM | VMA_READ | VMA_WRITE) < 0) {
+			if (i > 0)
+				__unmap_area(start, i * PAGE_SIZE, true);
+			return EOF;
+		}
+	}
+	return 0;
+}
+
+void *vmalloc(size_t size)
+{
+	struct vm_area *area;
+	struct pages p;
+	addr_t *frames;
+	size_t nr, i;
+
+	size = ALIGN_ABOVE(size, PAGE_SIZE);
+	if (size == 0)
+		return NULL;
+	nr = size / PAGE_SIZE;
+
+	area = kmalloc(sizeof(*area), 0);
+	if (area == NULL)
+		return NULL;
+	area->size = size;
+	area->frames = kmalloc(nr * sizeof(addr_t), 0);
+	if (area->frames == NULL)
+		goto free_area;
+
+	for (i = 0; i < nr; ++i) {
+		p.size = PAGE_SIZE;
+		p.flags = 0;
+		if (alloc_pages(&p) != 0)
+			goto free_frames;
+		area->frames[i] = p.paddr;
+	}
+
+	spin_lock(&__vm_lock);
+	area->start = __range_get(size);
+	if (area->start == 0 && !list_empty(&__vm_lazy)) {
+		__purge_lazy();
+		area->start = __range_get(size);
+	}
+	if (area->start == 0) {
+		spin_unlock(&__vm_lock);
+		goto free_frames;
+	}
+	if (__map_area(area->start, area->frames, nr) != 0) {
+		/* @area goes back to the free list */
+		frames = area->frames;
+		__range_put(area);
+		spin_unlock(&__vm_lock);
+		__free_frames(frames, nr);
+		kfree(frames);
+		return NULL;
+	}
+	list_add_after(&area->node, &__vm_busy);
+	spin_unlock(&__vm_lock);
+
+	return (void *)area->start;
+
+free_frames:
+	__free_frames(area->frames, i);
+	kfree(area->frames);
+free_area:
+	kfree(area);
+	return NULL;
+}
+
+void vfree(void *addr)
+{
+	struct vm_area *area;
+
+	if (addr == NULL)
+		return;
+
+	spin_lock(&__vm_lock);
+	for_each_entry(area, &__vm_busy, node) {
+		if (area->start == (size_t)addr)
+			break;
+	}
+	if (&area->node == &__vm_busy)
+		panic("vfree: 0x%08x not allocated\n", (size_t)addr);
+
+	list_del(&area->node);
+	list_add_after(&area->node, &__vm_lazy);
+	__vm_lazy_pages += area->size / PAGE_SIZE;
+	if (__vm_lazy_pages >= VMALLOC_LAZY_MAX)
+		__purge_lazy();
+	spin_unlock(&__vm_lock);
+}
+
+static int __init(void)
+{
+	struct vm_area *free;
+	size_t start = ALIGN_ABOVE(early_mapping_kmmap_top(), PAGE_SIZE);
+
+	if (start >= RESERVED_BASE)
+		return 0;
+	free = kmalloc(sizeof(*free), 0);
+	assert(free != NULL);
+	free->start = start;
+	free->size = RESERVED_BASE - start;
+	free->frames = NULL;
+	list_add_after(&free->node, &__vm_free);
+	assert(share_kern_pgtables((void *)start, RESERVED_BASE - start) == 0);
+	return 0;
+}
+
+INITCALL_CORE(__init)
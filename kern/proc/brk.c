@@ -0,0 +1,89 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <errno.h>
+#include <mm.h>
+#include <proc.h>
+#include <util.h>
+
+/*
+ * The heap starts at ustacktop and is mapped in chunks: the mapped part is
+ * always heapsize rounded up to HEAP_CHUNK, so that most brk() calls do
+ * not touch the VMAs at all, and the others create or destroy a whole
+ * chunk in one go.  Heap pages are demand-zero, so a mapped chunk costs
+ * no memory until it is used.
+ */
+#define HEAP_CHUNK	(64 * PAGE_SIZE)
+
+int proc_brk(struct proc *proc, uintptr_t brk)
+{
+	uintptr_t base = proc->ustacktop;
+	size_t size, top, new_top, used;
+	int ret;
+
+	if (brk < base)
+		return -EINVAL;
+	size = brk - base;
+	top = ALIGN_ABOVE(proc->heapsize, HEAP_CHUNK);
+	new_top = ALIGN_ABOVE(size, HEAP_CHUNK);
+
+	if (new_top > top) {
+		ret = create_uvm(proc->mm, (void *)(base + top), new_top - top,
+		    VMA_READ | VMA_WRITE);
+		if (ret < 0)
+			/* ran into something mapped above */
+			return (ret == -EFAULT) ? -ENOMEM : ret;
+	} else if (size < proc->heapsize) {
+		if (new_top < top) {
+			ret = destroy_uvm(proc->mm, (void *)(base + new_top),
+			    top - new_top);
+			if (ret < 0)
+				return ret;
+		}
+		/* pages given back must read as zeros when the heap grows */
+		used = ALIGN_ABOVE(size, PAGE_SIZE);
+		if (used < new_top) {
+			ret = advise_uvm(proc->mm, (void *)(base + used),
+			    new_top - used, MADV_DONTNEED);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	proc->heapsize = size;
+	return 0;
+}
+
+int proc_sbrk(struct proc *proc, ssize_t incr, uintptr_t *oldbrk)
+{
+	uintptr_t brk = proc->ustacktop + proc->heapsize;
+	int ret;
+
+	if (incr < 0 && (size_t)-incr > proc->heapsize)
+		return -EINVAL;
+	if ((ret = proc_brk(proc, brk + incr)) < 0)
+		return ret;
+	if (oldbrk != NULL)
+		*oldbrk = brk;
+	return 0;
+}
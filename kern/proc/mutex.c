@@ -0,0 +1,119 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <atomic.h>
+#include <mutex.h>
+#include <proc.h>
+#include <rcu.h>
+#include <sched.h>
+#include <waitqueue.h>
+
+/*
+ * The state goes from UNLOCKED to LOCKED on an uncontended lock.  Those
+ * going to sleep swap in CONTENDED, so whoever unlocks knows to wake one
+ * of them up; the sleeper woken swaps it in again, and either gets the
+ * mutex that way or sleeps on.
+ */
+
+/* in tries, so that an owner running for long does not keep us spinning */
+#define MUTEX_SPIN_MAX	(1 << 14)
+
+void mutex_init(struct mutex *mutex)
+{
+	atomic_set(&mutex->state, MUTEX_UNLOCKED);
+	mutex->owner = NULL;
+	waitqueue_init(&mutex->wq);
+}
+
+static inline bool __mutex_try(struct mutex *mutex)
+{
+	return atomic_cmpxchg_acquire(&mutex->state, MUTEX_UNLOCKED,
+	    MUTEX_LOCKED) == MUTEX_UNLOCKED;
+}
+
+/*
+ * The owner we read may release the mutex and exit while we look.  Nothing
+ * frees procs yet; whatever comes to do so must wait for a grace period
+ * first, e.g. with call_rcu(), for the read below to stay safe.  Code
+ * outside any proc cannot sleep, and a new owner not yet written in is
+ * running by definition.
+ */
+static bool __owner_running(struct mutex *mutex)
+{
+	struct proc *owner;
+	bool running;
+
+	rcu_read_lock();
+	owner = *(struct proc * volatile *)&mutex->owner;
+	running = (owner == NULL || owner->state == PS_ONPROC);
+	rcu_read_unlock();
+	return running;
+}
+
+static bool __mutex_spin(struct mutex *mutex)
+{
+	int i;
+
+	for (i = 0; i < MUTEX_SPIN_MAX; ++i) {
+		/* only read while it is held, as spinlock waiters do */
+		if (atomic_read(&mutex->state) == MUTEX_UNLOCKED &&
+		    __mutex_try(mutex))
+			return true;
+		if (!__owner_running(mutex))
+			return false;
+	}
+	return false;
+}
+
+void mutex_lock(struct mutex *mutex)
+{
+	struct wait_entry wait;
+
+	if (!__mutex_try(mutex) && !__mutex_spin(mutex)) {
+		for (;;) {
+			prepare_to_wait(&mutex->wq, &wait);
+			if (atomic_xchg(&mutex->state, MUTEX_CONTENDED) ==
+			    MUTEX_UNLOCKED)
+				break;
+			wait_woken(&wait);
+		}
+		finish_wait(&mutex->wq, &wait);
+	}
+	mutex->owner = current_proc();
+}
+
+bool mutex_trylock(struct mutex *mutex)
+{
+	if (!__mutex_try(mutex))
+		return false;
+	mutex->owner = current_proc();
+	return true;
+}
+
+void mutex_unlock(struct mutex *mutex)
+{
+	mutex->owner = NULL;
+	/* fully ordered, so we see the entry of a sleeper we saw mark it */
+	if (atomic_xchg(&mutex->state, MUTEX_UNLOCKED) == MUTEX_CONTENDED)
+		wake_up(&mutex->wq);
+}
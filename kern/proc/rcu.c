@@ -0,0 +1,197 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <aim/initcalls.h>
+#include <aim/sync.h>
+#include <rcu.h>
+#include <smp.h>
+#include <percpu.h>
+#include <util.h>
+
+/*
+ * Grace periods are numbered.  Starting one asks every online CPU for a
+ * quiescent state, and the last CPU to report ends it.
+ *
+ * Each CPU queues new callbacks on its next list.  At a quiescent state
+ * the whole batch moves to the wait list and is tagged with the first
+ * grace period starting after it; the wait list runs once that grace
+ * period is over.  Only one grace period runs at a time, a CPU needing
+ * another one while it runs leaves a note to start it right after.
+ */
+
+struct rcu_cpu {
+	bool		online;
+	bool		qs_pending;	/* owes the current grace period */
+	struct rcu_head	*next, **next_tail;
+	struct rcu_head	*wait;
+	unsigned long	wait_gp;	/* grace period @wait waits for */
+};
+
+static lock_t __rcu_lock = UNLOCKED;
+static DEFINE_PER_CPU(struct rcu_cpu, __rcu_cpu);
+static unsigned long __gp_cur;		/* last grace period started */
+static unsigned long __gp_done;		/* last grace period ended */
+static int __qs_left;			/* CPUs yet to report */
+static bool __gp_wanted;
+
+#define __gp_active()		(__gp_cur != __gp_done)
+#define __gp_after(a, b)	((long)((a) - (b)) > 0)
+
+static void __start_gp(void)
+{
+	int i;
+
+	++__gp_cur;
+	__gp_wanted = false;
+	__qs_left = 0;
+	for (i = 0; i < NR_CPUS; ++i) {
+		if (!per_cpu(__rcu_cpu, i).online)
+			continue;
+		per_cpu(__rcu_cpu, i).qs_pending = true;
+		++__qs_left;
+	}
+	if (__qs_left == 0)
+		__gp_done = __gp_cur;
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+	struct rcu_cpu *rcu;
+
+	head->func = func;
+	head->next = NULL;
+
+	spin_lock(&__rcu_lock);
+	rcu = this_cpu_ptr(&__rcu_cpu);
+	*rcu->next_tail = head;
+	rcu->next_tail = &head->next;
+	spin_unlock(&__rcu_lock);
+}
+
+/*
+ * Peek at what @rcu has pending without the lock.  Only the CPU itself
+ * fills its lists, so these are exact; a grace period starting under our
+ * feet is seen on the next call.
+ */
+static inline bool __rcu_idle(struct rcu_cpu *rcu)
+{
+	return !*(volatile bool *)&rcu->qs_pending &&
+	    *(struct rcu_head * volatile *)&rcu->wait == NULL &&
+	    *(struct rcu_head * volatile *)&rcu->next == NULL;
+}
+
+void rcu_qs(void)
+{
+	struct rcu_cpu *rcu = this_cpu_ptr(&__rcu_cpu);
+	struct rcu_head *done = NULL, *next;
+
+	/* idle CPUs come by often, keep them off __rcu_lock */
+	if (__rcu_idle(rcu))
+		return;
+
+	spin_lock(&__rcu_lock);
+
+	if (rcu->qs_pending) {
+		rcu->qs_pending = false;
+		if (--__qs_left == 0) {
+			__gp_done = __gp_cur;
+			if (__gp_wanted)
+				__start_gp();
+		}
+	}
+
+	if (rcu->wait != NULL && !__gp_after(rcu->wait_gp, __gp_done)) {
+		done = rcu->wait;
+		rcu->wait = NULL;
+	}
+
+	if (rcu->wait == NULL && rcu->next != NULL) {
+		rcu->wait = rcu->next;
+		rcu->next = NULL;
+		rcu->next_tail = &rcu->next;
+		if (__gp_active()) {
+			__gp_wanted = true;
+			rcu->wait_gp = __gp_cur + 1;
+		} else {
+			__start_gp();
+			rcu->wait_gp = __gp_cur;
+		}
+	}
+
+	spin_unlock(&__rcu_lock);
+
+	/* callbacks may well call_rcu() again */
+	for (; done != NULL; done = next) {
+		next = done->next;
+		done->func(done);
+	}
+}
+
+struct rcu_sync {
+	struct rcu_head head;
+	volatile bool done;
+};
+
+static void __sync_done(struct rcu_head *head)
+{
+	struct rcu_sync *sync = container_of(head, struct rcu_sync, head);
+
+	sync->done = true;
+}
+
+/*
+ * We are quiescent ourselves while waiting here, the other CPUs get
+ * through theirs on their own.
+ */
+void synchronize_rcu(void)
+{
+	struct rcu_sync sync = { .done = false };
+
+	call_rcu(&sync.head, __sync_done);
+	while (!sync.done)
+		rcu_qs();
+}
+
+void rcu_cpu_online(void)
+{
+	spin_lock(&__rcu_lock);
+	this_cpu_write(__rcu_cpu.online, true);
+	spin_unlock(&__rcu_lock);
+}
+
+static int __init(void)
+{
+	struct rcu_cpu *rcu;
+	int i;
+
+	for (i = 0; i < NR_CPUS; ++i) {
+		rcu = per_cpu_ptr(&__rcu_cpu, i);
+		rcu->next = rcu->wait = NULL;
+		rcu->next_tail = &rcu->next;
+	}
+	/* the boot CPU */
+	rcu_cpu_online();
+	return 0;
+}
+
+INITCALL_CORE(__init)
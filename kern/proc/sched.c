@@ -0,0 +1,44 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <proc.h>
+#include <rcu.h>
+#include <sched.h>
+
+/*
+ * There is no context switch yet, so nobody can run in our place.  We
+ * pass a quiescent state, as an idle loop would, and return to let the
+ * caller check again.  Once procs are switched, a sleeping proc leaves
+ * the CPU here and a running one goes to the back of the line.
+ */
+void schedule(void)
+{
+	rcu_qs();
+}
+
+void proc_wakeup(struct proc *proc)
+{
+	/* and hand it to the scheduler, once there is one */
+	if (proc->state == PS_SLEEPING)
+		proc->state = PS_RUNNABLE;
+}
@@ -0,0 +1,66 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <atomic.h>
+#include <panic.h>
+#include <semaphore.h>
+#include <waitqueue.h>
+
+void semaphore_init(semaphore_t *sem, int val)
+{
+	atomic_set(&sem->val, val);
+	sem->limit = val;
+	waitqueue_init(&sem->wq);
+	/* make it visible */
+	SMP_DMB();
+}
+
+bool semaphore_trydec(semaphore_t *sem)
+{
+	int val = (int)atomic_read(&sem->val), prev;
+
+	while (val > 0) {
+		prev = (int)atomic_cmpxchg_acquire(&sem->val, val, val - 1);
+		if (prev == val)
+			return true;
+		val = prev;
+	}
+	return false;
+}
+
+void semaphore_dec(semaphore_t *sem)
+{
+	if (!semaphore_trydec(sem))
+		wait_event(&sem->wq, semaphore_trydec(sem));
+}
+
+void semaphore_inc(semaphore_t *sem)
+{
+	/* fully ordered, so a sleeper either sees it or is woken */
+	int val = (int)atomic_inc_return(&sem->val);
+
+	if (val > sem->limit)
+		panic("Increasing semaphore at 0x%p to %d/%d\n",
+			sem, val, sem->limit);
+	wake_up(&sem->wq);
+}
@@ -0,0 +1,118 @@
+/* Copyright (C) 2016 David Gao <davidgao1001@gmail.com>
+ *
+ * This file is part of AIMv6.
+ *
+ * AIMv6 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * AIMv6 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <aim/sync.h>
+#include <list.h>
+#include <proc.h>
+#include <sched.h>
+#include <waitqueue.h>
+
+void waitqueue_init(struct waitqueue *wq)
+{
+	spinlock_init(&wq->lock);
+	list_init(&wq->head);
+}
+
+void prepare_to_wait(struct waitqueue *wq, struct wait_entry *wait)
+{
+	struct proc *proc = current_proc();
+
+	wait->proc = proc;
+	wait->woken = false;
+
+	spin_lock(&wq->lock);
+	list_add_tail(&wait->node, &wq->head);
+	/* from here on a wakeup may come any time, even before we sleep */
+	if (proc != NULL) {
+		proc->bed = wq;
+		proc->state = PS_SLEEPING;
+	}
+	spin_unlock(&wq->lock);
+	/* the caller's check must not go before the entry is visible */
+	SMP_DMB();
+}
+
+void wait_woken(struct wait_entry *wait)
+{
+	/*
+	 * The proc stays asleep, and schedule() skips it, until the waker
+	 * has set @woken and made it runnable.  Outside any proc there is
+	 * nobody to switch to, so we simply wait.
+	 */
+	while (!wait->woken)
+		schedule();
+	SMP_DMB();
+}
+
+void finish_wait(struct waitqueue *wq, struct wait_entry *wait)
+{
+	struct proc *proc = wait->proc;
+
+	if (!wait->woken) {
+		spin_lock(&wq->lock);
+		/* check again, a wakeup may have got in meanwhile */
+		if (!wait->woken)
+			list_del(&wait->node);
+		spin_unlock(&wq->lock);
+	}
+	if (proc != NULL) {
+		proc->bed = NULL;
+		proc->state = PS_ONPROC;
+	}
+}
+
+/* With the queue locked */
+static void __wake_entry(struct wait_entry *wait)
+{
+	struct proc *proc = wait->proc;
+
+	list_del(&wait->node);
+	if (proc != NULL)
+		proc_wakeup(proc);
+	/* the waiter may return and drop its entry as soon as it sees this */
+	SMP_DMB();
+	wait->woken = true;
+}
+
+bool wake_up(struct waitqueue *wq)
+{
+	bool found = false;
+
+	spin_lock(&wq->lock);
+	if (!list_empty(&wq->head)) {
+		__wake_entry(list_first_entry(&wq->head, struct wait_entry,
+		    node));
+		found = true;
+	}
+	spin_unlock(&wq->lock);
+	return found;
+}
+
+void wake_up_all(struct waitqueue *wq)
+{
+	spin_lock(&wq->lock);
+	while (!list_empty(&wq->head))
+		__wake_entry(list_first_entry(&wq->head, struct wait_entry,
+		    node));
+	spin_unlock(&wq->lock);
+}
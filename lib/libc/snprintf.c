@@ -153,6 +153,10 @@ print_uint:			buf_pos = 0;
 				flag |= FLAG_ZEROPAD;
 				++fmt;
 				goto fmt_loop;
+			case 'l':
+				/* integers are always fetched as longs */
+				++fmt;
+				goto fmt_loop;
 			case '1': case '2': case '3':
 			case '4': case '5': case '6':
 			case '7': case '8': case '9':